@@ -11,6 +11,7 @@ export let activeRecordings: string[] = [];
 export let requestsRecieved = 0;
 export let readysRecieved = 0;
 export let cooksStarted = 0;
+export let cooksDeduplicated = 0;
 export const formatsCooked = new Map<string, number>();
 
 export function onRequest(recordingID: string, isReady = false) {
@@ -31,6 +32,10 @@ export function onCookRun(recordingID: string, format: string) {
   formatsCooked.set(format, cookCount);
 }
 
+export function onCookDeduplicated() {
+  cooksDeduplicated++;
+}
+
 async function collect(timestamp = new Date()) {
   if (!process.env.INFLUX_URL || !process.env.INFLUX_TOKEN) return;
 
@@ -42,6 +47,7 @@ async function collect(timestamp = new Date()) {
       .intField('readysRecieved', readysRecieved)
       .intField('recievedUnique', activeRecordings.length)
       .intField('cooksStarted', cooksStarted)
+      .intField('cooksDeduplicated', cooksDeduplicated)
       .timestamp(timestamp || cron.lastDate())
   ];
 
@@ -74,5 +80,6 @@ async function collect(timestamp = new Date()) {
   requestsRecieved = 0;
   readysRecieved = 0;
   cooksStarted = 0;
+  cooksDeduplicated = 0;
   formatsCooked.clear();
 }
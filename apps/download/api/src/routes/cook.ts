@@ -2,18 +2,21 @@ import { captureException, withScope } from '@sentry/node';
 import { RouteOptions } from 'fastify';
 
 import { clearDownload, getDownload } from '../cache';
-import { onCookRun, onRequest } from '../influx';
+import { onCookDeduplicated, onCookRun, onRequest } from '../influx';
 import { ErrorCode } from '../util';
 import {
   allowedAvatarFormats,
   allowedContainers,
   allowedFormats,
+  claimCook,
   cook,
   cookAvatars,
   getDuration,
   getNotes,
   getReady,
-  rawPartwise
+  isCooking,
+  rawPartwise,
+  unclaimCook
 } from '../util/cook';
 import { removeFile, writeToFile } from '../util/download';
 import { getRecording, getUsers, keyMatches } from '../util/recording';
@@ -160,10 +163,6 @@ export const postRoute: RouteOptions = {
     if (!keyMatches(info, key)) return reply.status(403).send({ ok: false, error: 'Invalid key', code: ErrorCode.INVALID_KEY });
     onRequest(id);
 
-    const ready = await getReady(id);
-    if (ready !== true)
-      return reply.status(429).send({ ok: false, error: 'This recording is already being processed', code: ErrorCode.RECORDING_NOT_READY });
-
     const body = request.body as { format?: string; container?: string; dynaudnorm?: boolean };
     if (body.format && !allowedFormats.includes(body.format))
       return reply.status(400).send({ ok: false, error: 'Invalid format', code: ErrorCode.INVALID_FORMAT });
@@ -179,13 +178,24 @@ export const postRoute: RouteOptions = {
 
     const dynaudnorm = Boolean(body.dynaudnorm);
 
+    const ready = await getReady(id);
     const download = await getDownload(id);
-    if (download) {
-      await clearDownload(id);
-      await removeFile(download.file);
+    // Claimed before the last download is cleared away, so that of racing requests, only the one that cooks clears it
+    if (ready !== true || !(await claimCook(id, format, container, dynaudnorm))) {
+      // If it's this very cook, it's already on its way to the download
+      if (await isCooking(id, format, container, dynaudnorm)) {
+        onCookDeduplicated();
+        return reply.status(200).send({ ok: true });
+      }
+      return reply.status(429).send({ ok: false, error: 'This recording is already being processed', code: ErrorCode.RECORDING_NOT_READY });
     }
 
     try {
+      if (download) {
+        await clearDownload(id);
+        await removeFile(download.file);
+      }
+
       onCookRun(id, `${format}.${container}${dynaudnorm ? ':dynaudnorm' : ''}`);
       let ext = allowedContainers[container].ext || `${format}.zip`;
       if (container === 'mix') ext = format === 'vorbis' ? 'ogg' : format;
@@ -195,6 +205,7 @@ export const postRoute: RouteOptions = {
       await writeToFile(stream, id, ext, format, container, dynaudnorm);
       return reply.status(200).send({ ok: true });
     } catch (err) {
+      await unclaimCook(id);
       withScope((scope) => {
         scope.setTag('recordingID', id);
         scope.setTag('format', `${format}.${container}${dynaudnorm ? ':dynaudnorm' : ''}`);
@@ -1,10 +1,14 @@
-import { spawn } from 'child_process';
+import { ChildProcessWithoutNullStreams, spawn } from 'child_process';
 import execa from 'execa';
+import { existsSync } from 'fs';
 import path from 'path';
+import { Readable } from 'stream';
 
 import { clearReadyState, getReadyState, setReadyState } from '../cache';
+import { chooseCookWorker } from './cookWorkers';
 import { registerProcess } from './processManager';
 import { RecordingNote, recPath } from './recording';
+import { claimFlight, flyingKey, landFlight, startFlight } from './singleFlight';
 
 export const cookPath = path.join(__dirname, '..', '..', '..', '..', 'cook');
 export const tmpPath = path.join(__dirname, '..', '..', '..', 'tmp');
@@ -131,22 +135,125 @@ function getStderrReader(state: ReadyState, writeState: (newState: ReadyState) =
   };
 }
 
+interface ToolProgress {
+  tool: string;
+  pid: number;
+  tracks?: number;
+  bytes?: number;
+  total?: number | null;
+  granule?: number;
+  done?: boolean;
+}
+
+// The tools that read a whole track's worth of input, and so measure how far along the cook is
+const trackTools = ['oggcorrect', 'cookengine', 'oggopus'];
+
+function formatTime(seconds: number) {
+  const h = Math.floor(seconds / 3600);
+  const m = Math.floor(seconds / 60) % 60;
+  const s = seconds % 60;
+  return `${String(h).padStart(2, '0')}:${String(m).padStart(2, '0')}:${s.toFixed(2).padStart(5, '0')}`;
+}
+
+/**
+ * Read the JSON lines that the cook tools write to fd 3, giving the progress over every track.
+ */
+function getProgressReader(state: ReadyState, writeState: (newState: ReadyState) => Promise<void>) {
+  const tools = new Map<number, ToolProgress>();
+  let tracks = 1;
+  let partial = '';
+
+  return (buf: Buffer) => {
+    const lines = (partial + buf.toString()).split('\n');
+    partial = lines.pop();
+
+    for (const line of lines) {
+      let report: ToolProgress;
+      try {
+        report = JSON.parse(line);
+      } catch (e) {
+        continue;
+      }
+      if (report.tracks) tracks = report.tracks;
+      else if (trackTools.includes(report.tool)) tools.set(report.pid, report);
+    }
+
+    let bytes = 0;
+    let total = 0;
+    let granule = 0;
+    for (const report of tools.values()) {
+      bytes += report.bytes;
+      total = Math.max(total, report.total || 0);
+      granule = Math.max(granule, report.granule);
+    }
+    if (!total) return;
+
+    // Every track reads the whole recording, so the total's the same for each
+    const progress = Math.min(99, Math.floor((100 * bytes) / (total * Math.max(tracks, tools.size))));
+    writeState({ file: state.file, progress, time: formatTime(granule / 48000) });
+  };
+}
+
+function cookKey(id: string, format: string, container: string, dynaudnorm: boolean) {
+  return `${id}:${format}.${container}${dynaudnorm ? ':dynaudnorm' : ''}`;
+}
+
+export async function isCooking(id: string, format = 'flac', container = 'zip', dynaudnorm = false) {
+  return (await flyingKey(id)) === cookKey(id, format, container, dynaudnorm);
+}
+
+/**
+ * Claim the recording for this cook, before clearing away its last download and calling cook(). Returns false if another
+ * request, on any instance, has it.
+ */
+export function claimCook(id: string, format = 'flac', container = 'zip', dynaudnorm = false) {
+  return claimFlight(id, cookKey(id, format, container, dynaudnorm));
+}
+
+/**
+ * Release a claim that never got as far as a cook. Once the cook has started, it's released when the cook ends.
+ */
+export function unclaimCook(id: string) {
+  return landFlight(id);
+}
+
 export async function cook(id: string, format = 'flac', container = 'zip', dynaudnorm = false) {
+  // With cookd built, the cook runs on its server if it's up (and cookd runs cook.sh itself if not), or another host's
+  const cookdPath = path.join(cookPath, 'cookd');
+  const useCookd = existsSync(cookdPath);
+  const worker = useCookd ? await chooseCookWorker(id) : null;
+
   const [state, writeState, deleteState] = stateManager(id);
 
   try {
+    const cookingPath = useCookd ? cookdPath : path.join(cookPath, '..', 'cook.sh');
+    // fd 3 is for progress reports from the cook tools
+    const args = [
+      ...(worker ? ['-c', worker] : []),
+      ...(useCookd ? ['cook'] : []),
+      '--progress-fd',
+      '3',
+      id,
+      format,
+      container,
+      ...(dynaudnorm ? ['dynaudnorm'] : [])
+    ];
+    const child = spawn(cookingPath, args, { detached: true, stdio: ['pipe', 'pipe', 'pipe', 'pipe'] }) as ChildProcessWithoutNullStreams;
+    console.log(`Cooking ${id} (${format}.${container}${dynaudnorm ? ' dynaudnorm' : ''}) with process ${child.pid}${worker ? ` on ${worker}` : ''}`);
+    startFlight(id, child);
+    registerProcess(child, () => {
+      landFlight(id, child);
+      return deleteState();
+    });
     await writeState({ message: 'Starting...' });
-    const cookingPath = path.join(cookPath, '..', 'cook.sh');
-    const args = [id, format, container, ...(dynaudnorm ? ['dynaudnorm'] : [])];
-    const child = spawn(cookingPath, args, { detached: true });
-    console.log(`Cooking ${id} (${format}.${container}${dynaudnorm ? ' dynaudnorm' : ''}) with process ${child.pid}`);
-    registerProcess(child, deleteState);
 
     // Prevent the stream from ending prematurely (for some reason)
     child.stderr.on('data', getStderrReader(state, writeState));
+    (child.stdio[3] as Readable).on('data', getProgressReader(state, writeState));
 
     return child.stdout;
   } catch (e) {
+    landFlight(id);
     deleteState();
     throw e;
   }
@@ -0,0 +1,85 @@
+import net from 'net';
+
+// Other hosts' cook servers (cookd -l), as host:port, comma-separated
+const workers = (process.env.COOK_WORKERS || '')
+  .split(',')
+  .map((worker) => worker.trim())
+  .filter((worker) => worker);
+
+// How long to wait for a worker's metrics before leaving it out
+const STAT_TIMEOUT = 1000;
+
+interface WorkerStats {
+  workers: number;
+  busy: number;
+  queued: number;
+  cpus: number;
+  loadAvg: number;
+  // Whether it can read the recording, on its own disk or a shared one
+  local?: boolean;
+}
+
+/**
+ * Ask a cook server for its metrics, and whether it has the recording. Messages over TCP are preceded by their length.
+ */
+function getWorkerStats(worker: string, id: string): Promise<WorkerStats | null> {
+  return new Promise((resolve) => {
+    const sep = worker.lastIndexOf(':');
+    const socket = net.connect({ host: worker.slice(0, sep).replace(/^\[(.*)\]$/, '$1'), port: parseInt(worker.slice(sep + 1), 10) });
+    let buf = Buffer.alloc(0);
+
+    const done = (stats: WorkerStats | null) => {
+      socket.destroy();
+      resolve(stats);
+    };
+    socket.setTimeout(STAT_TIMEOUT, () => done(null));
+    socket.on('error', () => done(null));
+    socket.on('close', () => done(null));
+    socket.on('connect', () => {
+      const msg = Buffer.from(`S${id}`);
+      const len = Buffer.alloc(4);
+      len.writeUInt32BE(msg.length);
+      socket.write(Buffer.concat([len, msg]));
+    });
+    socket.on('data', (chunk: Buffer) => {
+      buf = Buffer.concat([buf, chunk]);
+      if (buf.length < 4 || buf.length < 4 + buf.readUInt32BE(0)) return;
+      const msg = buf.subarray(4, 4 + buf.readUInt32BE(0)).toString();
+      try {
+        done(msg[0] === 'S' ? JSON.parse(msg.slice(1)) : null);
+      } catch (e) {
+        done(null);
+      }
+    });
+  });
+}
+
+// How busy a worker is, as the share of its slots in use or waited for
+function workerLoad(stats: WorkerStats) {
+  return (stats.busy + stats.queued) / Math.max(stats.workers, 1);
+}
+
+/**
+ * Choose which cook server to cook a recording on: of those that can read the recording, the least busy. Null if there
+ * are no workers configured, or none that answered can, to cook here.
+ */
+export async function chooseCookWorker(id: string): Promise<string | null> {
+  if (!workers.length) return null;
+
+  const stats = await Promise.all(workers.map((worker) => getWorkerStats(worker, id)));
+  let best: string | null = null;
+  let bestStats: WorkerStats | null = null;
+  for (let i = 0; i < workers.length; i++) {
+    const s = stats[i];
+    if (!s || !s.local) continue;
+    if (bestStats) {
+      if (workerLoad(s) > workerLoad(bestStats)) continue;
+      // Between equally busy servers, the one whose host is least loaded by everything else
+      if (workerLoad(s) === workerLoad(bestStats) && s.loadAvg / Math.max(s.cpus, 1) >= bestStats.loadAvg / Math.max(bestStats.cpus, 1))
+        continue;
+    }
+    best = workers[i];
+    bestStats = s;
+  }
+  return best;
+}
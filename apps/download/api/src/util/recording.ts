@@ -98,11 +98,22 @@ export async function getRecording(id: string): Promise<RecordingInfo | false> {
 export async function deleteRecording(id: string): Promise<void> {
   const keyExists = await fileExists(path.join(recPath, `${id}.ogg.key`));
   const featsExists = await fileExists(path.join(recPath, `${id}.ogg.features`));
+  const indexExists = await fileExists(path.join(recPath, `${id}.ogg.index`));
   await Promise.all(
-    ['data', 'header1', 'header2', ...(keyExists ? ['key'] : []), ...(featsExists ? ['features'] : [])].map((ext) =>
-      fs.unlink(path.join(recPath, `${id}.ogg.${ext}`))
-    )
+    [
+      'data',
+      'header1',
+      'header2',
+      ...(keyExists ? ['key'] : []),
+      ...(featsExists ? ['features'] : []),
+      ...(indexExists ? ['index'] : [])
+    ].map((ext) => fs.unlink(path.join(recPath, `${id}.ogg.${ext}`)))
   );
+
+  // And its finished cooks, named by the recording ID and a hash (see cook/cookcache.c)
+  const cachePath = path.join(recPath, 'cache');
+  const cacheFiles = await fs.readdir(cachePath).catch(() => [] as string[]);
+  await Promise.all(cacheFiles.filter((file) => file.startsWith(`${id}-`)).map((file) => fs.unlink(path.join(cachePath, file)).catch(() => {})));
 }
 
 export async function getUsers(id: string): Promise<RecordingUser[]> {
@@ -0,0 +1,142 @@
+import { ChildProcessWithoutNullStreams } from 'child_process';
+import { link, readFile, rename, unlink, writeFile } from 'fs/promises';
+import path from 'path';
+
+import { recPath } from './recording';
+
+/*
+ * A recording only has one cook (and one download) at a time, across every instance of this app. The cook's claim is a
+ * lock file, rec/<id>.ogg.cooking, holding which cook it is and the process that claimed it.
+ */
+
+// A cook that's running, or about to be: which cook it is, and its process once it has one
+interface Flight {
+  key: string;
+  child?: ChildProcessWithoutNullStreams;
+}
+
+interface FlightLock {
+  key: string;
+  pid: number;
+}
+
+// The claims this instance holds
+const flights = new Map<string, Flight>();
+
+function lockPath(id: string) {
+  return path.join(recPath, `${id}.ogg.cooking`);
+}
+
+// The lock's content, and what it says if it makes sense, or null if there's no lock
+async function readLock(id: string): Promise<{ content: string; lock?: FlightLock } | null> {
+  let content: string;
+  try {
+    content = await readFile(lockPath(id), 'utf8');
+  } catch (e) {
+    return null;
+  }
+  try {
+    return { content, lock: JSON.parse(content) };
+  } catch (e) {
+    return { content };
+  }
+}
+
+function isAlive(pid: number) {
+  try {
+    process.kill(pid, 0);
+    return true;
+  } catch (e) {
+    return e.code === 'EPERM';
+  }
+}
+
+/**
+ * Remove a lock left by an instance that died. It's moved aside first, so that if two instances both find it stale,
+ * only one removes it, and neither removes a claim made since.
+ */
+async function breakLock(id: string, content: string) {
+  const aside = `${lockPath(id)}-${process.pid}-stale`;
+  try {
+    await rename(lockPath(id), aside);
+  } catch (e) {
+    return;
+  }
+  // If it's not the lock we found stale, someone claimed it in the meantime, so put it back
+  const moved = await readFile(aside, 'utf8').catch(() => content);
+  if (moved !== content) await link(aside, lockPath(id)).catch(() => {});
+  await unlink(aside).catch(() => {});
+}
+
+/**
+ * Take the lock file. It's written aside and linked into place, so it's never seen half-written, and the link fails if
+ * it's there already.
+ */
+async function takeLock(id: string, key: string) {
+  const pending = `${lockPath(id)}-${process.pid}`;
+  await writeFile(pending, JSON.stringify({ key, pid: process.pid }));
+  try {
+    for (let tries = 0; tries < 2; tries++) {
+      try {
+        await link(pending, lockPath(id));
+        return true;
+      } catch (e) {
+        if (e.code !== 'EEXIST') throw e;
+      }
+
+      // Claimed, unless by an instance that's gone
+      const held = await readLock(id);
+      if (held && held.lock && isAlive(held.lock.pid)) return false;
+      if (held) await breakLock(id, held.content);
+    }
+    return false;
+  } finally {
+    await unlink(pending).catch(() => {});
+  }
+}
+
+/**
+ * The key of the cook running for this recording, if there is one, on any instance.
+ */
+export async function flyingKey(id: string): Promise<string | null> {
+  const flight = flights.get(id);
+  if (flight) return flight.key;
+  const held = await readLock(id);
+  return held && held.lock && isAlive(held.lock.pid) ? held.lock.key : null;
+}
+
+/**
+ * Claim a recording for a cook. Of any requests racing for the same recording, on any instance, only one gets it.
+ * Returns false if it's already claimed.
+ */
+export async function claimFlight(id: string, key: string) {
+  // Held here while we take the lock, so that other requests here don't race us for it
+  if (flights.has(id)) return false;
+  flights.set(id, { key });
+  try {
+    if (await takeLock(id, key)) return true;
+  } catch (e) {
+    flights.delete(id);
+    throw e;
+  }
+  flights.delete(id);
+  return false;
+}
+
+/**
+ * Give a claimed cook its process.
+ */
+export function startFlight(id: string, child: ChildProcessWithoutNullStreams) {
+  const flight = flights.get(id);
+  if (flight && !flight.child) flight.child = child;
+}
+
+/**
+ * Release a claim, once its cook is done or been killed, or if it never got a process (with no child given).
+ */
+export async function landFlight(id: string, child?: ChildProcessWithoutNullStreams) {
+  const flight = flights.get(id);
+  if (!flight || flight.child !== child) return;
+  flights.delete(id);
+  await unlink(lockPath(id)).catch(() => {});
+}
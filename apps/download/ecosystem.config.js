@@ -14,6 +14,13 @@ module.exports = {
       env_production: {
         NODE_ENV: 'production'
       }
+    },
+    {
+      name: 'cookd',
+      script: '../../cook/cookd',
+      args: 'serve',
+      interpreter: 'none',
+      kill_timeout: 3000
     }
   ]
 };
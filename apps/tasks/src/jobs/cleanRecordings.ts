@@ -21,6 +21,9 @@ export default class CleanRecordings extends TaskJob {
     if (recordingConfig.skipAll) return;
     const recPath = path.join(__dirname, '..', '..', recordingConfig.path);
     const files = await readdir(recPath);
+    // Finished cooks, named by the recording ID and a hash (see cook/cookcache.c)
+    const cachePath = path.join(recPath, 'cache');
+    const cacheFiles = await readdir(cachePath).catch(() => [] as string[]);
     const recordingExts: { [file: string]: string[] } = {};
 
     for (const file of files) {
@@ -58,6 +61,9 @@ export default class CleanRecordings extends TaskJob {
         if (shouldExpire) {
           this.logger.log(`Deleting ${id}.`);
           await Promise.all(types.map((type) => unlink(path.join(recPath, `${id}.ogg.${type}`))));
+          await Promise.all(
+            cacheFiles.filter((file) => file.startsWith(`${id}-`)).map((file) => unlink(path.join(cachePath, file)).catch(() => {}))
+          );
         }
       } catch (e) {
         this.logger.error(`Failed to read info file for ${id}.`, types);
@@ -87,22 +87,44 @@ exec 9< "$1.ogg.data"
 flock -s 9
 
 NICE="nice -n10 ionice -c3 chrt -i 0"
-CODECS=`timeout 10 "$SCRIPTBASE/cook/oggtracks" < $1.ogg.header1`
-NB_STREAMS=`echo "$CODECS" | wc -l`
-DURATION=`timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/cook/oggduration" < $1.ogg.data`
+PLAN=`timeout 10 "$SCRIPTBASE/cook/cookplan" plan $1`
+TAB=`printf '\t'`
+DURATIONS=`timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/cook/oggduration" --all -- "$1.ogg.data"`
+DURATION=`echo "$DURATIONS" | awk -F '\t' '$1 == "*" { print $3 }'`
+
+# cookzip reads every file at once, so with it, the tracks can wait their turn
+# in cooksched, along with every other cook's tracks. zip reads them in order,
+# so they can't.
+ZIP=zip
+ZIPOUT="-FI -"
+SCHED=
+SCHED_SLOTS=8 # As in cook.sh, since they share them
+if [ -x "$SCRIPTBASE/cook/cookzip" ]
+then
+    ZIP="$SCRIPTBASE/cook/cookzip"
+    ZIPOUT=
+    [ ! -x "$SCRIPTBASE/cook/cooksched" ] || SCHED="$SCRIPTBASE/cook/cooksched"
+fi
 
 TRACKS=
 
 # Make the png files
-for c in `seq -w 1 $NB_STREAMS`
+while IFS="$TAB" read -r c sno CODEC O_AVATAR O_USER
 do
-    O_USER="`$SCRIPTBASE/cook/userinfo.js $1 $c`"
+    [ "$c" ] || continue
     [ "$O_USER" ] || unset O_USER
     TRACKS="$TRACKS $c${O_USER+-}$O_USER"
     O_FN="$c${O_USER+-}$O_USER.png"
     O_FFN="$tmpdir/in/$O_FN"
-    "$SCRIPTBASE/cook/userinfo.js" $1 $c avatar datauri > "$O_FFN" || convert -size 128x128 xc:black "$O_FFN"
-done
+    if [ "$O_AVATAR" = "1" ]
+    then
+        "$SCRIPTBASE/cook/cookplan" user $1 $c avatar datauri > "$O_FFN" || convert -size 128x128 xc:black "$O_FFN"
+    else
+        convert -size 128x128 xc:black "$O_FFN"
+    fi
+done << EOF
+$PLAN
+EOF
 
 FILES=
 
@@ -220,19 +242,25 @@ else
         fi
 
         # Now perform the conversion
-        timeout $DEF_TIMEOUT cat $1.ogg.header1 $1.ogg.header2 $1.ogg.data \
-            $1.ogg.header1 $1.ogg.header2 $1.ogg.data |
-            timeout $DEF_TIMEOUT "$SCRIPTBASE/cook/oggcorrect" $c |
-            timeout $DEF_TIMEOUT $NICE ffmpeg \
-                -framerate 30 -i "$SCRIPTBASE/cook/glower-avatar.png" \
-                -framerate 30 -i "$SCRIPTBASE/cook/glower-glow.png" \
-                -codec libopus -copyts -i - \
-                -framerate 30 -i "$I_FFN" \
-                -filter_complex "$FILTER" \
-                -map '[vid]' \
-                $CODEC \
-                -t "$DURATION" \
-                -y "$O_FFN" &
+        T_BYTES=`echo "$DURATIONS" | awk -F '\t' -v s="$c" '
+            $1 == s + 0 { b = $4 }
+            END { print b + 0 }'`
+        (
+            [ ! "$SCHED" ] || "$SCHED" -j $SCHED_SLOTS wait "$1" "$T_BYTES" || true
+            timeout $DEF_TIMEOUT "$SCRIPTBASE/cook/oggcorrect" $c \
+                $1.ogg.header1 $1.ogg.header2 $1.ogg.data |
+                timeout $DEF_TIMEOUT $NICE ffmpeg \
+                    -framerate 30 -i "$SCRIPTBASE/cook/glower-avatar.png" \
+                    -framerate 30 -i "$SCRIPTBASE/cook/glower-glow.png" \
+                    -codec libopus -copyts -i - \
+                    -framerate 30 -i "$I_FFN" \
+                    -filter_complex "$FILTER" \
+                    -map '[vid]' \
+                    $CODEC \
+                    -t "$DURATION" \
+                    -y "$O_FFN"
+            [ ! "$SCHED" ] || "$SCHED" done || true
+        ) &
 
         # Support special stuff for special formats
         if [ "$TRANSPARENT" -a "$FORMAT" = "mkvh264" ]
@@ -281,11 +309,11 @@ fi
 [ "$FORMAT" = "png" ] && cd "$tmpdir/in" || cd "$tmpdir/out"
 case "$CONTAINER" in
     exe)
-        ( timeout $DEF_TIMEOUT $NICE zip -1 -FI - $FILES || true ) |
+        ( timeout $DEF_TIMEOUT $NICE $ZIP -1 $ZIPOUT $FILES || true ) |
         cat "$SCRIPTBASE/cook/sfx.exe" -
         ;;
     *)
-        timeout $DEF_TIMEOUT $NICE zip -1 -FI - $FILES || true
+        timeout $DEF_TIMEOUT $NICE $ZIP -1 $ZIPOUT $FILES || true
         ;;
 esac | (cat || cat > /dev/null)
 
@@ -0,0 +1,466 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* cookcache keeps finished cooks, so that cooking the same recording the same
+ * way again is just a copy. Entries are named by a key made from the
+ * recording's ID, the sizes and modification times of its files (including
+ * the info and users files, which go into info.txt and the file names), and
+ * the cook's parameters, so a recording that changes simply gets new keys, and
+ * its old entries age out. Entries are written under a temporary name and
+ * renamed into place only when the cook is complete, so a reader never sees a
+ * partial one. Each hit marks its entry as used (by its access time, which we
+ * set ourselves, since the file system may not), and the least recently used
+ * entries are removed whenever the cache is over its budget. */
+
+#define _GNU_SOURCE // For O_NOATIME
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BUF_SIZE (64*1024)
+
+// Default budget, in bytes
+#define DEFAULT_BUDGET (10ULL*1024*1024*1024)
+
+// Temporary files older than this (in seconds) are left over from a crash
+#define STALE_TEMP (24*60*60)
+
+/* Part of every key. Bump it when what a cook makes changes (a new tool, or
+ * a tool's output changing), so that no entry cooked the old way is used. */
+#define KEY_VERSION 1
+
+struct CacheFile {
+    char *name;
+    uint64_t size;
+    struct timespec atime;
+};
+
+static const char *cacheDir = "cache";
+static uint64_t budget = DEFAULT_BUDGET;
+
+// FNV-1a, over everything that goes into a key
+static void hashBytes(uint64_t *hash, const void *vbuf, size_t len)
+{
+    const unsigned char *buf = vbuf;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        *hash ^= buf[i];
+        *hash *= 0x100000001b3ULL;
+    }
+}
+
+static void hashString(uint64_t *hash, const char *str)
+{
+    // Including the terminator, so that "a" "bc" differs from "ab" "c"
+    hashBytes(hash, str, strlen(str) + 1);
+}
+
+// Print the key for this recording and these parameters
+static int key(const char *id, int paramCt, char **params)
+{
+    static const char *suffixes[] = {".ogg.header1", ".ogg.header2", ".ogg.data",
+        ".ogg.info", ".ogg.users", NULL};
+    static const int required = 3;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint32_t version = KEY_VERSION;
+    const char *c;
+    char *path;
+    int i;
+
+    // The ID is part of the name, so must be safe as one
+    if (!id[0])
+        return 1;
+    for (c = id; *c; c++) {
+        if (!((*c >= '0' && *c <= '9') || (*c >= 'A' && *c <= 'Z') ||
+              (*c >= 'a' && *c <= 'z') || *c == '_' || *c == '-'))
+            return 1;
+    }
+    hashBytes(&hash, &version, sizeof(version));
+    hashString(&hash, id);
+
+    path = malloc(strlen(id) + 16);
+    if (!path) {
+        perror("malloc");
+        exit(1);
+    }
+    for (i = 0; suffixes[i]; i++) {
+        struct stat sbuf;
+        int64_t fields[3] = {-1, 0, 0};
+        sprintf(path, "%s%s", id, suffixes[i]);
+        if (stat(path, &sbuf) == 0) {
+            fields[0] = sbuf.st_size;
+            fields[1] = sbuf.st_mtim.tv_sec;
+            fields[2] = sbuf.st_mtim.tv_nsec;
+        } else if (i < required) {
+            perror(path);
+            exit(1);
+        }
+        hashBytes(&hash, fields, sizeof(fields));
+    }
+    free(path);
+
+    for (i = 0; i < paramCt; i++)
+        hashString(&hash, params[i]);
+
+    printf("%s-%016llx\n", id, (unsigned long long) hash);
+    return 0;
+}
+
+// A key, as given to get or put, must be one we'd make
+static void checkKey(const char *key)
+{
+    const char *c;
+    if (!key[0] || key[0] == '.' || strchr(key, '/')) {
+        fprintf(stderr, "cookcache: Invalid key %s\n", key);
+        exit(1);
+    }
+    for (c = key; *c; c++) {
+        if (*c < ' ' || *c > '~') {
+            fprintf(stderr, "cookcache: Invalid key %s\n", key);
+            exit(1);
+        }
+    }
+}
+
+static char *cachePath(const char *name)
+{
+    char *path = malloc(strlen(cacheDir) + strlen(name) + 2);
+    if (!path) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(path, "%s/%s", cacheDir, name);
+    return path;
+}
+
+/* Send an entry to stdout, if we have it. Returns 0 if we did, 1 if we don't
+ * have it (and have written nothing), and 2 if we failed partway. */
+static int get(const char *key)
+{
+    static const struct timespec touch[2] = {{0, UTIME_NOW}, {0, UTIME_OMIT}};
+    struct stat sbuf;
+    char *path, *buf;
+    off_t off = 0;
+    ssize_t rd;
+    int fd;
+
+    checkKey(key);
+    path = cachePath(key);
+    fd = open(path, O_RDONLY | O_NOATIME);
+    if (fd < 0 && errno == EPERM)
+        fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0)
+        return 1;
+    if (fstat(fd, &sbuf) < 0)
+        return 1;
+
+    // Mark it used now, so that it's the last to be evicted
+    futimens(fd, touch);
+
+    // Straight from the page cache to the client
+    while (off < sbuf.st_size) {
+        rd = sendfile(1, fd, &off, sbuf.st_size - off);
+        if (rd < 0 && errno == EINTR)
+            continue;
+        if (rd < 0 && off == 0 && (errno == EINVAL || errno == ENOSYS))
+            break;
+        if (rd <= 0)
+            return off ? 2 : 1;
+    }
+    if (off >= sbuf.st_size)
+        return 0;
+
+    // sendfile can't write to this, so copy it ourselves
+    buf = malloc(BUF_SIZE);
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+    while ((rd = read(fd, buf, BUF_SIZE)) > 0) {
+        char *wbuf = buf;
+        while (rd > 0) {
+            ssize_t wr = write(1, wbuf, rd);
+            if (wr < 0 && errno == EINTR)
+                continue;
+            if (wr <= 0)
+                return 2;
+            off += wr;
+            wbuf += wr;
+            rd -= wr;
+        }
+    }
+    return (off == sbuf.st_size) ? 0 : 2;
+}
+
+static int compareAtime(const void *lv, const void *rv)
+{
+    const struct CacheFile *l = lv, *r = rv;
+    if (l->atime.tv_sec != r->atime.tv_sec)
+        return (l->atime.tv_sec < r->atime.tv_sec) ? -1 : 1;
+    if (l->atime.tv_nsec != r->atime.tv_nsec)
+        return (l->atime.tv_nsec < r->atime.tv_nsec) ? -1 : 1;
+    return 0;
+}
+
+// Remove the least recently used entries until we're within budget
+static void evict()
+{
+    struct CacheFile *files = NULL;
+    size_t fileCt = 0, fileSz = 0, i;
+    uint64_t total = 0;
+    struct dirent *de;
+    DIR *dh;
+    int dfd;
+    time_t now = time(NULL);
+
+    dh = opendir(cacheDir);
+    if (!dh)
+        return;
+    dfd = dirfd(dh);
+
+    while ((de = readdir(dh))) {
+        struct stat sbuf;
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        if (fstatat(dfd, de->d_name, &sbuf, AT_SYMLINK_NOFOLLOW) < 0 ||
+            !S_ISREG(sbuf.st_mode))
+            continue;
+
+        if (de->d_name[0] == '.') {
+            // A cook in progress, or one that never finished
+            if (now - sbuf.st_mtime > STALE_TEMP)
+                unlinkat(dfd, de->d_name, 0);
+            else
+                total += sbuf.st_blocks * 512;
+            continue;
+        }
+
+        if (fileCt >= fileSz) {
+            fileSz = fileSz ? fileSz * 2 : 64;
+            files = realloc(files, fileSz * sizeof(struct CacheFile));
+            if (!files) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        files[fileCt].name = strdup(de->d_name);
+        if (!files[fileCt].name) {
+            perror("strdup");
+            exit(1);
+        }
+        files[fileCt].size = sbuf.st_blocks * 512;
+        files[fileCt].atime = sbuf.st_atim;
+        total += files[fileCt].size;
+        fileCt++;
+    }
+
+    if (total > budget) {
+        qsort(files, fileCt, sizeof(struct CacheFile), compareAtime);
+        for (i = 0; i < fileCt && total > budget; i++) {
+            /* If another eviction got to it first, it's gone all the same.
+             * Anyone still reading it keeps reading it. */
+            unlinkat(dfd, files[i].name, 0);
+            total -= files[i].size;
+        }
+    }
+
+    for (i = 0; i < fileCt; i++)
+        free(files[i].name);
+    free(files);
+    closedir(dh);
+}
+
+/* Copy stdin to stdout, and into the cache. It's only published if the cook
+ * finished, which the cook says by creating doneFile before its output ends.
+ * If the client goes away, we keep reading, so the cook isn't interrupted,
+ * and it's still cached. */
+static int put(const char *key, const char *doneFile)
+{
+    char *path, *tmpPath, *tmpName, *buf;
+    int fd, out = 1;
+    ssize_t rd;
+
+    checkKey(key);
+    signal(SIGPIPE, SIG_IGN);
+    if (mkdir(cacheDir, 0777) < 0 && errno != EEXIST)
+        perror(cacheDir);
+
+    path = cachePath(key);
+    tmpName = malloc(strlen(key) + 32);
+    if (!tmpName) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(tmpName, ".%s.%d", key, (int) getpid());
+    tmpPath = cachePath(tmpName);
+    free(tmpName);
+    fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        perror(tmpPath);
+
+    buf = malloc(BUF_SIZE);
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+
+    while ((rd = read(0, buf, BUF_SIZE)) != 0) {
+        if (rd < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("stdin");
+            break;
+        }
+
+        if (out >= 0) {
+            char *wbuf = buf;
+            ssize_t left = rd;
+            while (left > 0) {
+                ssize_t wr = write(out, wbuf, left);
+                if (wr < 0 && errno == EINTR)
+                    continue;
+                if (wr <= 0) {
+                    out = -1;
+                    break;
+                }
+                wbuf += wr;
+                left -= wr;
+            }
+        }
+
+        if (fd >= 0) {
+            char *wbuf = buf;
+            ssize_t left = rd;
+            while (left > 0) {
+                ssize_t wr = write(fd, wbuf, left);
+                if (wr < 0 && errno == EINTR)
+                    continue;
+                if (wr <= 0) {
+                    // Probably out of space. Just don't cache it.
+                    perror(tmpPath);
+                    close(fd);
+                    unlink(tmpPath);
+                    fd = -1;
+                    break;
+                }
+                wbuf += wr;
+                left -= wr;
+            }
+        }
+    }
+    if (out >= 0)
+        close(out);
+
+    if (fd >= 0) {
+        if (rd == 0 && access(doneFile, F_OK) == 0 &&
+            fdatasync(fd) == 0 && close(fd) == 0) {
+            if (rename(tmpPath, path) < 0) {
+                perror(path);
+                unlink(tmpPath);
+            }
+        } else {
+            close(fd);
+            unlink(tmpPath);
+        }
+    }
+    free(tmpPath);
+    free(path);
+
+    evict();
+    return 0;
+}
+
+// Parse a size with an optional K, M, G or T suffix
+static int parseSize(const char *arg, uint64_t *size)
+{
+    char *end;
+    unsigned long long val = strtoull(arg, &end, 10);
+    int shift = 0;
+    if (end == arg)
+        return 0;
+    switch (*end) {
+        case 'T': case 't': shift += 10; /* fallthrough */
+        case 'G': case 'g': shift += 10; /* fallthrough */
+        case 'M': case 'm': shift += 10; /* fallthrough */
+        case 'K': case 'k': shift += 10; end++; /* fallthrough */
+        case 0: break;
+        default: return 0;
+    }
+    if (*end)
+        return 0;
+    *size = (uint64_t) val << shift;
+    return 1;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Use: cookcache [-d <dir>] [-b <budget>] <command>\n"
+                    "Commands:\n"
+                    "  key <ID> <parameters...>: Print the key for this recording (in the\n"
+                    "      current directory) cooked with these parameters.\n"
+                    "  get <key>: Write the entry to stdout. Exits 1 if there isn't one, or 2\n"
+                    "      if it failed after writing some of it.\n"
+                    "  put <key> <done file>: Copy stdin to stdout, and cache it, if done\n"
+                    "      file exists when it ends.\n"
+                    "  evict: Remove the least recently used entries until within budget.\n"
+                    "The cache is in the directory \"cache\", or as -d says, and its budget\n"
+                    "is 10G, or as -b says.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int ai;
+
+    for (ai = 1; ai < argc && argv[ai][0] == '-'; ai++) {
+        const char *arg = argv[ai];
+        if (!strcmp(arg, "-d") && ai + 1 < argc) {
+            cacheDir = argv[++ai];
+        } else if (!strcmp(arg, "-b") && ai + 1 < argc) {
+            if (!parseSize(argv[++ai], &budget))
+                usage();
+        } else {
+            usage();
+        }
+    }
+    if (ai >= argc)
+        usage();
+
+    if (!strcmp(argv[ai], "key") && ai + 1 < argc) {
+        return key(argv[ai + 1], argc - ai - 2, argv + ai + 2);
+    } else if (!strcmp(argv[ai], "get") && ai + 2 == argc) {
+        return get(argv[ai + 1]);
+    } else if (!strcmp(argv[ai], "put") && ai + 3 == argc) {
+        return put(argv[ai + 1], argv[ai + 2]);
+    } else if (!strcmp(argv[ai], "evict") && ai + 1 == argc) {
+        evict();
+        return 0;
+    }
+    usage();
+    return 1;
+}
@@ -0,0 +1,1227 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* cookd is a long-running cook server, so that a cook doesn't have to start
+ * from nothing. It listens on a Unix socket for cook requests, queues them,
+ * and hands each to one of a pool of workers forked when it starts, which runs
+ * the cook (with cookdriver) and tells the client how it went. While a request
+ * waits its turn, the recording is read ahead, so that it's in the page cache
+ * when its worker gets to it.
+ *
+ * The socket is SOCK_SEQPACKET, so every message is one packet, starting with
+ * its type:
+ *  C<ID>\0<format>\0<container>\0[dynaudnorm\0]: Cook, to the fds passed
+ *      with it (output, then optionally progress), or if none were passed,
+ *      back over the socket.
+ *  K: Cancel the cook (as does leaving).
+ *  S[<ID>]: Ask for the queue and latency metrics, as a JSON S message, with
+ *      whether the recording is here, if given its ID.
+ * and back to the client:
+ *  D<data>, P<progress>: The output and progress, if not passed fds.
+ *  E<status>: The cook is done, with this exit status.
+ *  X<message>: The request was refused.
+ * The workers get the same C message, with the client's socket passed before
+ * its fds, and answer with E<status> <run time in ns>.
+ *
+ * So that cook servers on other hosts can share the load, a server can also
+ * listen on TCP (-l), for the same messages, but with each preceded by its
+ * length, as 4 bytes big-endian, since TCP doesn't keep them apart. No fds
+ * can be passed over TCP, so the output and progress always come back over
+ * the connection. There's no authentication, so only listen on a private
+ * network. */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MSG_MAX 65536
+#define REQ_MAX 1024
+#define MAX_FDS 3
+
+#define DEF_WORKERS 4
+#define DEF_QUEUE 1024
+
+struct Worker {
+    pid_t pid;
+    int fd;
+    int busy;
+};
+
+struct Conn {
+    int fd;
+    int stream; // TCP, so framed
+    unsigned char in[4 + REQ_MAX]; // The request as it's read, if framed
+    size_t inLen;
+    int queued;
+    uint64_t seq;
+    uint64_t since; // In ns
+    char req[REQ_MAX];
+    size_t reqLen;
+    int fds[MAX_FDS - 1];
+    int fdCt;
+};
+
+static char scriptBase[PATH_MAX];
+static const char *sockPath, *listenAddr, *serverAddr;
+
+static struct Worker *workers;
+static int workerCt;
+
+static struct Conn *conns;
+static size_t connCt, connSize;
+static uint64_t connSeq;
+static size_t maxQueue = DEF_QUEUE;
+
+// Since we started
+static struct {
+    uint64_t start;
+    uint64_t accepted, rejected, cancelled, done, failed, respawned;
+    uint64_t waitTotal, waitMax, runTotal, runMax;
+} stats;
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Send a message, with these fds
+static ssize_t sendMsg(int sock, const void *buf, size_t len, const int *fds, int fdCt)
+{
+    struct msghdr msg = {0};
+    struct iovec iov;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * (MAX_FDS + 1))];
+        struct cmsghdr align;
+    } cbuf;
+    ssize_t ret;
+
+    iov.iov_base = (void *) buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fdCt) {
+        struct cmsghdr *cmsg;
+        memset(&cbuf, 0, sizeof(cbuf));
+        msg.msg_control = cbuf.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fdCt);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdCt);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdCt);
+    }
+    while ((ret = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+    return ret;
+}
+
+// Receive a message, and any fds with it (up to *fdCt)
+static ssize_t recvMsg(int sock, void *buf, size_t len, int *fds, int *fdCt)
+{
+    struct msghdr msg = {0};
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * (MAX_FDS + 1))];
+        struct cmsghdr align;
+    } cbuf;
+    int maxFds = *fdCt;
+    ssize_t ret;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf.buf;
+    msg.msg_controllen = sizeof(cbuf.buf);
+    *fdCt = 0;
+    while ((ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+    if (ret < 0)
+        return ret;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        int *in = (int *) CMSG_DATA(cmsg);
+        int ct, i;
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        ct = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (i = 0; i < ct; i++) {
+            if (*fdCt < maxFds)
+                fds[(*fdCt)++] = in[i];
+            else
+                close(in[i]);
+        }
+    }
+
+    // A message too big for us is as bad as none
+    if (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) {
+        while (*fdCt)
+            close(fds[--*fdCt]);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return ret;
+}
+
+static int writeAll(int fd, const void *buf, size_t len)
+{
+    const char *cbuf = buf;
+    while (len) {
+        ssize_t wr = send(fd, cbuf, len, MSG_NOSIGNAL);
+        if (wr < 0 && errno == EINTR)
+            continue;
+        if (wr <= 0)
+            return -1;
+        cbuf += wr;
+        len -= wr;
+    }
+    return 0;
+}
+
+static int readAll(int fd, void *buf, size_t len)
+{
+    char *cbuf = buf;
+    while (len) {
+        ssize_t rd = read(fd, cbuf, len);
+        if (rd < 0 && errno == EINTR)
+            continue;
+        if (rd <= 0)
+            return -1;
+        cbuf += rd;
+        len -= rd;
+    }
+    return 0;
+}
+
+// Send a message with no fds, framed if it's over a stream
+static ssize_t sendPacket(int sock, int stream, const void *buf, size_t len)
+{
+    unsigned char hdr[4];
+    if (!stream)
+        return sendMsg(sock, buf, len, NULL, 0);
+    hdr[0] = len >> 24;
+    hdr[1] = len >> 16;
+    hdr[2] = len >> 8;
+    hdr[3] = len;
+    if (writeAll(sock, hdr, 4) < 0 || writeAll(sock, buf, len) < 0)
+        return -1;
+    return len;
+}
+
+// Receive a message with no fds, framed if it's over a stream
+static ssize_t recvPacket(int sock, int stream, void *buf, size_t len)
+{
+    unsigned char hdr[4];
+    uint32_t msgLen;
+    int none = 0;
+
+    if (!stream)
+        return recvMsg(sock, buf, len, NULL, &none);
+    if (readAll(sock, hdr, 4) < 0)
+        return 0;
+    msgLen = ((uint32_t) hdr[0] << 24) | (hdr[1] << 16) | (hdr[2] << 8) | hdr[3];
+    if (msgLen > len) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (readAll(sock, buf, msgLen) < 0)
+        return 0;
+    return msgLen;
+}
+
+static void sendText(int sock, int stream, char type, const char *text)
+{
+    char buf[REQ_MAX];
+    int len = snprintf(buf, sizeof(buf), "%c%s", type, text);
+    if (len >= (int) sizeof(buf))
+        len = sizeof(buf) - 1;
+    sendPacket(sock, stream, buf, len);
+}
+
+static int isStream(int sock)
+{
+    int type;
+    socklen_t len = sizeof(type);
+    return getsockopt(sock, SOL_SOCKET, SO_TYPE, &type, &len) == 0 && type == SOCK_STREAM;
+}
+
+// Whether this is a reasonable recording ID, since it becomes a path
+static int validId(const char *id)
+{
+    const char *c;
+    if (!id[0])
+        return 0;
+    for (c = id; *c; c++) {
+        if (!((*c >= '0' && *c <= '9') || (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+              *c == '_' || *c == '-'))
+            return 0;
+    }
+    return 1;
+}
+
+/* Split a cook request into its arguments, checking them as cook.sh would
+ * (and more strictly for the ID, which becomes a path). Returns the number of
+ * arguments, or 0 if it's bad. */
+static int parseRequest(char *req, size_t len, char **args)
+{
+    size_t off = 1;
+    int argCt = 0;
+
+    if (len < 2 || req[0] != 'C' || req[len-1])
+        return 0;
+    while (off < len && argCt < 4) {
+        args[argCt++] = req + off;
+        off += strlen(req + off) + 1;
+    }
+    if (off < len)
+        return 0;
+    if (!validId(args[0]))
+        return 0;
+    if (argCt == 4 && strcmp(args[3], "dynaudnorm"))
+        return 0;
+    return argCt;
+}
+
+// The program that does the cooking
+static const char *cooker()
+{
+    static char path[PATH_MAX + 32];
+    snprintf(path, sizeof(path), "%s/cook/cookdriver", scriptBase);
+    return path;
+}
+
+/* Run a cook, as a worker, telling the client how it went. Returns its exit
+ * status. */
+static int runJob(int sigFd, char *req, size_t len, int *fds, int fdCt)
+{
+    char *args[5] = {0}, *argv[9];
+    char buf[MSG_MAX];
+    int conn = fds[0], out = fdCt > 1 ? fds[1] : -1, prog = fdCt > 2 ? fds[2] : -1;
+    int relay = (fdCt == 1), outPipe[2] = {-1, -1}, progPipe[2] = {-1, -1};
+    int argCt, argvCt, ai, status = -1, watchConn = 1, stream = isStream(conn);
+    pid_t pid;
+
+    // The server doesn't wait for clients, but we do
+    fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) & ~O_NONBLOCK);
+
+    argCt = parseRequest(req, len, args);
+    if (!argCt) {
+        sendText(conn, stream, 'X', "Bad request");
+        return 1;
+    }
+
+    if (relay) {
+        if (pipe2(outPipe, O_CLOEXEC) < 0 || pipe2(progPipe, O_CLOEXEC) < 0) {
+            perror("pipe");
+            sendText(conn, stream, 'X', "Internal error");
+            return 1;
+        }
+        out = outPipe[1];
+        prog = progPipe[1];
+    }
+
+    argv[0] = (char *) cooker();
+    argvCt = 1;
+    if (prog >= 0) {
+        argv[argvCt++] = "--progress-fd";
+        argv[argvCt++] = "3";
+    }
+    for (ai = 0; ai < argCt; ai++)
+        argv[argvCt++] = args[ai];
+    argv[argvCt] = NULL;
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        sendText(conn, stream, 'X', "Internal error");
+        return 1;
+
+    } else if (pid == 0) {
+        sigset_t none;
+        int fd;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        signal(SIGPIPE, SIG_DFL);
+
+        fd = open("/dev/null", O_RDONLY);
+        dup2(fd, 0);
+        close(fd);
+        dup2(out, 1);
+        if (prog >= 0) {
+            dup2(prog, 3);
+            fcntl(3, F_SETFD, 0);
+        } else {
+            close(3);
+        }
+        for (fd = 4; fd < 1024; fd++)
+            close(fd);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+
+    }
+
+    if (relay) {
+        close(outPipe[1]);
+        close(progPipe[1]);
+    }
+
+    // Wait for the cook, relaying it if we have to, and stopping it if the client leaves
+    while (status < 0 || outPipe[0] >= 0 || progPipe[0] >= 0) {
+        struct pollfd pfds[4];
+        int pi;
+
+        pfds[0].fd = sigFd;
+        pfds[1].fd = watchConn ? conn : -1;
+        pfds[2].fd = outPipe[0];
+        pfds[3].fd = progPipe[0];
+        for (pi = 0; pi < 4; pi++) {
+            pfds[pi].events = POLLIN;
+            pfds[pi].revents = 0;
+        }
+        if (poll(pfds, 4, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        if (pfds[0].revents) {
+            struct signalfd_siginfo si;
+            while (read(sigFd, &si, sizeof(si)) == sizeof(si)) {
+                if (si.ssi_signo == SIGTERM) {
+                    // Let the cook clean up after itself first
+                    kill(pid, SIGTERM);
+                    waitpid(pid, NULL, 0);
+                    exit(1);
+                }
+            }
+            if (status < 0) {
+                int wstatus;
+                if (waitpid(pid, &wstatus, WNOHANG) == pid)
+                    status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+            }
+        }
+
+        if (pfds[1].revents) {
+            // The client only sends anything else to cancel
+            ssize_t rd = recv(conn, buf, sizeof(buf), MSG_DONTWAIT);
+            if (rd == 0 || (rd < 0 && errno != EAGAIN) ||
+                (rd > 0 && memchr(buf, 'K', rd))) {
+                if (status < 0)
+                    kill(pid, SIGTERM);
+                watchConn = 0;
+            }
+        }
+
+        for (pi = 2; pi < 4; pi++) {
+            int *fd = (pi == 2) ? &outPipe[0] : &progPipe[0];
+            ssize_t rd;
+            if (!pfds[pi].revents)
+                continue;
+            buf[0] = (pi == 2) ? 'D' : 'P';
+            rd = read(*fd, buf + 1, sizeof(buf) - 1);
+            if (rd < 0 && errno == EINTR)
+                continue;
+            if (rd <= 0) {
+                close(*fd);
+                *fd = -1;
+                continue;
+            }
+            if (watchConn && sendPacket(conn, stream, buf, rd + 1) < 0) {
+                // Nobody to read it, so stop it
+                if (status < 0)
+                    kill(pid, SIGTERM);
+                watchConn = 0;
+            }
+        }
+    }
+
+    snprintf(buf, sizeof(buf), "%d", status);
+    sendText(conn, stream, 'E', buf);
+    return status;
+}
+
+// A worker: run cooks from the server, one at a time, until it goes away
+static void worker(int ctl)
+{
+    char req[REQ_MAX], reply[64];
+    sigset_t sigs;
+    int sigFd, fd;
+
+    for (fd = 3; fd < 1024; fd++)
+        if (fd != ctl)
+            close(fd);
+
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGCHLD);
+    sigaddset(&sigs, SIGTERM);
+    sigprocmask(SIG_BLOCK, &sigs, NULL);
+    sigFd = signalfd(-1, &sigs, SFD_NONBLOCK|SFD_CLOEXEC);
+    if (sigFd < 0) {
+        perror("signalfd");
+        exit(1);
+    }
+
+    while (1) {
+        int fds[MAX_FDS], fdCt = MAX_FDS, status, fi;
+        uint64_t start;
+        struct pollfd pfds[2];
+        ssize_t len;
+
+        // Wait for a job, or to be told to stop
+        pfds[0].fd = ctl;
+        pfds[1].fd = sigFd;
+        pfds[0].events = pfds[1].events = POLLIN;
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(1);
+        }
+        if (pfds[1].revents) {
+            struct signalfd_siginfo si;
+            while (read(sigFd, &si, sizeof(si)) == sizeof(si))
+                if (si.ssi_signo == SIGTERM)
+                    exit(0);
+        }
+        if (!pfds[0].revents)
+            continue;
+
+        len = recvMsg(ctl, req, sizeof(req), fds, &fdCt);
+        if (len <= 0)
+            exit(0);
+        if (fdCt < 1) {
+            snprintf(reply, sizeof(reply), "E-1 0");
+            sendMsg(ctl, reply, strlen(reply), NULL, 0);
+            continue;
+        }
+
+        start = now();
+        status = runJob(sigFd, req, len, fds, fdCt);
+        for (fi = 0; fi < fdCt; fi++)
+            close(fds[fi]);
+
+        snprintf(reply, sizeof(reply), "E%d %llu", status, (unsigned long long) (now() - start));
+        if (sendMsg(ctl, reply, strlen(reply), NULL, 0) < 0)
+            exit(0);
+    }
+}
+
+static void startWorker(struct Worker *w)
+{
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, fds) < 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    w->pid = fork();
+    if (w->pid < 0) {
+        perror("fork");
+        exit(1);
+    } else if (w->pid == 0) {
+        close(fds[0]);
+        worker(fds[1]);
+        exit(0);
+    }
+    close(fds[1]);
+    w->fd = fds[0];
+    w->busy = 0;
+}
+
+static void closeConn(size_t ci)
+{
+    int fi;
+    close(conns[ci].fd);
+    for (fi = 0; fi < conns[ci].fdCt; fi++)
+        close(conns[ci].fds[fi]);
+    conns[ci] = conns[--connCt];
+}
+
+static size_t queueLength()
+{
+    size_t ci, ct = 0;
+    for (ci = 0; ci < connCt; ci++)
+        if (conns[ci].queued)
+            ct++;
+    return ct;
+}
+
+/* The metrics, for whoever's watching, or choosing a server. If given a
+ * recording's ID, also whether it's here (rather than on another host). */
+static void sendStats(int sock, int stream, const char *id)
+{
+    char buf[1024], local[32] = "";
+    size_t ci;
+    uint64_t t = now(), oldest = 0, finished = stats.done + stats.failed;
+    int wi, busy = 0, cpus = 0;
+    double loadAvg = 0;
+    cpu_set_t cpuSet;
+    FILE *f;
+
+    if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0)
+        cpus = CPU_COUNT(&cpuSet);
+    if ((f = fopen("/proc/loadavg", "r"))) {
+        if (fscanf(f, "%lf", &loadAvg) != 1)
+            loadAvg = 0;
+        fclose(f);
+    }
+    if (id) {
+        char path[PATH_MAX + REQ_MAX + 32];
+        snprintf(path, sizeof(path), "%s/rec/%s.ogg.data", scriptBase, id);
+        snprintf(local, sizeof(local), ",\"local\":%s", access(path, R_OK) ? "false" : "true");
+    }
+
+    for (wi = 0; wi < workerCt; wi++)
+        busy += workers[wi].busy;
+    for (ci = 0; ci < connCt; ci++)
+        if (conns[ci].queued && t - conns[ci].since > oldest)
+            oldest = t - conns[ci].since;
+
+    snprintf(buf, sizeof(buf),
+             "S{\"workers\":%d,\"busy\":%d,\"queued\":%zu,\"accepted\":%llu,\"rejected\":%llu,"
+             "\"cancelled\":%llu,\"done\":%llu,\"failed\":%llu,\"respawned\":%llu,"
+             "\"waitAvg\":%.3f,\"waitMax\":%.3f,\"oldestWait\":%.3f,\"runAvg\":%.3f,\"runMax\":%.3f,"
+             "\"cpus\":%d,\"loadAvg\":%.2f,\"uptime\":%.3f%s}\n",
+             workerCt, busy, queueLength(),
+             (unsigned long long) stats.accepted, (unsigned long long) stats.rejected,
+             (unsigned long long) stats.cancelled, (unsigned long long) stats.done,
+             (unsigned long long) stats.failed, (unsigned long long) stats.respawned,
+             stats.accepted ? stats.waitTotal / 1e9 / stats.accepted : 0.0, stats.waitMax / 1e9,
+             oldest / 1e9, finished ? stats.runTotal / 1e9 / finished : 0.0, stats.runMax / 1e9,
+             cpus, loadAvg, (t - stats.start) / 1e9, local);
+    sendPacket(sock, stream, buf, strlen(buf));
+}
+
+// Start reading the recording, so it's in the page cache when its turn comes
+static void readAhead(const char *id)
+{
+    const char *files[] = {"header1", "header2", "data"};
+    char path[PATH_MAX + 64];
+    int fi;
+
+    for (fi = 0; fi < 3; fi++) {
+        int fd;
+        snprintf(path, sizeof(path), "%s/rec/%s.ogg.%s", scriptBase, id, files[fi]);
+        fd = open(path, O_RDONLY|O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+// Read a new connection's request
+static void readRequest(size_t ci)
+{
+    struct Conn *conn = &conns[ci];
+    char *args[5];
+    int fds[MAX_FDS - 1], fdCt = MAX_FDS - 1;
+    ssize_t len;
+
+    if (conn->stream) {
+        // As much of the frame as has come
+        uint32_t msgLen = REQ_MAX;
+        if (conn->inLen >= 4)
+            msgLen = ((uint32_t) conn->in[0] << 24) | (conn->in[1] << 16) | (conn->in[2] << 8) | conn->in[3];
+        if (msgLen > REQ_MAX) {
+            closeConn(ci);
+            return;
+        }
+        len = read(conn->fd, conn->in + conn->inLen, (conn->inLen < 4 ? 4 : 4 + msgLen) - conn->inLen);
+        if (len < 0 && (errno == EAGAIN || errno == EINTR))
+            return;
+        if (len <= 0) {
+            closeConn(ci);
+            return;
+        }
+        conn->inLen += len;
+        if (conn->inLen < 4 || conn->inLen < 4 + msgLen)
+            return;
+        len = msgLen;
+        memcpy(conn->req, conn->in + 4, len);
+        fdCt = 0;
+
+    } else {
+        len = recvMsg(conn->fd, conn->req, sizeof(conn->req), fds, &fdCt);
+        if (len < 0 && errno == EAGAIN)
+            return;
+
+    }
+    if (len <= 0) {
+        closeConn(ci);
+        return;
+    }
+    memcpy(conn->fds, fds, sizeof(int) * fdCt);
+    conn->fdCt = fdCt;
+    conn->reqLen = len;
+
+    if (conn->req[0] == 'S') {
+        char id[REQ_MAX];
+        snprintf(id, sizeof(id), "%.*s", (int) len - 1, conn->req + 1);
+        sendStats(conn->fd, conn->stream, validId(id) ? id : NULL);
+        closeConn(ci);
+
+    } else if (!parseRequest(conn->req, len, args)) {
+        sendText(conn->fd, conn->stream, 'X', "Bad request");
+        stats.rejected++;
+        closeConn(ci);
+
+    } else if (queueLength() >= maxQueue) {
+        sendText(conn->fd, conn->stream, 'X', "Queue full");
+        stats.rejected++;
+        closeConn(ci);
+
+    } else {
+        readAhead(args[0]);
+        conn->queued = 1;
+        conn->seq = connSeq++;
+        conn->since = now();
+
+    }
+}
+
+// Give the oldest requests to idle workers
+static void dispatch()
+{
+    int wi;
+
+    for (wi = 0; wi < workerCt; wi++) {
+        struct Worker *w = &workers[wi];
+        int fds[MAX_FDS];
+        size_t ci, oldest = connCt;
+        uint64_t waited;
+
+        if (w->busy)
+            continue;
+        for (ci = 0; ci < connCt; ci++)
+            if (conns[ci].queued && (oldest == connCt || conns[ci].seq < conns[oldest].seq))
+                oldest = ci;
+        if (oldest == connCt)
+            return;
+
+        fds[0] = conns[oldest].fd;
+        memcpy(fds + 1, conns[oldest].fds, sizeof(int) * conns[oldest].fdCt);
+        if (sendMsg(w->fd, conns[oldest].req, conns[oldest].reqLen, fds, conns[oldest].fdCt + 1) < 0) {
+            perror("worker");
+            continue;
+        }
+        w->busy = 1;
+        waited = now() - conns[oldest].since;
+        stats.accepted++;
+        stats.waitTotal += waited;
+        if (waited > stats.waitMax)
+            stats.waitMax = waited;
+        closeConn(oldest);
+    }
+}
+
+// Hear from a worker, which is done with its job
+static void workerReply(struct Worker *w)
+{
+    char buf[64];
+    ssize_t len = recv(w->fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    int status;
+    unsigned long long run;
+
+    if (len <= 0 || buf[0] != 'E')
+        return;
+    buf[len] = 0;
+    if (sscanf(buf + 1, "%d %llu", &status, &run) != 2)
+        return;
+    if (status == 0)
+        stats.done++;
+    else
+        stats.failed++;
+    stats.runTotal += run;
+    if (run > stats.runMax)
+        stats.runMax = run;
+    w->busy = 0;
+}
+
+/* Listen on, or connect to, a TCP address, as host:port (or [host]:port).
+ * Returns the socket, or -1. */
+static int openTcp(const char *hostPort, int server, int quiet)
+{
+    struct addrinfo hints = {0}, *res, *ai;
+    char host[256];
+    const char *port = strrchr(hostPort, ':');
+    int sock = -1, err, one = 1;
+
+    if (!port || port - hostPort >= (int) sizeof(host)) {
+        fprintf(stderr, "cookd: %s isn't host:port\n", hostPort);
+        return -1;
+    }
+    snprintf(host, sizeof(host), "%.*s", (int) (port - hostPort), hostPort);
+    if (host[0] == '[' && host[strlen(host) - 1] == ']') {
+        memmove(host, host + 1, strlen(host));
+        host[strlen(host) - 1] = 0;
+    }
+    port++;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = server ? AI_PASSIVE : 0;
+    if ((err = getaddrinfo(host[0] ? host : NULL, port, &hints, &res)) != 0) {
+        if (!quiet)
+            fprintf(stderr, "cookd: %s: %s\n", hostPort, gai_strerror(err));
+        return -1;
+    }
+    for (ai = res; ai; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype|SOCK_CLOEXEC|(server ? SOCK_NONBLOCK : 0), ai->ai_protocol);
+        if (sock < 0)
+            continue;
+        if (server) {
+            setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(sock, ai->ai_addr, ai->ai_addrlen) == 0 && listen(sock, 128) == 0)
+                break;
+        } else if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    if (sock < 0 && !quiet)
+        perror(hostPort);
+    return sock;
+}
+
+static void serve()
+{
+    struct sockaddr_un addr = {0};
+    struct pollfd *pfds = NULL;
+    sigset_t sigs;
+    int sock, tcpSock = -1, sigFd, wi;
+
+    stats.start = now();
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sockPath);
+    sock = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    // Only take over the socket if nobody's listening on it
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "cookd: %s is already being served\n", sockPath);
+        exit(1);
+    }
+    close(sock);
+    unlink(sockPath);
+    sock = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+    umask(077);
+    if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sock, 128) < 0) {
+        perror(sockPath);
+        exit(1);
+    }
+    if (listenAddr && (tcpSock = openTcp(listenAddr, 1, 0)) < 0)
+        exit(1);
+
+    // Workers first, so that they don't inherit the signalfd
+    workers = calloc(workerCt, sizeof(struct Worker));
+    if (!workers) {
+        perror("calloc");
+        exit(1);
+    }
+    for (wi = 0; wi < workerCt; wi++)
+        startWorker(&workers[wi]);
+
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGCHLD);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGINT);
+    sigprocmask(SIG_BLOCK, &sigs, NULL);
+    sigFd = signalfd(-1, &sigs, SFD_NONBLOCK|SFD_CLOEXEC);
+    if (sigFd < 0) {
+        perror("signalfd");
+        exit(1);
+    }
+
+    while (1) {
+        size_t pi, pfdCt = 3 + workerCt + connCt, ci;
+
+        pfds = realloc(pfds, pfdCt * sizeof(struct pollfd));
+        if (!pfds) {
+            perror("realloc");
+            exit(1);
+        }
+        pfds[0].fd = sigFd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = sock;
+        pfds[1].events = POLLIN;
+        pfds[2].fd = tcpSock;
+        pfds[2].events = POLLIN;
+        for (wi = 0; wi < workerCt; wi++) {
+            pfds[3 + wi].fd = workers[wi].fd;
+            pfds[3 + wi].events = POLLIN;
+        }
+        // Waiting for the request, or while queued, just for the client leaving
+        for (ci = 0; ci < connCt; ci++) {
+            pfds[3 + workerCt + ci].fd = conns[ci].fd;
+            pfds[3 + workerCt + ci].events = conns[ci].queued ? POLLRDHUP : POLLIN;
+        }
+        for (pi = 0; pi < pfdCt; pi++)
+            pfds[pi].revents = 0;
+
+        if (poll(pfds, pfdCt, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(1);
+        }
+
+        if (pfds[0].revents) {
+            struct signalfd_siginfo si;
+            pid_t pid;
+            int status;
+
+            while (read(sigFd, &si, sizeof(si)) == sizeof(si)) {
+                if (si.ssi_signo == SIGTERM || si.ssi_signo == SIGINT) {
+                    for (wi = 0; wi < workerCt; wi++)
+                        kill(workers[wi].pid, SIGTERM);
+                    while (wait(NULL) > 0);
+                    unlink(sockPath);
+                    exit(0);
+                }
+            }
+
+            // A worker that died is replaced
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                for (wi = 0; wi < workerCt && workers[wi].pid != pid; wi++);
+                if (wi == workerCt)
+                    continue;
+                fprintf(stderr, "cookd: worker %d died\n", (int) pid);
+                if (workers[wi].busy)
+                    stats.failed++;
+                close(workers[wi].fd);
+                startWorker(&workers[wi]);
+                stats.respawned++;
+            }
+        }
+
+        // (Unless it's been replaced since)
+        for (wi = 0; wi < workerCt; wi++)
+            if ((pfds[3 + wi].revents & POLLIN) && pfds[3 + wi].fd == workers[wi].fd)
+                workerReply(&workers[wi]);
+
+        // Connections, from the end, since closing one moves the last into its place
+        for (ci = connCt; ci > 0; ci--) {
+            struct pollfd *pfd = &pfds[3 + workerCt + ci - 1];
+            if (!pfd->revents)
+                continue;
+            if (conns[ci - 1].queued) {
+                stats.cancelled++;
+                closeConn(ci - 1);
+            } else {
+                readRequest(ci - 1);
+            }
+        }
+
+        // Local clients, and remote ones over TCP
+        for (pi = 1; pi < 3; pi++) {
+            int fd, one = 1;
+            if (!pfds[pi].revents)
+                continue;
+            while ((fd = accept4(pfds[pi].fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC)) >= 0) {
+                if (pi == 2)
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                if (connCt >= connSize) {
+                    connSize = connSize ? connSize * 2 : 32;
+                    conns = realloc(conns, connSize * sizeof(struct Conn));
+                    if (!conns) {
+                        perror("realloc");
+                        exit(1);
+                    }
+                }
+                memset(&conns[connCt], 0, sizeof(struct Conn));
+                conns[connCt].stream = (pi == 2);
+                conns[connCt++].fd = fd;
+            }
+        }
+
+        dispatch();
+    }
+}
+
+// Our connection to the server, as a client, and whether it's TCP
+static int clientSock = -1, clientStream;
+
+/* Connect to the server: over TCP if given one (-c), or if that fails, or
+ * wasn't given, the local socket. */
+static int connectServer(int quiet)
+{
+    struct sockaddr_un addr = {0};
+    int sock;
+
+    if (serverAddr) {
+        sock = openTcp(serverAddr, 0, quiet);
+        if (sock >= 0) {
+            int one = 1;
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            clientStream = 1;
+            return clientSock = sock;
+        }
+    }
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        perror("socket");
+        exit(1);
+    }
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sockPath);
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        if (!quiet)
+            perror(sockPath);
+        close(sock);
+        return -1;
+    }
+    clientStream = 0;
+    return clientSock = sock;
+}
+
+// Killed while cooking, so cancel the cook, wherever it is
+static void cancelCook(int sig)
+{
+    (void) sig;
+    if (clientSock >= 0)
+        sendPacket(clientSock, clientStream, "K", 1);
+    _exit(1);
+}
+
+/* Cook thru the server, as cook.sh would: output to stdout, and progress to
+ * progressFd if it's not -1. If there's no server, just run cook.sh. */
+static int cook(int argc, char **argv, int relay, int progressFd)
+{
+    char req[REQ_MAX], *buf, progressArg[16];
+    size_t len = 1;
+    int sock, fds[2], fdCt = 0, ai, cookArgCt = 1;
+    int progress = progressFd >= 0;
+
+    sock = connectServer(1);
+    if (sock < 0) {
+        char path[PATH_MAX + 32], *cookArgs[8];
+        snprintf(path, sizeof(path), "%s/cook.sh", scriptBase);
+        cookArgs[0] = path;
+        if (progress) {
+            snprintf(progressArg, sizeof(progressArg), "%d", progressFd);
+            cookArgs[cookArgCt++] = "--progress-fd";
+            cookArgs[cookArgCt++] = progressArg;
+        }
+        for (ai = 0; ai < argc && ai < 4; ai++)
+            cookArgs[cookArgCt++] = argv[ai];
+        cookArgs[cookArgCt] = NULL;
+        execv(path, cookArgs);
+        perror(path);
+        return 1;
+    }
+    signal(SIGTERM, cancelCook);
+    signal(SIGINT, cancelCook);
+
+    req[0] = 'C';
+    for (ai = 0; ai < argc; ai++) {
+        size_t argLen = strlen(argv[ai]) + 1;
+        if (len + argLen > sizeof(req)) {
+            fprintf(stderr, "cookd: Request too long\n");
+            return 1;
+        }
+        memcpy(req + len, argv[ai], argLen);
+        len += argLen;
+    }
+    // (fds can't go over TCP)
+    if (!relay && !clientStream) {
+        fds[fdCt++] = 1;
+        if (progress)
+            fds[fdCt++] = progressFd;
+    }
+    if ((clientStream ? sendPacket(sock, 1, req, len) : sendMsg(sock, req, len, fds, fdCt)) < 0) {
+        perror("send");
+        return 1;
+    }
+
+    buf = malloc(MSG_MAX + 1);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    while (1) {
+        ssize_t rd = recvPacket(sock, clientStream, buf, MSG_MAX);
+        if (rd <= 0) {
+            fprintf(stderr, "cookd: Lost the server\n");
+            return 1;
+        }
+        buf[rd] = 0;
+        switch (buf[0]) {
+            case 'D':
+                if (write(1, buf + 1, rd - 1) != rd - 1)
+                    return 1;
+                break;
+
+            case 'P':
+                if (progress && write(progressFd, buf + 1, rd - 1) < 0)
+                    progress = 0;
+                break;
+
+            case 'E':
+                return atoi(buf + 1);
+
+            case 'X':
+                fprintf(stderr, "cookd: %s\n", buf + 1);
+                return 1;
+        }
+    }
+}
+
+static int printStat(const char *id)
+{
+    char buf[1024];
+    int sock = connectServer(0);
+    ssize_t rd;
+
+    if (sock < 0)
+        return 1;
+    rd = snprintf(buf, sizeof(buf), "S%s", id ? id : "");
+    if (sendPacket(sock, clientStream, buf, rd) < 0) {
+        perror("send");
+        return 1;
+    }
+    rd = recvPacket(sock, clientStream, buf, sizeof(buf));
+    if (rd <= 1 || buf[0] != 'S')
+        return 1;
+    fwrite(buf + 1, 1, rd - 1, stdout);
+    return 0;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Use: cookd [-s <socket>] [-l <host:port>] [-c <host:port>] [-j <workers>]\n"
+                    "             [-q <queue>] <command>\n"
+                    "Commands:\n"
+                    "  serve: Serve cooks, with a pool of workers (by default, %d).\n"
+                    "  cook [-r] [--progress-fd <fd>] <ID> [<format> [<container> [dynaudnorm]]]:\n"
+                    "      Cook thru the server, as cook.sh, or with cook.sh if there's no\n"
+                    "      server. With -r, the output comes back over the socket, rather\n"
+                    "      than being written directly. With --progress-fd, progress is\n"
+                    "      reported to that fd.\n"
+                    "  stat [<ID>]: Print the queue and latency metrics as JSON, with\n"
+                    "      whether the recording is on the server's host, if given its ID.\n"
+                    "The socket is rec/cookd.sock by default. With -l, the server also\n"
+                    "listens on TCP, and with -c, the client connects to a server over TCP,\n"
+                    "falling back to the local socket.\n", DEF_WORKERS);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static char defSock[PATH_MAX + 32];
+    char *slash;
+    ssize_t len;
+    int ai;
+
+    // Find ourself, and so everything else
+    len = readlink("/proc/self/exe", scriptBase, sizeof(scriptBase) - 1);
+    if (len < 0) {
+        perror("/proc/self/exe");
+        return 1;
+    }
+    scriptBase[len] = 0;
+    if ((slash = strrchr(scriptBase, '/')))
+        *slash = 0;
+    if ((slash = strrchr(scriptBase, '/')))
+        *slash = 0;
+    snprintf(defSock, sizeof(defSock), "%s/rec/cookd.sock", scriptBase);
+    sockPath = defSock;
+    workerCt = DEF_WORKERS;
+
+    for (ai = 1; ai < argc && argv[ai][0] == '-'; ai++) {
+        if (!strcmp(argv[ai], "-s") && ai + 1 < argc) {
+            sockPath = argv[++ai];
+        } else if (!strcmp(argv[ai], "-l") && ai + 1 < argc) {
+            listenAddr = argv[++ai];
+        } else if (!strcmp(argv[ai], "-c") && ai + 1 < argc) {
+            serverAddr = argv[++ai];
+        } else if (!strcmp(argv[ai], "-j") && ai + 1 < argc) {
+            workerCt = atoi(argv[++ai]);
+            if (workerCt < 1)
+                usage();
+        } else if (!strcmp(argv[ai], "-q") && ai + 1 < argc) {
+            maxQueue = strtoul(argv[++ai], NULL, 10);
+        } else {
+            usage();
+        }
+    }
+    if (ai >= argc)
+        usage();
+
+    if (!strcmp(argv[ai], "serve") && ai + 1 == argc) {
+        serve();
+
+    } else if (!strcmp(argv[ai], "cook") && ai + 1 < argc) {
+        int relay = 0, progressFd = -1;
+        for (ai++; ai < argc && argv[ai][0] == '-'; ai++) {
+            if (!strcmp(argv[ai], "-r")) {
+                relay = 1;
+            } else if (!strcmp(argv[ai], "--progress-fd") && ai + 1 < argc) {
+                progressFd = atoi(argv[++ai]);
+                if (fcntl(progressFd, F_GETFD) < 0) {
+                    perror("--progress-fd");
+                    return 1;
+                }
+            } else {
+                usage();
+            }
+        }
+        if (ai >= argc || argc - ai > 4)
+            usage();
+        return cook(argc - ai, argv + ai, relay, progressFd);
+
+    } else if (!strcmp(argv[ai], "stat") && argc - ai <= 2) {
+        return printStat(argv[ai + 1]);
+
+    } else {
+        usage();
+
+    }
+
+    return 0;
+}
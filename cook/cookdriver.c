@@ -0,0 +1,1583 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* cookdriver cooks a recording, for every format and container, as one
+ * process that owns the whole cook. Every stage is its own child: the per-track
+ * pipelines that correct, decode, filter and encode into the tracks' FIFOs, and
+ * the container stage that reads them. The driver connects them with pipes,
+ * starts as many tracks at once as the container can take (and cooksched
+ * allows), gives every stage its own timeout, reaps every child, and only
+ * caches the cook if every stage of it succeeded. cook.sh is only a wrapper
+ * around it. */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Timeouts, in seconds
+#define DEF_TIMEOUT 14400
+#define INFO_TIMEOUT 10
+
+// How long a stage gets to die after it's been asked to, as timeout -k
+#define KILL_AFTER 5
+
+// How long stragglers get once the container's done with them
+#define STRAGGLE_TIME 5
+
+// Our temporary directories older than this (in seconds) are left over
+#define STALE_TMPDIR (DEF_TIMEOUT + 3600)
+
+#define SCHED_SLOTS 8 // As many as the CPU affinity allows
+#define CACHE_BUDGET "10G"
+#define ZIP_PARALLEL 8
+
+// Flags for stages
+#define STAGE_NICE   1 // nice -n10 taskset -c 0-7 ionice -c3 chrt -i 0
+#define STAGE_QUIET  2 // 2> /dev/null
+#define STAGE_APPEND 4 // >> rather than >
+
+struct Format {
+    const char *name; // NULL for the default
+    const char *ext;
+    const char *encode; // Split on spaces
+    int engine; // Whether cookengine can do it
+    int remux; // Whether oggopus can do it, for Opus tracks
+    int zipOnly; // Always zipped, whatever the container
+    const char *zipFlags;
+    const char *extraFiles; // Split on spaces
+};
+
+static const struct Format formats[] = {
+    {"copy", "ogg", NULL, 0, 0, 0, "-1", NULL},
+    {"oggflac", "oga", "flac --ogg --serial-number=1 - -c", 0, 0, 0, "-1", NULL},
+    {"vorbis", "ogg", "oggenc -q 6 -", 0, 0, 0, "-1", NULL},
+    {"aac", "aac", "fdkaac -f 2 -m 4 -o - -", 0, 0, 0, "-1", NULL},
+    {"heaac", "aac", "fdkaac -p 29 -f 2 -m 4 -o - -", 0, 0, 0, "-1", NULL},
+    {"opus", "opus", "opusenc --bitrate 96 - -", 0, 1, 0, "-1", NULL},
+    {"wav", "wav", "ffmpeg -f wav -i - -c:a adpcm_ms -f wav -", 0, 0, 1, "-9", NULL},
+    {"adpcm", "wav", "ffmpeg -f wav -i - -c:a adpcm_ms -f wav -", 0, 0, 1, "-9", NULL},
+    {"wav8", "wav", "ffmpeg -f wav -i - -c:a pcm_u8 -f wav -", 0, 0, 1, "-9", NULL},
+    {"wavsfx", "flac", "flac - -c", 0, 0, 0, "-1", "RunMe.bat ffmpeg.exe"},
+    {"powersfx", "flac", "flac - -c", 0, 0, 0, "-1", "ffmpeg.exe"},
+    {"wavsfxm", "flac", "flac - -c", 0, 0, 0, "-1", "RunMe.command ffmpeg"},
+    {"powersfxm", "flac", "flac - -c", 0, 0, 0, "-1", "RunMe.command ffmpeg"},
+    {"wavsfxu", "flac", "flac - -c", 0, 0, 0, "-1", "RunMe.sh"},
+    {"powersfxu", "flac", "flac - -c", 0, 0, 0, "-1", "RunMe.sh"},
+    {"mp3", "mp3", "lame -b 128 - -", 0, 0, 0, "-1", NULL},
+    {"ra", "ra", "ffmpeg -f wav -i - -f rm -", 0, 0, 0, "-1", NULL},
+    {NULL, "flac", "flac - -c", 1, 0, 0, "-1", NULL}
+};
+
+// A growable argument list
+struct Args {
+    char **v;
+    int n, size;
+};
+
+/* A job is a pipeline of stages (children), perhaps with a pipe we read from:
+ * either its output, which we capture, or the input to its last stage, which
+ * we drain once that stage is done, so that the stages before it can finish */
+struct Job {
+    const char *name;
+    int running; // Stages still running
+    int failed;
+    int status; // Of the last stage
+    pid_t last;
+    int readFd;
+    int capture, draining;
+    char *buf;
+    size_t len, size;
+    int started, finished;
+    void (*done)(struct Job *job);
+    void *arg;
+};
+
+struct Child {
+    pid_t pid;
+    struct Job *job;
+    uint64_t deadline; // Monotonic ns, or 0
+    int killed;
+};
+
+struct Track {
+    int no;
+    char num[16]; // As given by cookplan, padded as seq -w
+    uint32_t streamNo;
+    char codec[8];
+    char *user;
+    char *fileName, *path;
+    char duration[32];
+    uint64_t bytes;
+    int sched, held; // Whether it waits its turn, and has a slot
+    struct Job admit, encode, release;
+};
+
+static const char *scriptBase, *id, *formatName = "flac", *container = "zip";
+static const struct Format *format;
+static char filter[64] = "anull";
+static char *ext, *tmpdir, *outDir;
+static int engine, remux, mixer, parallel, progress, progressFd = -1;
+static char *sched;
+
+static struct Track *tracks;
+static int trackCt, tracksStarted, tracksRunning, trackLimit;
+static int tracksFailed, containerDone;
+
+static struct Child *children;
+static size_t childCt, childSize;
+static struct Job **jobs;
+static size_t jobCt, jobSize;
+
+static int sigFd;
+
+static void *xrealloc(void *ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (!ptr) {
+        perror("realloc");
+        exit(1);
+    }
+    return ptr;
+}
+
+static char *xasprintf(const char *fmt, ...)
+{
+    va_list ap;
+    char *ret;
+    va_start(ap, fmt);
+    if (vasprintf(&ret, fmt, ap) < 0) {
+        perror("asprintf");
+        exit(1);
+    }
+    va_end(ap);
+    return ret;
+}
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void argAdd(struct Args *args, const char *arg)
+{
+    if (args->n + 2 > args->size) {
+        args->size = args->size ? args->size * 2 : 16;
+        args->v = xrealloc(args->v, args->size * sizeof(char *));
+    }
+    args->v[args->n++] = arg ? strdup(arg) : NULL;
+    args->v[args->n] = NULL;
+}
+
+static void argSplit(struct Args *args, const char *str)
+{
+    char *copy = strdup(str), *save, *word;
+    for (word = strtok_r(copy, " ", &save); word; word = strtok_r(NULL, " ", &save))
+        argAdd(args, word);
+    free(copy);
+}
+
+static char *tool(const char *name)
+{
+    return xasprintf("%s/cook/%s", scriptBase, name);
+}
+
+static int haveTool(const char *name)
+{
+    char *path = tool(name);
+    int ret = !access(path, X_OK);
+    free(path);
+    return ret;
+}
+
+/* Whether an environment variable asks for something that isn't done by
+ * default (set, and not to 0) */
+static int optedIn(const char *name)
+{
+    const char *val = getenv(name);
+    return val && val[0] && strcmp(val, "0");
+}
+
+// The recording's files, which stages can find wherever they run
+static char *recFile(const char *suffix)
+{
+    return xasprintf("%s/rec/%s.ogg.%s", scriptBase, id, suffix);
+}
+
+static int removeEntry(const char *path, const struct stat *sbuf, int type, struct FTW *ftw)
+{
+    (void) sbuf; (void) type; (void) ftw;
+    remove(path);
+    return 0;
+}
+
+static void cleanup()
+{
+    if (tmpdir)
+        nftw(tmpdir, removeEntry, 16, FTW_DEPTH|FTW_PHYS);
+}
+
+// Remove the temporary directories of cooks that died without cleaning up
+static void sweepStale(const char *base)
+{
+    DIR *dh = opendir(base);
+    struct dirent *de;
+    time_t cutoff = time(NULL) - STALE_TMPDIR;
+
+    if (!dh)
+        return;
+    while ((de = readdir(dh))) {
+        struct stat sbuf;
+        char *path;
+        if (strncmp(de->d_name, "cookdriver.", 11))
+            continue;
+        path = xasprintf("%s/%s", base, de->d_name);
+        if (lstat(path, &sbuf) == 0 && S_ISDIR(sbuf.st_mode) &&
+            sbuf.st_uid == getuid() && sbuf.st_mtime < cutoff)
+            nftw(path, removeEntry, 16, FTW_DEPTH|FTW_PHYS);
+        free(path);
+    }
+    closedir(dh);
+}
+
+static void progressLine(const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+    int len;
+
+    if (!progress)
+        return;
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (write(progressFd, buf, len) != len)
+        progress = 0;
+}
+
+// Lower a child's priority, as nice -n10 taskset -c 0-7 ionice -c3 chrt -i 0
+static void lowerPriority()
+{
+    struct sched_param param = {0};
+    cpu_set_t allowed, want;
+    int cpu;
+
+    if (nice(10) < 0) {}
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        CPU_ZERO(&want);
+        for (cpu = 0; cpu < SCHED_SLOTS; cpu++)
+            if (CPU_ISSET(cpu, &allowed))
+                CPU_SET(cpu, &want);
+        if (CPU_COUNT(&want))
+            sched_setaffinity(0, sizeof(want), &want);
+    }
+    syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, 3 << 13 /* IOPRIO_CLASS_IDLE */);
+    sched_setscheduler(0, SCHED_IDLE, &param);
+}
+
+static void registerJob(struct Job *job)
+{
+    if (jobCt >= jobSize) {
+        jobSize = jobSize ? jobSize * 2 : 32;
+        jobs = xrealloc(jobs, jobSize * sizeof(struct Job *));
+    }
+    jobs[jobCt++] = job;
+}
+
+static void startJob(struct Job *job, const char *name, void (*done)(struct Job *), void *arg)
+{
+    memset(job, 0, sizeof(*job));
+    job->name = name;
+    job->readFd = -1;
+    job->started = 1;
+    job->done = done;
+    job->arg = arg;
+    registerJob(job);
+}
+
+static void checkFinished(struct Job *job)
+{
+    size_t ji;
+    if (job->finished || job->running || job->readFd >= 0)
+        return;
+    job->finished = 1;
+    for (ji = 0; ji < jobCt; ji++) {
+        if (jobs[ji] == job) {
+            jobs[ji] = jobs[--jobCt];
+            break;
+        }
+    }
+    if (job->done)
+        job->done(job);
+}
+
+/* Start a stage of this job. in and out are the fds to give it as stdin and
+ * stdout: -1 means /dev/null for stdin, and our own stdout for stdout, and
+ * outPath, if given, is opened by the child (since opening a FIFO blocks). If
+ * fn is given, the child runs that (and then exits) rather than argv. */
+static pid_t startStage(struct Job *job, char *const *argv, int (*fn)(void *), void *arg,
+                        int in, int out, const char *outPath, int flags, int timeout)
+{
+    pid_t pid;
+    sigset_t all;
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        job->failed = 1;
+        return -1;
+    }
+
+    if (pid == 0) {
+        int fd;
+
+        sigemptyset(&all);
+        sigprocmask(SIG_SETMASK, &all, NULL);
+        signal(SIGPIPE, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+
+        if (in < 0)
+            in = open("/dev/null", O_RDONLY);
+        if (in != 0) {
+            dup2(in, 0);
+            close(in);
+        }
+        if (outPath) {
+            out = open(outPath, O_WRONLY|O_CREAT|((flags & STAGE_APPEND) ? O_APPEND : O_TRUNC), 0666);
+            if (out < 0) {
+                perror(outPath);
+                _exit(1);
+            }
+        }
+        if (out >= 0 && out != 1) {
+            dup2(out, 1);
+            close(out);
+        }
+        if (flags & STAGE_QUIET) {
+            fd = open("/dev/null", O_WRONLY);
+            dup2(fd, 2);
+            close(fd);
+        }
+
+        // Only the progress fd goes past stderr, as fd 3
+        if (progress && progressFd != 3) {
+            dup2(progressFd, 3);
+            progressFd = 3;
+        }
+        for (fd = progress ? 4 : 3; fd < 1024; fd++)
+            close(fd);
+
+        if (flags & STAGE_NICE)
+            lowerPriority();
+
+        if (fn)
+            _exit(fn(arg));
+        execvp(argv[0], argv);
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+
+    if (childCt >= childSize) {
+        childSize = childSize ? childSize * 2 : 32;
+        children = xrealloc(children, childSize * sizeof(struct Child));
+    }
+    children[childCt].pid = pid;
+    children[childCt].job = job;
+    children[childCt].deadline = timeout ? now() + timeout * 1000000000ULL : 0;
+    children[childCt].killed = 0;
+    childCt++;
+    job->running++;
+    job->last = pid;
+    return pid;
+}
+
+/* Start a job of these stages, connected by pipes, the first reading in and
+ * the last writing out (or outPath). With drain, we keep the read end of the
+ * pipe into the last stage, and read it to the end once that stage is done, so
+ * that the stage before it can finish writing. With capture (out < 0 and no
+ * outPath), we capture the last stage's output. */
+static void startPipeline(struct Job *job, struct Args *stages, int stageCt, int in, int out,
+                          const char *outPath, int flags, int timeout, int drain, int capture)
+{
+    int si, fds[2], keep = -1;
+
+    if (capture) {
+        if (pipe2(fds, O_CLOEXEC) < 0) {
+            perror("pipe");
+            job->failed = 1;
+            checkFinished(job);
+            return;
+        }
+        out = fds[1];
+        job->readFd = fds[0];
+        job->capture = 1;
+    }
+
+    for (si = 0; si < stageCt; si++) {
+        int stageOut = out;
+        const char *stageOutPath = outPath;
+        int next = -1;
+
+        if (si < stageCt - 1) {
+            if (pipe2(fds, O_CLOEXEC) < 0) {
+                perror("pipe");
+                job->failed = 1;
+                break;
+            }
+            stageOut = fds[1];
+            stageOutPath = NULL;
+            next = fds[0];
+            if (drain && si == stageCt - 2)
+                keep = fcntl(next, F_DUPFD_CLOEXEC, 0);
+        }
+
+        startStage(job, stages[si].v, NULL, NULL, in, stageOut, stageOutPath, flags, timeout);
+        if (in >= 0)
+            close(in);
+        if (stageOut >= 0 && stageOut != out)
+            close(stageOut);
+        in = next;
+    }
+    if (in >= 0)
+        close(in);
+    if (capture)
+        close(out);
+    if (keep >= 0) {
+        fcntl(keep, F_SETFL, O_NONBLOCK);
+        job->readFd = keep;
+    }
+    checkFinished(job);
+}
+
+// Kill everything and give up
+static void terminate()
+{
+    size_t ci;
+    for (ci = 0; ci < childCt; ci++)
+        kill(children[ci].pid, SIGTERM);
+    cleanup();
+    exit(1);
+}
+
+static void reap()
+{
+    pid_t pid;
+    int status;
+    size_t ci;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        struct Job *job;
+        for (ci = 0; ci < childCt && children[ci].pid != pid; ci++);
+        if (ci == childCt)
+            continue;
+        job = children[ci].job;
+        if (children[ci].killed) {
+            fprintf(stderr, "cookdriver: %s timed out\n", job->name);
+            job->failed = 1;
+        } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            job->failed = 1;
+        }
+        if (pid == job->last)
+            job->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        children[ci] = children[--childCt];
+
+        job->running--;
+        if (pid == job->last && job->readFd >= 0 && !job->capture)
+            job->draining = 1;
+        checkFinished(job);
+    }
+}
+
+// Wait for something to happen, and deal with it
+static void step()
+{
+    struct pollfd *pfds;
+    struct Job **pjobs;
+    size_t ci, ji, pfdCt = 1;
+    uint64_t t = now(), wait = 1000000000ULL;
+    char buf[65536];
+
+    // Whoever's out of time gets TERM, and then KILL
+    for (ci = 0; ci < childCt; ci++) {
+        struct Child *child = &children[ci];
+        if (!child->deadline)
+            continue;
+        if (child->deadline <= t) {
+            kill(child->pid, child->killed ? SIGKILL : SIGTERM);
+            child->killed = 1;
+            child->deadline = t + KILL_AFTER * 1000000000ULL;
+        }
+        if (child->deadline - t < wait)
+            wait = child->deadline - t;
+    }
+
+    pfds = xrealloc(NULL, (jobCt + 1) * sizeof(struct pollfd));
+    pjobs = xrealloc(NULL, (jobCt + 1) * sizeof(struct Job *));
+    pfds[0].fd = sigFd;
+    pfds[0].events = POLLIN;
+    for (ji = 0; ji < jobCt; ji++) {
+        if (jobs[ji]->readFd < 0 || !(jobs[ji]->capture || jobs[ji]->draining))
+            continue;
+        pfds[pfdCt].fd = jobs[ji]->readFd;
+        pfds[pfdCt].events = POLLIN;
+        pjobs[pfdCt] = jobs[ji];
+        pfdCt++;
+    }
+
+    if (poll(pfds, pfdCt, wait / 1000000 + 1) < 0 && errno != EINTR) {
+        perror("poll");
+        terminate();
+    }
+
+    for (ci = 1; ci < pfdCt; ci++) {
+        struct Job *job = pjobs[ci];
+        ssize_t rd;
+        if (!pfds[ci].revents)
+            continue;
+        rd = read(job->readFd, buf, sizeof(buf));
+        if (rd < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        if (rd <= 0) {
+            close(job->readFd);
+            job->readFd = -1;
+            checkFinished(job);
+            continue;
+        }
+        if (job->capture) {
+            if (job->len + rd + 1 > job->size) {
+                job->size = (job->len + rd + 1) * 2;
+                job->buf = xrealloc(job->buf, job->size);
+            }
+            memcpy(job->buf + job->len, buf, rd);
+            job->len += rd;
+            job->buf[job->len] = 0;
+        }
+    }
+
+    if (pfds[0].revents) {
+        struct signalfd_siginfo si;
+        while (read(sigFd, &si, sizeof(si)) == sizeof(si)) {
+            if (si.ssi_signo == SIGTERM)
+                terminate();
+        }
+        reap();
+    }
+
+    free(pfds);
+    free(pjobs);
+}
+
+static void loopUntil(const int *flag)
+{
+    while (!*flag)
+        step();
+}
+
+// Run a single command to completion
+static struct Job *runSync(struct Job *job, struct Args *args, const char *outPath, int flags, int timeout, int capture)
+{
+    startJob(job, args->v[0], NULL, NULL);
+    startPipeline(job, args, 1, -1, -1, outPath, flags, timeout, 0, capture);
+    loopUntil(&job->finished);
+    if (capture && !job->buf)
+        job->buf = strdup("");
+    return job;
+}
+
+// Copy a file into another, as cp, making it executable if asked, as chmod a+x
+static int copyFile(const char *from, const char *to, int executable)
+{
+    char buf[65536];
+    struct stat sbuf;
+    ssize_t rd;
+    int in, out;
+
+    in = open(from, O_RDONLY);
+    if (in < 0 || fstat(in, &sbuf) < 0) {
+        perror(from);
+        return 0;
+    }
+    out = open(to, O_WRONLY|O_CREAT|O_TRUNC, sbuf.st_mode & 0777);
+    if (out < 0) {
+        perror(to);
+        close(in);
+        return 0;
+    }
+    while ((rd = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, rd) != rd) {
+            perror(to);
+            break;
+        }
+    }
+    if (executable && fstat(out, &sbuf) == 0)
+        fchmod(out, (sbuf.st_mode & 07777) | 0111);
+    close(in);
+    close(out);
+    return 1;
+}
+
+// Write each line of a file with a prefix and suffix, as sed 's/^/prefix/ ; s/$/suffix/'
+static void prefixLines(FILE *out, const char *path, const char *prefix, const char *suffix)
+{
+    FILE *in = fopen(path, "r");
+    char *line = NULL;
+    size_t lineSz = 0;
+    ssize_t len;
+
+    if (!in) {
+        perror(path);
+        return;
+    }
+    while ((len = getline(&line, &lineSz, in)) > 0) {
+        int nl = line[len-1] == '\n';
+        if (nl)
+            line[--len] = 0;
+        fprintf(out, "%s%s%s%s", prefix, line, suffix, nl ? "\n" : "");
+    }
+    free(line);
+    fclose(in);
+}
+
+static FILE *openOut(const char *path, const char *mode)
+{
+    FILE *f = fopen(path, mode);
+    if (!f) {
+        perror(path);
+        cleanup();
+        exit(1);
+    }
+    return f;
+}
+
+// Prepare the self-extractor or project file, and the files with them
+static void prepareExtras()
+{
+    char *lgpl = xasprintf("%s/cook/ffmpeg-lgpl21.txt", scriptBase);
+    char *path, *from;
+    const char *runMe = NULL;
+    FILE *f;
+    int ti;
+
+    if (!strcmp(formatName, "wavsfx") || !strcmp(formatName, "powersfx")) {
+        // The executable is just read by the container, so needn't be copied
+        from = xasprintf("%s/cook/ffmpeg-%s.exe", scriptBase,
+                         strcmp(formatName, "wavsfx") ? "fat" : "wav");
+        path = xasprintf("%s/ffmpeg.exe", outDir);
+        if (symlink(from, path) < 0)
+            perror(path);
+        free(from);
+        free(path);
+
+        if (!strcmp(formatName, "wavsfx")) {
+            path = xasprintf("%s/RunMe.bat", outDir);
+            f = openOut(path, "w");
+            prefixLines(f, lgpl, "@REM   ", "\r");
+            for (ti = 0; ti < trackCt; ti++) {
+                char *wav = strdup(tracks[ti].fileName);
+                size_t len = strlen(wav);
+                if (len >= 5 && !strcmp(wav + len - 5, ".flac"))
+                    wav[len-5] = 0;
+                fprintf(f, "ffmpeg -i %s %s.wav\r\ndel %s\r\n\r\n",
+                        tracks[ti].fileName, wav, tracks[ti].fileName);
+                free(wav);
+            }
+            fclose(f);
+            free(path);
+        }
+
+    } else if (!strcmp(formatName, "wavsfxm") || !strcmp(formatName, "wavsfxu")) {
+        runMe = "sh";
+        if (!strcmp(formatName, "wavsfxm")) {
+            from = xasprintf("%s/cook/ffmpeg-wav.macosx", scriptBase);
+            path = xasprintf("%s/ffmpeg", outDir);
+            copyFile(from, path, 1);
+            free(from);
+            free(path);
+            runMe = "command";
+        }
+
+        path = xasprintf("%s/RunMe.%s", outDir, runMe);
+        f = openOut(path, "w");
+        fprintf(f, "#!/bin/sh\n");
+        prefixLines(f, lgpl, "#   ", "");
+        fprintf(f, "set -e\ncd \"$(dirname \"$0\")\"\n\n");
+        for (ti = 0; ti < trackCt; ti++) {
+            char *wav = strdup(tracks[ti].fileName);
+            size_t len = strlen(wav);
+            if (len >= 5 && !strcmp(wav + len - 5, ".flac"))
+                wav[len-5] = 0;
+            fprintf(f, "%sffmpeg -i %s %s.wav\nrm %s\n\n",
+                    strcmp(formatName, "wavsfxm") ? "" : "./",
+                    tracks[ti].fileName, wav, tracks[ti].fileName);
+            free(wav);
+        }
+        fprintf(f, "printf '\\n\\n===\\nProcessing complete.\\n===\\n\\n'\n");
+        fclose(f);
+        chmod(path, 0755);
+        free(path);
+
+    } else if (!strcmp(formatName, "powersfxm") || !strcmp(formatName, "powersfxu")) {
+        if (!strcmp(formatName, "powersfxm")) {
+            from = xasprintf("%s/cook/ffmpeg-fat.macosx", scriptBase);
+            path = xasprintf("%s/ffmpeg", outDir);
+            copyFile(from, path, 1);
+            free(from);
+            free(path);
+        }
+        from = xasprintf("%s/cook/powersfx.sh", scriptBase);
+        path = xasprintf("%s/RunMe.%s", outDir, strcmp(formatName, "powersfxm") ? "sh" : "command");
+        copyFile(from, path, 1);
+        free(from);
+        free(path);
+
+    }
+
+    free(lgpl);
+}
+
+// The Audacity project, which needs the notes
+static void prepareProject()
+{
+    char *headerPath = xasprintf("%s/cook/aup-header.xml", scriptBase);
+    char *path = xasprintf("%s/out/%s.aup", tmpdir, id);
+    char *projName = xasprintf("%s_data", id);
+    FILE *in, *f;
+    struct Args args = {0};
+    struct Job job;
+    char *line = NULL, *at;
+    size_t lineSz = 0;
+    int ti;
+
+    in = openOut(headerPath, "r");
+    f = openOut(path, "w");
+    while (getline(&line, &lineSz, in) > 0) {
+        char *rest = line;
+        while ((at = strstr(rest, "@PROJNAME@"))) {
+            fwrite(rest, 1, at - rest, f);
+            fputs(projName, f);
+            rest = at + 10;
+        }
+        fputs(rest, f);
+    }
+    fclose(in);
+    fclose(f);
+
+    argAdd(&args, tool("extnotes"));
+    argAdd(&args, "-f");
+    argAdd(&args, "audacity");
+    argAdd(&args, recFile("header1"));
+    argAdd(&args, recFile("header2"));
+    argAdd(&args, recFile("data"));
+    runSync(&job, &args, path, STAGE_APPEND, DEF_TIMEOUT, 0);
+
+    f = openOut(path, "a");
+    for (ti = 0; ti < trackCt; ti++)
+        fprintf(f, "\t<import filename=\"%s\" offset=\"0.00000000\" mute=\"0\" solo=\"0\" height=\"150\" minimized=\"0\" gain=\"1.0\" pan=\"0.0\"/>\n",
+                tracks[ti].fileName);
+    fprintf(f, "</project>\n");
+    fclose(f);
+
+    free(line);
+    free(headerPath);
+    free(path);
+    free(projName);
+}
+
+// Read the plan from cookplan, and the durations, into tracks
+static void readTracks(const char *plan, const char *durations)
+{
+    const char *line;
+    int ti;
+
+    for (line = plan; *line; ) {
+        const char *end = strchr(line, '\n');
+        if (!end)
+            end = line + strlen(line);
+        if (end > line) {
+            struct Track *track;
+            char *copy = strndup(line, end - line), *fields[5] = {0}, *save = copy;
+            int fi;
+            for (fi = 0; fi < 5; fi++)
+                fields[fi] = strsep(&save, "\t");
+            if (fields[3]) {
+                tracks = xrealloc(tracks, (trackCt + 1) * sizeof(struct Track));
+                track = &tracks[trackCt++];
+                memset(track, 0, sizeof(*track));
+                snprintf(track->num, sizeof(track->num), "%s", fields[0]);
+                track->no = atoi(fields[0]);
+                track->streamNo = strtoul(fields[1], NULL, 10);
+                snprintf(track->codec, sizeof(track->codec), "%s", fields[2]);
+                track->user = strdup(fields[4] ? fields[4] : "");
+            }
+            free(copy);
+        }
+        line = *end ? end + 1 : end;
+    }
+
+    for (ti = 0; ti < trackCt; ti++) {
+        struct Track *track = &tracks[ti];
+        track->fileName = track->user[0]
+            ? xasprintf("%s-%s.%s", track->num, track->user, ext)
+            : xasprintf("%s.%s", track->num, ext);
+        track->path = xasprintf("%s/%s", outDir, track->fileName);
+
+        // The duration and size of the stream numbered as the track
+        strcpy(track->duration, "2.000000");
+        for (line = durations; *line; ) {
+            const char *end = strchr(line, '\n');
+            char *copy, *fields[4] = {0}, *save;
+            int fi;
+            if (!end)
+                end = line + strlen(line);
+            copy = strndup(line, end - line);
+            save = copy;
+            for (fi = 0; fi < 4; fi++)
+                fields[fi] = strsep(&save, "\t");
+            if (fields[2] && strcmp(fields[0], "*") && atoi(fields[0]) == track->no) {
+                snprintf(track->duration, sizeof(track->duration), "%s", fields[2]);
+                track->bytes = fields[3] ? strtoull(fields[3], NULL, 10) : 0;
+            }
+            free(copy);
+            line = *end ? end + 1 : end;
+        }
+    }
+}
+
+static void addInputs(struct Args *args)
+{
+    argAdd(args, recFile("header1"));
+    argAdd(args, recFile("header2"));
+    argAdd(args, recFile("data"));
+}
+
+static void startTracks();
+
+static void trackEncoded(struct Job *job)
+{
+    struct Track *track = job->arg;
+    if (job->failed) {
+        fprintf(stderr, "cookdriver: track %s failed\n", track->num);
+        tracksFailed++;
+    }
+    progressLine("{\"tool\":\"cookdriver\",\"pid\":%d,\"track\":%d,\"done\":true,\"failed\":%s}\n",
+                 (int) getpid(), track->no, job->failed ? "true" : "false");
+
+    if (track->held) {
+        struct Args args = {0};
+        argAdd(&args, sched);
+        argAdd(&args, "done");
+        startJob(&track->release, "cooksched done", NULL, NULL);
+        startPipeline(&track->release, &args, 1, -1, -1, NULL, 0, INFO_TIMEOUT, 0, 0);
+    }
+
+    tracksRunning--;
+    startTracks();
+}
+
+// Encode a track into its FIFO
+static void encodeTrack(struct Job *admit)
+{
+    struct Track *track = admit->arg;
+    struct Args stages[4] = {{0}};
+    int stageCt = 1, drain = 0;
+    int mixed = !strcmp(container, "mix");
+
+    // A failure of cooksched itself doesn't stop the track
+    track->held = track->sched && !admit->failed;
+    startJob(&track->encode, track->fileName, trackEncoded, track);
+
+    // But if the container's already done, nothing will read it
+    if (containerDone) {
+        track->encode.failed = 1;
+        checkFinished(&track->encode);
+        return;
+    }
+
+    if (mixed || !strcmp(formatName, "copy")) {
+        /* Corrected Ogg, for the container to handle, gated so that cookmix
+         * can skip the silence. This is one oggcorrect per track, not one
+         * oggcorrect --outdir for them all: that writes every track in input
+         * order, so a track that's silent for a while gets nothing until its
+         * next packet, and oggmultiplexer and cookmix, which wait on the
+         * track that's furthest behind, would leave the other tracks' FIFOs
+         * to fill and stop it before it got there. */
+        argAdd(&stages[0], tool("oggcorrect"));
+        if (progress) {
+            argAdd(&stages[0], "--progress-fd");
+            argAdd(&stages[0], "3");
+        }
+        if (mixed && mixer)
+            argAdd(&stages[0], "--gate");
+        argAdd(&stages[0], xasprintf("%u", track->streamNo));
+        addInputs(&stages[0]);
+
+    } else if (engine) {
+        argAdd(&stages[0], tool("cookengine"));
+        if (progress) {
+            argAdd(&stages[0], "--progress-fd");
+            argAdd(&stages[0], "3");
+        }
+        argAdd(&stages[0], xasprintf("%u", track->streamNo));
+        argAdd(&stages[0], track->duration);
+        addInputs(&stages[0]);
+
+    } else if (remux && !strcmp(track->codec, "opus")) {
+        argAdd(&stages[0], tool("oggopus"));
+        if (progress) {
+            argAdd(&stages[0], "--progress-fd");
+            argAdd(&stages[0], "3");
+        }
+        argAdd(&stages[0], xasprintf("%u", track->streamNo));
+        argAdd(&stages[0], track->duration);
+        addInputs(&stages[0]);
+
+    } else {
+        argAdd(&stages[0], tool("oggcorrect"));
+        if (progress) {
+            argAdd(&stages[0], "--progress-fd");
+            argAdd(&stages[0], "3");
+        }
+        argAdd(&stages[0], xasprintf("%u", track->streamNo));
+        addInputs(&stages[0]);
+
+        argAdd(&stages[1], "ffmpeg");
+        argAdd(&stages[1], "-codec");
+        argAdd(&stages[1], strcmp(track->codec, "opus") ? track->codec : "libopus");
+        argSplit(&stages[1], "-copyts -i - -af");
+        argAdd(&stages[1], filter);
+        argSplit(&stages[1], "-flags bitexact -f wav -");
+
+        argAdd(&stages[2], tool("wavduration"));
+        argAdd(&stages[2], track->duration);
+
+        argSplit(&stages[3], format->encode);
+        stageCt = 4;
+        drain = 1;
+    }
+
+    startPipeline(&track->encode, stages, stageCt, -1, -1, track->path,
+                  STAGE_NICE, DEF_TIMEOUT, drain, 0);
+}
+
+static void startTrack(struct Track *track)
+{
+    tracksRunning++;
+    tracksStarted++;
+
+    // Only the encoders wait their turn in cooksched
+    track->sched = sched && strcmp(formatName, "copy") && strcmp(container, "mix") &&
+        !(remux && !strcmp(track->codec, "opus"));
+    startJob(&track->admit, "cooksched wait", encodeTrack, track);
+    if (track->sched) {
+        struct Args args = {0};
+        argAdd(&args, sched);
+        argAdd(&args, "-j");
+        argAdd(&args, xasprintf("%d", SCHED_SLOTS));
+        argAdd(&args, "wait");
+        argAdd(&args, id);
+        argAdd(&args, xasprintf("%llu", (unsigned long long) track->bytes));
+        startPipeline(&track->admit, &args, 1, -1, -1, NULL, 0, 0, 0, 0);
+    } else {
+        checkFinished(&track->admit);
+    }
+}
+
+static void startTracks()
+{
+    while (!containerDone && tracksStarted < trackCt && tracksRunning < trackLimit)
+        startTrack(&tracks[tracksStarted]);
+}
+
+static const char *rawInfo;
+
+// Write raw.dat: the info and then the raw recording
+static int writeRaw(void *arg)
+{
+    const char *files[] = {"header1", "header2", "data"};
+    char buf[65536];
+    size_t len = strlen(rawInfo);
+    int fi;
+    (void) arg;
+
+    if (write(1, rawInfo, len) != (ssize_t) len)
+        return 1;
+    for (fi = 0; fi < 3; fi++) {
+        char *path = recFile(files[fi]);
+        int fd = open(path, O_RDONLY);
+        ssize_t rd;
+        if (fd < 0) {
+            perror(path);
+            return 1;
+        }
+        while ((rd = read(fd, buf, sizeof(buf))) > 0)
+            if (write(1, buf, rd) != rd)
+                return 1;
+        close(fd);
+        free(path);
+    }
+    return 0;
+}
+
+static const char *sfxPath;
+static struct Args sfxZip;
+
+// The self-extractor: its head, and then the zip
+static int writeSfx(void *arg)
+{
+    char buf[65536];
+    ssize_t rd;
+    int fd = open(sfxPath, O_RDONLY);
+    (void) arg;
+
+    if (fd < 0) {
+        perror(sfxPath);
+        return 1;
+    }
+    while ((rd = read(fd, buf, sizeof(buf))) > 0)
+        if (write(1, buf, rd) != rd)
+            return 1;
+    close(fd);
+    execvp(sfxZip.v[0], sfxZip.v);
+    perror(sfxZip.v[0]);
+    return 127;
+}
+
+// Add the tracks and other files for a zip
+static void addZipFiles(struct Args *args, const char *dir)
+{
+    int ti;
+    for (ti = 0; ti < trackCt; ti++)
+        argAdd(args, dir ? xasprintf("%s/%s", dir, tracks[ti].fileName) : tracks[ti].fileName);
+    if (!dir && format->extraFiles)
+        argSplit(args, format->extraFiles);
+    argAdd(args, dir ? xasprintf("%s/info.txt", dir) : "info.txt");
+    argAdd(args, dir ? xasprintf("%s/raw.dat", dir) : "raw.dat");
+}
+
+static void zipCommand(struct Args *args)
+{
+    char *cookzip = tool("cookzip");
+    if (!access(cookzip, X_OK)) {
+        argAdd(args, cookzip);
+        argAdd(args, format->zipFlags);
+    } else {
+        argAdd(args, "zip");
+        argAdd(args, format->zipFlags);
+    }
+    free(cookzip);
+}
+
+static void zipOut(struct Args *args)
+{
+    if (!haveTool("cookzip")) {
+        argAdd(args, "-FI");
+        argAdd(args, "-");
+    }
+}
+
+// Put the tracks into their container, writing to out
+static void startContainer(struct Job *job, int out, const char *duration)
+{
+    struct Args stages[3] = {{0}};
+    int ti;
+
+    startJob(job, "container", NULL, NULL);
+
+    if (!strcmp(container, "ogg") || !strcmp(container, "matroska")) {
+        if (!strcmp(formatName, "copy") && !strcmp(container, "ogg")) {
+            argAdd(&stages[0], tool("oggmultiplexer"));
+            if (progress) {
+                argAdd(&stages[0], "--progress-fd");
+                argAdd(&stages[0], "3");
+            }
+            for (ti = 0; ti < trackCt; ti++)
+                argAdd(&stages[0], tracks[ti].fileName);
+            startPipeline(job, stages, 1, -1, out, NULL, 0, 0, 0, 0);
+
+        } else {
+            argAdd(&stages[0], "ffmpeg");
+            for (ti = 0; ti < trackCt; ti++) {
+                if (!strcmp(formatName, "copy"))
+                    argAdd(&stages[0], "-copyts");
+                argAdd(&stages[0], "-i");
+                argAdd(&stages[0], tracks[ti].fileName);
+            }
+            for (ti = 0; ti < trackCt; ti++) {
+                argAdd(&stages[0], "-map");
+                argAdd(&stages[0], xasprintf("%d", ti));
+            }
+            argSplit(&stages[0], "-c:a copy -f");
+            argAdd(&stages[0], container);
+            argAdd(&stages[0], "-");
+            startPipeline(job, stages, 1, -1, out, NULL, STAGE_NICE, DEF_TIMEOUT, 0, 0);
+
+        }
+
+    } else if (!strcmp(container, "mix")) {
+        int stageCt;
+
+        if (mixer) {
+            // The same leveling and mixing, in one stage however many tracks,
+            // without decoding the silence
+            argAdd(&stages[0], tool("cookmix"));
+            argAdd(&stages[0], "--sparse");
+            argAdd(&stages[0], duration);
+            for (ti = 0; ti < trackCt; ti++)
+                argAdd(&stages[0], tracks[ti].fileName);
+            stageCt = 1;
+
+        } else {
+            size_t filterSz = 256 + trackCt * 64;
+            char *mixFilter = xrealloc(NULL, filterSz), *mix = xrealloc(NULL, filterSz);
+            int co = 0;
+
+            mixFilter[0] = mix[0] = 0;
+            argAdd(&stages[0], "ffmpeg");
+            for (ti = 0; ti < trackCt; ti++) {
+                argAdd(&stages[0], "-codec");
+                argAdd(&stages[0], strcmp(tracks[ti].codec, "opus") ? tracks[ti].codec : "libopus");
+                argAdd(&stages[0], "-copyts");
+                argAdd(&stages[0], "-i");
+                argAdd(&stages[0], tracks[ti].fileName);
+                sprintf(mixFilter + strlen(mixFilter), "[%d:a]dynaudnorm[aud%d];", ti, co);
+                sprintf(mix + strlen(mix), "[aud%d]", co);
+                co++;
+
+                // amix can only mix 32 at a time, so if we reached that, we have to start again
+                if (co == 32) {
+                    strcat(mix, " amix=32,dynaudnorm[aud0];[aud0]");
+                    co = 1;
+                }
+            }
+            sprintf(mix + strlen(mix), " amix=%d,dynaudnorm[aud]", co);
+            strcat(mixFilter, mix);
+            argAdd(&stages[0], "-filter_complex");
+            argAdd(&stages[0], mixFilter);
+            argSplit(&stages[0], "-map [aud] -flags bitexact -f wav -");
+            free(mixFilter);
+            free(mix);
+
+            argAdd(&stages[1], tool("wavduration"));
+            argAdd(&stages[1], duration);
+            stageCt = 2;
+        }
+
+        if (!format->encode) {
+            fprintf(stderr, "cookdriver: %s can't be mixed\n", formatName);
+            job->failed = 1;
+            checkFinished(job);
+            return;
+        }
+        argSplit(&stages[stageCt++], format->encode);
+        startPipeline(job, stages, stageCt, -1, out, NULL, STAGE_NICE, DEF_TIMEOUT, 1, 0);
+
+    } else if (!strcmp(container, "exe")) {
+        zipCommand(&sfxZip);
+        zipOut(&sfxZip);
+        addZipFiles(&sfxZip, NULL);
+        sfxPath = xasprintf("%s/cook/%s", scriptBase,
+                            strcmp(formatName, "powersfx") ? "sfx.exe" : "powersfx.exe");
+        startStage(job, NULL, writeSfx, NULL, -1, out, NULL, STAGE_NICE, DEF_TIMEOUT);
+        checkFinished(job);
+
+    } else if (!strcmp(container, "aupzip")) {
+        char *dataDir = xasprintf("%s_data", id);
+        zipCommand(&stages[0]);
+        argAdd(&stages[0], "-r");
+        zipOut(&stages[0]);
+        argAdd(&stages[0], xasprintf("%s.aup", id));
+        addZipFiles(&stages[0], dataDir);
+        free(dataDir);
+        startPipeline(job, stages, 1, -1, out, NULL, STAGE_NICE, DEF_TIMEOUT, 0, 0);
+
+    } else {
+        zipCommand(&stages[0]);
+        zipOut(&stages[0]);
+        addZipFiles(&stages[0], NULL);
+        startPipeline(job, stages, 1, -1, out, NULL, STAGE_NICE, DEF_TIMEOUT, 0, 0);
+
+    }
+}
+
+static void usage()
+{
+    fprintf(stderr, "Use: cookdriver [--progress-fd <fd>] <ID> [<format> [<container> [dynaudnorm]]]\n"
+                    "Cooks the recording to stdout. With --progress-fd, progress\n"
+                    "is reported to that fd as lines of JSON. With COOK_ENGINE=1 in the\n"
+                    "environment, FLAC tracks are encoded with cookengine, and with\n"
+                    "COOK_MIX=1, mixes are mixed with cookmix.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    char self[PATH_MAX], *slash, *tmpBase, *cacheTool, *key = NULL, *cacheDir;
+    struct Args args;
+    struct Job job, containerJob, putJob, rawJob = {0};
+    const char *plan, *durations, *duration = "2.000000";
+    struct rlimit limit;
+    sigset_t sigs;
+    int ai, lockFd, out = -1, cacheWrite = -1, ti, fd, incomplete = 0;
+    ssize_t len;
+
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    limit.rlim_cur = limit.rlim_max = 8ULL * 1024 * 1024 * 1024;
+    setrlimit(RLIMIT_AS, &limit);
+    fd = open("/proc/self/oom_adj", O_WRONLY);
+    if (fd >= 0) {
+        if (write(fd, "10\n", 3) < 0) {}
+        close(fd);
+    }
+
+    // Find ourself, and so everything else
+    len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0) {
+        perror("/proc/self/exe");
+        return 1;
+    }
+    self[len] = 0;
+    if ((slash = strrchr(self, '/')))
+        *slash = 0;
+    if ((slash = strrchr(self, '/')))
+        *slash = 0;
+    scriptBase = self;
+
+    for (ai = 1; ai < argc && !strncmp(argv[ai], "--", 2); ai++) {
+        if (!strcmp(argv[ai], "--")) {
+            ai++;
+            break;
+        } else if (!strcmp(argv[ai], "--progress-fd") && ai + 1 < argc) {
+            progressFd = atoi(argv[++ai]);
+            if (fcntl(progressFd, F_GETFD) < 0) {
+                perror("--progress-fd");
+                return 1;
+            }
+            progress = 1;
+        } else {
+            usage();
+        }
+    }
+    argc -= ai - 1;
+    argv += ai - 1;
+
+    if (argc < 2 || !argv[1][0])
+        usage();
+    id = argv[1];
+    if (argc > 2 && argv[2][0])
+        formatName = argv[2];
+    if (argc > 3 && argv[3][0])
+        container = argv[3];
+    for (ai = 4; ai < argc; ai++) {
+        if (!strcmp(argv[ai], "dynaudnorm")) {
+            strncat(filter, ",dynaudnorm", sizeof(filter) - strlen(filter) - 1);
+        } else {
+            fprintf(stderr, "Unrecognized argument \"%s\"\n", argv[ai]);
+            return 1;
+        }
+    }
+
+    for (format = formats; format->name && strcmp(format->name, formatName); format++);
+    if (format->zipOnly)
+        container = "zip";
+
+    /* cookengine does plain FLAC in one process, but doesn't filter. It hasn't
+     * been measured against flac on real recordings yet, so it's only used
+     * if asked for, with COOK_ENGINE=1. */
+    engine = format->engine && !strcmp(filter, "anull") && optedIn("COOK_ENGINE") && haveTool("cookengine");
+
+    /* cookmix mixes without ffmpeg, but its leveler isn't dynaudnorm, so its
+     * loudness isn't the same. Until it's been checked against dynaudnorm,
+     * it's only used if asked for, with COOK_MIX=1. */
+    mixer = !strcmp(container, "mix") && optedIn("COOK_MIX") && haveTool("cookmix");
+
+    // oggopus writes Opus tracks as Opus without decoding them, so can't filter either
+    remux = format->remux && !strcmp(filter, "anull") && haveTool("oggopus");
+
+    /* cookzip takes each file as it's finished, so the tracks can all be
+     * encoded at once, and with cooksched, they can all be started at once, to
+     * wait their turn */
+    if (haveTool("cookzip") &&
+        (!strcmp(container, "zip") || !strcmp(container, "aupzip") || !strcmp(container, "exe"))) {
+        parallel = ZIP_PARALLEL;
+        if (haveTool("cooksched"))
+            sched = tool("cooksched");
+    }
+
+    // mix: Smart auto-mixing, so ext is temporary
+    // aupzip: Even though we use FLAC, Audacity throws a fit if they're not called .ogg
+    ext = strdup((!strcmp(container, "mix") || !strcmp(container, "aupzip")) ? "ogg" : format->ext);
+
+    if (chdir(scriptBase) < 0 || chdir("rec") < 0) {
+        perror("rec");
+        return 1;
+    }
+
+    // Take a lock on the data file so that we can detect active downloads
+    {
+        char *dataPath = recFile("data");
+        lockFd = open(dataPath, O_RDONLY|O_CLOEXEC);
+        if (lockFd < 0 || flock(lockFd, LOCK_EX|LOCK_NB) < 0)
+            return 1;
+        free(dataPath);
+    }
+
+    tmpBase = getenv("TMPDIR");
+    if (!tmpBase || !tmpBase[0])
+        tmpBase = "/tmp";
+    sweepStale(tmpBase);
+    tmpdir = xasprintf("%s/cookdriver.XXXXXX", tmpBase);
+    if (!mkdtemp(tmpdir)) {
+        perror(tmpdir);
+        return 1;
+    }
+    outDir = xasprintf("%s/out", tmpdir);
+    if (mkdir(outDir, 0777) < 0) {
+        perror(outDir);
+        cleanup();
+        return 1;
+    }
+    if (!strcmp(container, "aupzip")) {
+        // Put actual audio in the _data dir
+        char *dataDir = xasprintf("%s/%s_data", outDir, id);
+        if (mkdir(dataDir, 0777) < 0) {
+            perror(dataDir);
+            cleanup();
+            return 1;
+        }
+        outDir = dataDir;
+    }
+
+    // From here, children are watched thru a signalfd
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGCHLD);
+    sigaddset(&sigs, SIGTERM);
+    sigprocmask(SIG_BLOCK, &sigs, NULL);
+    sigFd = signalfd(-1, &sigs, SFD_NONBLOCK|SFD_CLOEXEC);
+    if (sigFd < 0) {
+        perror("signalfd");
+        cleanup();
+        return 1;
+    }
+
+    // If we've cooked this recording this way before, it's just a copy
+    cacheTool = tool("cookcache");
+    cacheDir = xasprintf("%s/rec/cache", scriptBase);
+    if (!access(cacheTool, X_OK)) {
+        memset(&args, 0, sizeof(args));
+        argAdd(&args, cacheTool);
+        argAdd(&args, "key");
+        argAdd(&args, id);
+        argAdd(&args, formatName);
+        argAdd(&args, container);
+        argAdd(&args, filter);
+        runSync(&job, &args, NULL, 0, INFO_TIMEOUT, 1);
+        if (!job.failed && job.len) {
+            key = strndup(job.buf, strcspn(job.buf, "\n"));
+            memset(&args, 0, sizeof(args));
+            argAdd(&args, cacheTool);
+            argAdd(&args, "-d");
+            argAdd(&args, cacheDir);
+            argAdd(&args, "get");
+            argAdd(&args, key);
+            runSync(&job, &args, NULL, 0, 0, 0);
+            if (job.status == 0) {
+                cleanup();
+                return 0;
+            } else if (job.status != 1) {
+                // Some of it may have been written, so it's too late to cook it afresh
+                fprintf(stderr, "cookdriver: Failed to send the cached cook\n");
+                cleanup();
+                return 1;
+            }
+        }
+    }
+
+    // Bring the index up to date, so that durations don't need a scan per track
+    memset(&args, 0, sizeof(args));
+    argAdd(&args, tool("oggindex"));
+    argAdd(&args, recFile("data"));
+    runSync(&job, &args, NULL, STAGE_NICE|STAGE_QUIET, DEF_TIMEOUT, 0);
+
+    // Everything about the tracks, and every track's duration in one go
+    memset(&args, 0, sizeof(args));
+    argAdd(&args, tool("cookplan"));
+    argAdd(&args, "plan");
+    argAdd(&args, id);
+    plan = runSync(&job, &args, NULL, 0, INFO_TIMEOUT, 1)->buf;
+    incomplete |= job.failed;
+    memset(&args, 0, sizeof(args));
+    argAdd(&args, tool("oggduration"));
+    argAdd(&args, "--all");
+    argAdd(&args, recFile("data"));
+    durations = runSync(&job, &args, NULL, STAGE_NICE, DEF_TIMEOUT, 1)->buf;
+    incomplete |= job.failed;
+    readTracks(plan, durations);
+    for (const char *line = durations; line && *line; ) {
+        if (line[0] == '*' && line[1] == '\t') {
+            const char *field = strchr(line + 2, '\t');
+            if (field)
+                duration = strndup(field + 1, strcspn(field + 1, "\t\n"));
+        }
+        line = strchr(line, '\n');
+        line = line ? line + 1 : NULL;
+    }
+
+    progressLine("{\"tool\":\"cookdriver\",\"pid\":%d,\"tracks\":%d}\n", (int) getpid(), trackCt);
+
+    prepareExtras();
+    if (!strcmp(container, "aupzip"))
+        prepareProject();
+    for (ti = 0; ti < trackCt; ti++) {
+        if (mkfifo(tracks[ti].path, 0666) < 0) {
+            perror(tracks[ti].path);
+            cleanup();
+            return 1;
+        }
+    }
+
+    // Also provide raw.dat and info.txt
+    if (!strcmp(container, "zip") || !strcmp(container, "aupzip") || !strcmp(container, "exe")) {
+        char *rawPath = xasprintf("%s/raw.dat", outDir);
+        char *infoPath = xasprintf("%s/info.txt", outDir);
+
+        memset(&args, 0, sizeof(args));
+        argAdd(&args, tool("cookplan"));
+        argAdd(&args, "info");
+        argAdd(&args, id);
+        rawInfo = runSync(&job, &args, NULL, 0, INFO_TIMEOUT, 1)->buf;
+        incomplete |= job.failed;
+
+        argAdd(&args, "text");
+        incomplete |= runSync(&job, &args, infoPath, 0, INFO_TIMEOUT, 0)->failed;
+        memset(&args, 0, sizeof(args));
+        argAdd(&args, tool("extnotes"));
+        addInputs(&args);
+        incomplete |= runSync(&job, &args, infoPath, STAGE_APPEND, DEF_TIMEOUT, 0)->failed;
+
+        if (mkfifo(rawPath, 0666) < 0) {
+            perror(rawPath);
+            cleanup();
+            return 1;
+        }
+        startJob(&rawJob, "raw.dat", NULL, NULL);
+        startStage(&rawJob, NULL, writeRaw, NULL, -1, -1, rawPath, 0, DEF_TIMEOUT);
+        free(rawPath);
+        free(infoPath);
+    }
+
+    /* Encode thru the FIFOs. Ogg for the container to handle goes all at
+     * once, since the container reads every track at once; likewise with
+     * cookzip, as many at a time as it's worth (or every one, to wait its turn
+     * in cooksched); anything else reads them in order, so one at a time. */
+    if (!strcmp(formatName, "copy") || !strcmp(container, "mix"))
+        trackLimit = trackCt;
+    else if (parallel)
+        trackLimit = sched ? trackCt : parallel;
+    else
+        trackLimit = 1;
+    startTracks();
+
+    // The container writes to the cache as it writes to us, if it can
+    if (key) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == 0) {
+            memset(&args, 0, sizeof(args));
+            argAdd(&args, cacheTool);
+            argAdd(&args, "-d");
+            argAdd(&args, cacheDir);
+            argAdd(&args, "-b");
+            argAdd(&args, CACHE_BUDGET);
+            argAdd(&args, "put");
+            argAdd(&args, key);
+            argAdd(&args, xasprintf("%s/done", tmpdir));
+            startJob(&putJob, "cookcache put", NULL, NULL);
+            startStage(&putJob, args.v, NULL, NULL, fds[0], -1, NULL, 0, 0);
+            close(fds[0]);
+            out = cacheWrite = fds[1];
+        } else {
+            key = NULL;
+        }
+    }
+
+    if (chdir(outDir) < 0 || (!strcmp(container, "aupzip") && chdir("..") < 0)) {
+        perror(outDir);
+        terminate();
+    }
+    startContainer(&containerJob, out, duration);
+    loopUntil(&containerJob.finished);
+    containerDone = 1;
+
+    // Whatever the container didn't read, it never will
+    {
+        uint64_t straggle = now() + STRAGGLE_TIME * 1000000000ULL;
+        size_t ci;
+        for (ci = 0; ci < childCt; ci++) {
+            if (key && children[ci].job == &putJob)
+                continue;
+            if (!children[ci].deadline || children[ci].deadline > straggle)
+                children[ci].deadline = straggle;
+        }
+    }
+    while (jobCt > (key && !putJob.finished ? 1 : 0))
+        step();
+
+    /* Cache it only if every part of it finished: the container can succeed
+     * without all of its input (cookzip takes whatever's in a FIFO), so that
+     * it did isn't enough */
+    if (containerJob.failed || tracksFailed || tracksStarted < trackCt || rawJob.failed)
+        incomplete = 1;
+    if (key) {
+        if (!incomplete) {
+            char *done = xasprintf("%s/done", tmpdir);
+            fd = open(done, O_WRONLY|O_CREAT, 0666);
+            if (fd >= 0)
+                close(fd);
+            free(done);
+        }
+        close(cacheWrite);
+        loopUntil(&putJob.finished);
+    }
+
+    // And clean up after ourselves
+    if (chdir("/") < 0) {}
+    cleanup();
+    close(lockFd);
+    return containerJob.failed;
+}
@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* cookengine does in one process what cook.sh otherwise does with
+ * oggcorrect | ffmpeg | wavduration | flac: it corrects a track, decodes it
+ * (Opus or FLAC) and encodes it as 16-bit FLAC of exactly the given duration.
+ * There's no filtering, so cooks with filters still go through ffmpeg. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <FLAC/stream_decoder.h>
+#include <FLAC/stream_encoder.h>
+#include <opus_multistream.h>
+
+#include "oggcorr.h"
+#include "oggpage.h"
+
+// The most an Opus packet can decode to, per channel (120ms)
+#define OPUS_MAX_FRAME 5760
+
+struct Engine {
+    // Output format, once we know it
+    uint32_t rate, channels;
+
+    // Samples (per channel) to write in all, and written so far
+    double duration;
+    uint64_t total, written;
+
+    // Opus decoder, and how much we've still to skip from its start
+    OpusMSDecoder *opus;
+    uint32_t opusPreSkip;
+    opus_int16 *opusBuf;
+
+    // FLAC decoder, its stream header, and what it's to read next
+    FLAC__StreamDecoder *flac;
+    unsigned char flacHead[42];
+    const unsigned char *flacIn;
+    size_t flacInSize;
+
+    FLAC__StreamEncoder *encoder;
+
+    // Interleaved samples for the encoder
+    FLAC__int32 *pcm;
+    size_t pcmSz;
+};
+
+ssize_t writeAll(int fd, const void *vbuf, size_t count)
+{
+    const unsigned char *buf = (const unsigned char *) vbuf;
+    ssize_t wr = 0, ret;
+    while (wr < count) {
+        ret = write(fd, buf + wr, count - wr);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR)
+                continue;
+            return ret;
+        }
+        wr += ret;
+    }
+    return wr;
+}
+
+// Make sure we have room for this many samples per channel
+FLAC__int32 *pcmBuffer(struct Engine *engine, size_t samples)
+{
+    size_t size = samples * engine->channels;
+    if (size > engine->pcmSz) {
+        engine->pcm = realloc(engine->pcm, size * sizeof(FLAC__int32));
+        if (!engine->pcm) {
+            perror("realloc");
+            exit(1);
+        }
+        engine->pcmSz = size;
+    }
+    return engine->pcm;
+}
+
+FLAC__StreamEncoderWriteStatus encoderWrite(const FLAC__StreamEncoder *encoder,
+    const FLAC__byte buffer[], size_t bytes, uint32_t samples,
+    uint32_t currentFrame, void *arg)
+{
+    if (writeAll(1, buffer, bytes) != bytes)
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+    return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+// Start encoding, as soon as we know what we're encoding
+void startEncoder(struct Engine *engine)
+{
+    FLAC__StreamEncoder *encoder;
+
+    if (engine->encoder)
+        return;
+    if (!engine->rate) {
+        // Never got a usable header, so this'll just be silence
+        engine->rate = 48000;
+        engine->channels = 1;
+    }
+    engine->total = engine->duration * engine->rate;
+
+    encoder = engine->encoder = FLAC__stream_encoder_new();
+    if (!encoder) {
+        perror("FLAC__stream_encoder_new");
+        exit(1);
+    }
+    FLAC__stream_encoder_set_channels(encoder, engine->channels);
+    FLAC__stream_encoder_set_bits_per_sample(encoder, 16);
+    FLAC__stream_encoder_set_sample_rate(encoder, engine->rate);
+    FLAC__stream_encoder_set_compression_level(encoder, 5);
+    FLAC__stream_encoder_set_total_samples_estimate(encoder, engine->total);
+    if (FLAC__stream_encoder_init_stream(encoder, encoderWrite, NULL, NULL, NULL, engine) !=
+        FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+        fprintf(stderr, "Failed to start FLAC encoder\n");
+        exit(1);
+    }
+}
+
+// Encode this many samples per channel from engine->pcm, up to our duration
+void encode(struct Engine *engine, size_t samples)
+{
+    if (engine->written + samples > engine->total)
+        samples = engine->total - engine->written;
+    if (!samples)
+        return;
+    if (!FLAC__stream_encoder_process_interleaved(engine->encoder, engine->pcm, samples)) {
+        perror("write");
+        exit(1);
+    }
+    engine->written += samples;
+}
+
+FLAC__StreamDecoderReadStatus flacRead(const FLAC__StreamDecoder *decoder,
+    FLAC__byte buffer[], size_t *bytes, void *arg)
+{
+    struct Engine *engine = arg;
+    if (!engine->flacInSize) {
+        *bytes = 0;
+        return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+    }
+    if (*bytes > engine->flacInSize)
+        *bytes = engine->flacInSize;
+    memcpy(buffer, engine->flacIn, *bytes);
+    engine->flacIn += *bytes;
+    engine->flacInSize -= *bytes;
+    return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+FLAC__StreamDecoderWriteStatus flacWrite(const FLAC__StreamDecoder *decoder,
+    const FLAC__Frame *frame, const FLAC__int32 *const buffer[], void *arg)
+{
+    struct Engine *engine = arg;
+    uint32_t samples = frame->header.blocksize, bits = frame->header.bits_per_sample;
+    uint32_t channels = engine->channels, c, i;
+    FLAC__int32 *pcm = pcmBuffer(engine, samples);
+
+    // Interleave and bring to 16 bits, as ffmpeg would for WAV
+    if (frame->header.channels < channels)
+        channels = frame->header.channels;
+    memset(pcm, 0, samples * engine->channels * sizeof(FLAC__int32));
+    for (c = 0; c < channels; c++) {
+        const FLAC__int32 *in = buffer[c];
+        FLAC__int32 *out = pcm + c;
+        if (bits > 16) {
+            for (i = 0; i < samples; i++, out += engine->channels)
+                *out = in[i] >> (bits - 16);
+        } else {
+            for (i = 0; i < samples; i++, out += engine->channels)
+                *out = in[i] << (16 - bits);
+        }
+    }
+
+    encode(engine, samples);
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+void flacError(const FLAC__StreamDecoder *decoder,
+    FLAC__StreamDecoderErrorStatus status, void *arg)
+{
+    // Bad frames are skipped, as ffmpeg would
+}
+
+// Set up our decoder from a header page
+void readHeader(struct Engine *engine, const unsigned char *buf, uint32_t size)
+{
+    if (engine->opus || engine->flac)
+        return;
+
+    if (size >= 19 && !memcmp(buf, "OpusHead", 8)) {
+        static const unsigned char stereoMapping[] = {0, 1};
+        const unsigned char *mapping = stereoMapping;
+        int streams = 1, coupled, error;
+
+        engine->rate = 48000;
+        engine->channels = buf[9];
+        engine->opusPreSkip = buf[10] | (buf[11] << 8);
+        coupled = (engine->channels > 1) ? 1 : 0;
+        if (buf[18] != 0) {
+            // Explicit channel mapping
+            if (size < 21 + engine->channels)
+                return;
+            streams = buf[19];
+            coupled = buf[20];
+            mapping = buf + 21;
+        } else if (engine->channels > 2) {
+            return;
+        }
+
+        engine->opus = opus_multistream_decoder_create(48000, engine->channels,
+            streams, coupled, mapping, &error);
+        if (!engine->opus) {
+            fprintf(stderr, "Failed to start Opus decoder: %s\n", opus_strerror(error));
+            exit(1);
+        }
+        opus_multistream_decoder_ctl(engine->opus,
+            OPUS_SET_GAIN((int16_t) (buf[16] | (buf[17] << 8))));
+
+        engine->opusBuf = malloc(OPUS_MAX_FRAME * engine->channels * sizeof(opus_int16));
+        if (!engine->opusBuf) {
+            perror("malloc");
+            exit(1);
+        }
+
+    } else if (size >= 51 && !memcmp(buf, "\x7f""FLAC", 5)) {
+        // Ogg FLAC mapping header, then fLaC and the STREAMINFO block
+        const unsigned char *streamInfo = buf + 17;
+        engine->rate = (streamInfo[10] << 12) | (streamInfo[11] << 4) | (streamInfo[12] >> 4);
+        engine->channels = ((streamInfo[12] >> 1) & 7) + 1;
+
+        // Make it look like a native FLAC stream with only STREAMINFO
+        memcpy(engine->flacHead, buf + 9, 42);
+        engine->flacHead[4] |= 0x80;
+
+        engine->flac = FLAC__stream_decoder_new();
+        if (!engine->flac ||
+            FLAC__stream_decoder_init_stream(engine->flac, flacRead, NULL, NULL,
+                NULL, NULL, flacWrite, NULL, flacError, engine) !=
+                FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+            fprintf(stderr, "Failed to start FLAC decoder\n");
+            exit(1);
+        }
+        engine->flacIn = engine->flacHead;
+        engine->flacInSize = sizeof(engine->flacHead);
+        FLAC__stream_decoder_process_until_end_of_metadata(engine->flac);
+
+    }
+}
+
+// Decode a data page and encode what it gives us
+void readData(struct Engine *engine, const unsigned char *buf, uint32_t size)
+{
+    startEncoder(engine);
+    if (engine->written >= engine->total) {
+        // Anything more would be cut off anyway
+        return;
+    }
+
+    if (engine->opus) {
+        int samples = opus_multistream_decode(engine->opus, buf, size,
+            engine->opusBuf, OPUS_MAX_FRAME, 0);
+        opus_int16 *in = engine->opusBuf;
+        FLAC__int32 *pcm;
+        size_t i;
+
+        if (samples <= 0)
+            return;
+
+        // Skip the start, as the header says
+        if (engine->opusPreSkip) {
+            uint32_t skip = engine->opusPreSkip;
+            if (skip > samples)
+                skip = samples;
+            engine->opusPreSkip -= skip;
+            in += skip * engine->channels;
+            samples -= skip;
+        }
+
+        pcm = pcmBuffer(engine, samples);
+        for (i = 0; i < (size_t) samples * engine->channels; i++)
+            pcm[i] = in[i];
+        encode(engine, samples);
+
+    } else if (engine->flac) {
+        engine->flacIn = buf;
+        engine->flacInSize = size;
+        FLAC__stream_decoder_process_single(engine->flac);
+        if (FLAC__stream_decoder_get_state(engine->flac) == FLAC__STREAM_DECODER_END_OF_STREAM) {
+            // A bad frame wanted more than we had. Start fresh with the next.
+            FLAC__stream_decoder_flush(engine->flac);
+        }
+        engine->flacInSize = 0;
+
+    }
+}
+
+void corrected(void *arg, struct OggCorrectTrack *track, int header,
+               struct OggHeader *oggHeader, const unsigned char *data, uint32_t size)
+{
+    if (header)
+        readHeader(arg, data, size);
+    else
+        readData(arg, data, size);
+}
+
+void usage()
+{
+    fprintf(stderr, "Use: cookengine [--progress-fd <fd>] <track no> <duration> [input files]\n"
+                    "Writes the track as FLAC of exactly the given duration, in seconds.\n"
+                    "With no input files, the input on stdin must be given twice.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static struct Engine engine;
+    struct OggCorrector corrector;
+    struct OggReader reader;
+    size_t samples;
+
+    oggProgressArgs(&argc, argv, "cookengine");
+    if (argc < 3)
+        usage();
+    engine.duration = atof(argv[2]);
+    if (engine.duration < 0)
+        usage();
+
+    if (!oggCorrectorInit(&corrector, 0, NULL, corrected, &engine)) {
+        perror("malloc");
+        exit(1);
+    }
+    oggCorrectAddTrack(&corrector, atoi(argv[1]));
+
+    if (!oggReaderOpen(&reader, argc - 3, argv + 3)) {
+        perror("open");
+        exit(1);
+    }
+    oggProgressAddReader(&reader);
+    oggProgress.passes = 2;
+
+    oggCorrect(&corrector, &reader);
+
+    // Fill out the rest of the duration with silence
+    startEncoder(&engine);
+    while (engine.written < engine.total) {
+        samples = engine.total - engine.written;
+        if (samples > 48000)
+            samples = 48000;
+        memset(pcmBuffer(&engine, samples), 0, samples * engine.channels * sizeof(FLAC__int32));
+        encode(&engine, samples);
+    }
+    if (!FLAC__stream_encoder_finish(engine.encoder)) {
+        perror("write");
+        exit(1);
+    }
+
+    oggProgressDone();
+    return 0;
+}
@@ -0,0 +1,898 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* cookmix mixes any number of corrected tracks (as written by oggcorrect, Opus
+ * or FLAC) in one stage, and writes the mix as 16-bit WAV of exactly the given
+ * duration, ready for an encoder. It does what cook.sh's ffmpeg graph of
+ * dynaudnorms and amixes did: each track is leveled, they're summed, and the
+ * sum is leveled again. The leveler is a simpler cousin of dynaudnorm: frames
+ * of half a second are each given the gain that would bring their peak to
+ * LEVEL_PEAK, and those gains are smoothed (minimum, then Gaussian) over
+ * LEVEL_RADIUS frames either side, so each leveler delays its output by twice
+ * that. The tracks are read in step, a frame at a time, so each input (usually
+ * a FIFO) only ever needs to be a frame ahead of the others.
+ *
+ * A frame of a track with nothing decoded in it is known to be silent, so it's
+ * neither leveled nor summed. In sparse mode, that goes further: once a track
+ * has been silent (by its packets' size, as oggcorrect judges it, or by
+ * oggcorrect --gate) for SPARSE_AFTER packets, its silent packets aren't
+ * decoded at all, and its decoder is reset, so that it doesn't carry old sound
+ * into the next sound. What that saves in CPU time hasn't been measured with
+ * the real libopus; --stats counts the packets and frames skipped, not time.
+ *
+ * The mix is at the highest rate of any track. Tracks at a lower rate (such as
+ * 44.1kHz FLAC among 48kHz Opus) are resampled to it as they're decoded, with
+ * a windowed sinc, as ffmpeg's amix would have had them resampled. */
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIX_X86 1
+#endif
+
+#include <FLAC/stream_decoder.h>
+#include <opus_multistream.h>
+
+#include "oggpage.h"
+
+// The most an Opus packet can decode to, per channel (120ms)
+#define OPUS_MAX_FRAME 5760
+
+#define LEVEL_RADIUS 15
+#define LEVEL_DELAY (2*LEVEL_RADIUS)
+#define LEVEL_PEAK 0.95
+#define LEVEL_MAX_GAIN 10.0
+
+// Silent packets (100ms worth) to decode before skipping them in sparse mode
+#define SPARSE_AFTER 5
+
+// The resampler's taps either side of each output, and its kernel's phases
+#define RESAMPLE_TAPS 16
+#define RESAMPLE_PHASES 256
+
+struct Leveler {
+    uint32_t channels;
+    size_t frameLen; // In samples per channel
+
+    // The frames we're holding back, as a ring of LEVEL_DELAY+1, and which are silent
+    float *frames;
+    unsigned char silent[LEVEL_DELAY + 1];
+
+    // Gains of the frames up to the last one pushed, as a ring
+    double gains[2*LEVEL_DELAY + 1];
+    double weights[2*LEVEL_RADIUS + 1];
+
+    uint64_t pushed;
+    double lastGain;
+};
+
+// A track's resampler: its input, and where in it the next output falls
+struct Resampler {
+    double step, pos;
+    float *kernel; // (RESAMPLE_PHASES+1) phases of 2*RESAMPLE_TAPS taps
+    float *in;
+    size_t inLen, inSz; // In samples per channel
+};
+
+struct Track {
+    const char *path;
+    struct OggReader reader;
+    int eof;
+
+    uint32_t rate, channels;
+
+    // Opus decoder, and how much we've still to skip from its start
+    OpusMSDecoder *opus;
+    uint32_t opusPreSkip;
+
+    // FLAC decoder, its stream header, and what it's to read next
+    FLAC__StreamDecoder *flac;
+    unsigned char flacHead[42];
+    const unsigned char *flacIn;
+    size_t flacInSize;
+
+    // Decoded samples not yet mixed, interleaved
+    float *pcm;
+    size_t pcmStart, pcmEnd, pcmSz;
+
+    // Only if it's not at the mix's rate
+    struct Resampler resampler;
+
+    /* How many floats we've mixed, and where the last sound ends, so that
+     * frames after it are known to be silent */
+    uint64_t consumed, soundEnd;
+
+    // Silent packets in a row, and packets decoded and skipped
+    uint32_t silentRun;
+    uint64_t decoded, skipped;
+
+    struct Leveler leveler;
+};
+
+static uint32_t rate = 0, channels = 0;
+static size_t frameLen;
+static int sparse = 0;
+
+// out[i] += in[i] * (gain + i*step)
+void (*mixAdd)(float *out, const float *in, size_t n, float gain, float step);
+
+// out[i] = in[i] * (gain + i*step), as 16-bit, clipped
+void (*toS16)(int16_t *out, const float *in, size_t n, float gain, float step);
+
+// max(|in[i]|)
+float (*peak)(const float *in, size_t n);
+
+void mixAddC(float *out, const float *in, size_t n, float gain, float step)
+{
+    size_t i;
+    for (i = 0; i < n; i++)
+        out[i] += in[i] * (gain + i*step);
+}
+
+void toS16C(int16_t *out, const float *in, size_t n, float gain, float step)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        float v = in[i] * (gain + i*step) * 32767.0f;
+        if (v > 32767.0f)
+            v = 32767.0f;
+        else if (v < -32768.0f)
+            v = -32768.0f;
+        out[i] = lrintf(v);
+    }
+}
+
+float peakC(const float *in, size_t n)
+{
+    float ret = 0;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        float v = fabsf(in[i]);
+        if (v > ret)
+            ret = v;
+    }
+    return ret;
+}
+
+#ifdef MIX_X86
+__attribute__((target("avx2,fma")))
+void mixAddAVX2(float *out, const float *in, size_t n, float gain, float step)
+{
+    __m256 ramp = _mm256_fmadd_ps(_mm256_set1_ps(step),
+        _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_ps(gain));
+    size_t i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256 g = _mm256_add_ps(ramp, _mm256_set1_ps(i*step));
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(in + i), g,
+            _mm256_loadu_ps(out + i)));
+    }
+    for (; i < n; i++)
+        out[i] += in[i] * (gain + i*step);
+}
+
+void mixAddSSE(float *out, const float *in, size_t n, float gain, float step)
+{
+    __m128 ramp = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(step), _mm_setr_ps(0, 1, 2, 3)),
+        _mm_set1_ps(gain));
+    size_t i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128 g = _mm_add_ps(ramp, _mm_set1_ps(i*step));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i),
+            _mm_mul_ps(_mm_loadu_ps(in + i), g)));
+    }
+    for (; i < n; i++)
+        out[i] += in[i] * (gain + i*step);
+}
+
+void toS16SSE(int16_t *out, const float *in, size_t n, float gain, float step)
+{
+    __m128 ramp = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(step), _mm_setr_ps(0, 1, 2, 3)),
+        _mm_set1_ps(gain));
+    __m128 scale = _mm_set1_ps(32767.0f), lo = _mm_set1_ps(-32768.0f);
+    size_t i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128 g0 = _mm_add_ps(ramp, _mm_set1_ps(i*step));
+        __m128 g1 = _mm_add_ps(ramp, _mm_set1_ps((i+4)*step));
+        __m128 v0 = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(in + i), g0), scale);
+        __m128 v1 = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), g1), scale);
+        // Clip before converting, since out-of-range conversions go negative
+        v0 = _mm_max_ps(_mm_min_ps(v0, scale), lo);
+        v1 = _mm_max_ps(_mm_min_ps(v1, scale), lo);
+        _mm_storeu_si128((__m128i *) (out + i),
+            _mm_packs_epi32(_mm_cvtps_epi32(v0), _mm_cvtps_epi32(v1)));
+    }
+    toS16C(out + i, in + i, n - i, gain + i*step, step);
+}
+
+float peakSSE(const float *in, size_t n)
+{
+    __m128 abs = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 max0 = _mm_setzero_ps(), max1 = _mm_setzero_ps();
+    float part[4], ret;
+    size_t i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        max0 = _mm_max_ps(max0, _mm_and_ps(_mm_loadu_ps(in + i), abs));
+        max1 = _mm_max_ps(max1, _mm_and_ps(_mm_loadu_ps(in + i + 4), abs));
+    }
+    _mm_storeu_ps(part, _mm_max_ps(max0, max1));
+    ret = peakC(in + i, n - i);
+    for (i = 0; i < 4; i++) {
+        if (part[i] > ret)
+            ret = part[i];
+    }
+    return ret;
+}
+#endif
+
+void *allocOrDie(size_t size)
+{
+    void *ret = calloc(1, size);
+    if (!ret) {
+        perror("malloc");
+        exit(1);
+    }
+    return ret;
+}
+
+void levelerInit(struct Leveler *lv, uint32_t channels)
+{
+    double sigma = (LEVEL_RADIUS - 1) / 3.0, sum = 0;
+    int k;
+
+    lv->channels = channels;
+    lv->frameLen = frameLen;
+    lv->frames = allocOrDie((LEVEL_DELAY + 1) * frameLen * channels * sizeof(float));
+    for (k = -LEVEL_RADIUS; k <= LEVEL_RADIUS; k++)
+        sum += lv->weights[k + LEVEL_RADIUS] = exp(-(k*k) / (2*sigma*sigma));
+    for (k = 0; k <= 2*LEVEL_RADIUS; k++)
+        lv->weights[k] /= sum;
+    lv->pushed = 0;
+    lv->lastGain = -1;
+}
+
+#define GAIN(lv, j) ((lv)->gains[(j) % (2*LEVEL_DELAY + 1)])
+
+/* Push a frame (NULL if it's silent), and get back the frame LEVEL_DELAY
+ * before it (NULL if that was silent), with the gain to ramp across it.
+ * Returns 0 if there's no such frame yet. The frame returned is only good
+ * until the next push. */
+int levelerPush(struct Leveler *lv, const float *frame, const float **out,
+                double *gain0, double *gain1)
+{
+    size_t n = lv->frameLen * lv->channels, slot = lv->pushed % (LEVEL_DELAY + 1);
+    uint64_t cur = lv->pushed + LEVEL_DELAY, mid; // Offset so j-LEVEL_DELAY*2 >= 0
+    float max = frame ? peak(frame, n) : 0;
+    double gain, smooth = 0;
+    int j, k;
+
+    gain = (max * LEVEL_MAX_GAIN > LEVEL_PEAK) ? LEVEL_PEAK / max : LEVEL_MAX_GAIN;
+    if (!lv->pushed) {
+        // Before the start, pretend it was all like the first frame
+        for (j = 0; j < 2*LEVEL_DELAY + 1; j++)
+            lv->gains[j] = gain;
+    }
+    GAIN(lv, cur) = gain;
+    lv->silent[slot] = !frame;
+    if (frame)
+        memcpy(lv->frames + slot * n, frame, n * sizeof(float));
+    lv->pushed++;
+
+    if (lv->pushed <= LEVEL_DELAY)
+        return 0;
+
+    // Smooth the minimum over the frames around the one going out
+    mid = cur - LEVEL_DELAY;
+    for (k = -LEVEL_RADIUS; k <= LEVEL_RADIUS; k++) {
+        double min = LEVEL_MAX_GAIN;
+        for (j = -LEVEL_RADIUS; j <= LEVEL_RADIUS; j++) {
+            double g = GAIN(lv, mid + k + j);
+            if (g < min)
+                min = g;
+        }
+        smooth += lv->weights[k + LEVEL_RADIUS] * min;
+    }
+
+    *gain0 = (lv->lastGain < 0) ? smooth : lv->lastGain;
+    *gain1 = lv->lastGain = smooth;
+    slot = (lv->pushed - 1 - LEVEL_DELAY) % (LEVEL_DELAY + 1);
+    *out = lv->silent[slot] ? NULL : lv->frames + slot * n;
+    return 1;
+}
+
+// Make room for this many more decoded floats
+float *pcmBuffer(struct Track *track, size_t count)
+{
+    if (track->pcmStart && track->pcmEnd + count > track->pcmSz) {
+        memmove(track->pcm, track->pcm + track->pcmStart,
+            (track->pcmEnd - track->pcmStart) * sizeof(float));
+        track->pcmEnd -= track->pcmStart;
+        track->pcmStart = 0;
+    }
+    if (track->pcmEnd + count > track->pcmSz) {
+        track->pcmSz = (track->pcmEnd + count) * 2;
+        track->pcm = realloc(track->pcm, track->pcmSz * sizeof(float));
+        if (!track->pcm) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    return track->pcm + track->pcmEnd;
+}
+
+FLAC__StreamDecoderReadStatus flacRead(const FLAC__StreamDecoder *decoder,
+    FLAC__byte buffer[], size_t *bytes, void *arg)
+{
+    struct Track *track = arg;
+    if (!track->flacInSize) {
+        *bytes = 0;
+        return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+    }
+    if (*bytes > track->flacInSize)
+        *bytes = track->flacInSize;
+    memcpy(buffer, track->flacIn, *bytes);
+    track->flacIn += *bytes;
+    track->flacInSize -= *bytes;
+    return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+FLAC__StreamDecoderWriteStatus flacWrite(const FLAC__StreamDecoder *decoder,
+    const FLAC__Frame *frame, const FLAC__int32 *const buffer[], void *arg)
+{
+    struct Track *track = arg;
+    uint32_t samples = frame->header.blocksize, c, i;
+    uint32_t channels = track->channels;
+    float scale = 1.0f / (1 << (frame->header.bits_per_sample - 1));
+    float *pcm = pcmBuffer(track, samples * track->channels);
+
+    if (frame->header.channels < channels)
+        channels = frame->header.channels;
+    memset(pcm, 0, samples * track->channels * sizeof(float));
+    for (c = 0; c < channels; c++) {
+        const FLAC__int32 *in = buffer[c];
+        float *out = pcm + c;
+        for (i = 0; i < samples; i++, out += track->channels)
+            *out = in[i] * scale;
+    }
+    track->pcmEnd += samples * track->channels;
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+void flacError(const FLAC__StreamDecoder *decoder,
+    FLAC__StreamDecoderErrorStatus status, void *arg)
+{
+    // Bad frames are skipped, as ffmpeg would
+}
+
+// Set up our decoder from a header page
+void readHeader(struct Track *track, const unsigned char *buf, uint32_t size)
+{
+    if (size >= 19 && !memcmp(buf, "OpusHead", 8)) {
+        static const unsigned char stereoMapping[] = {0, 1};
+        const unsigned char *mapping = stereoMapping;
+        int streams = 1, coupled, error;
+
+        track->rate = 48000;
+        track->channels = buf[9];
+        track->opusPreSkip = buf[10] | (buf[11] << 8);
+        coupled = (track->channels > 1) ? 1 : 0;
+        if (buf[18] != 0) {
+            // Explicit channel mapping
+            if (size < 21 + track->channels)
+                return;
+            streams = buf[19];
+            coupled = buf[20];
+            mapping = buf + 21;
+        } else if (track->channels > 2) {
+            return;
+        }
+
+        track->opus = opus_multistream_decoder_create(48000, track->channels,
+            streams, coupled, mapping, &error);
+        if (!track->opus) {
+            fprintf(stderr, "%s: Failed to start Opus decoder: %s\n", track->path,
+                opus_strerror(error));
+            exit(1);
+        }
+        opus_multistream_decoder_ctl(track->opus,
+            OPUS_SET_GAIN((int16_t) (buf[16] | (buf[17] << 8))));
+
+    } else if (size >= 51 && !memcmp(buf, "\x7f""FLAC", 5)) {
+        // Ogg FLAC mapping header, then fLaC and the STREAMINFO block
+        const unsigned char *streamInfo = buf + 17;
+        track->rate = (streamInfo[10] << 12) | (streamInfo[11] << 4) | (streamInfo[12] >> 4);
+        track->channels = ((streamInfo[12] >> 1) & 7) + 1;
+
+        // Make it look like a native FLAC stream with only STREAMINFO
+        memcpy(track->flacHead, buf + 9, 42);
+        track->flacHead[4] |= 0x80;
+
+        track->flac = FLAC__stream_decoder_new();
+        if (!track->flac ||
+            FLAC__stream_decoder_init_stream(track->flac, flacRead, NULL, NULL,
+                NULL, NULL, flacWrite, NULL, flacError, track) !=
+                FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+            fprintf(stderr, "%s: Failed to start FLAC decoder\n", track->path);
+            exit(1);
+        }
+        track->flacIn = track->flacHead;
+        track->flacInSize = sizeof(track->flacHead);
+        FLAC__stream_decoder_process_until_end_of_metadata(track->flac);
+
+    }
+}
+
+/* Decode a data page onto the end of the track's samples. Returns 1 if what
+ * it decoded counts as sound. */
+int decodeData(struct Track *track, const unsigned char *buf, uint32_t size)
+{
+    if (track->opus) {
+        float *pcm;
+        int samples;
+
+        if (size >= 8 && !memcmp(buf, "OpusTags", 8))
+            return 0;
+
+        if (sparse && size < 8) {
+            // Silent, so once it's been silent a while, don't bother decoding
+            samples = opus_packet_get_nb_samples(buf, size, 48000);
+            if (++track->silentRun > SPARSE_AFTER && samples > 0 && !track->opusPreSkip) {
+                if (track->silentRun == SPARSE_AFTER + 1)
+                    opus_multistream_decoder_ctl(track->opus, OPUS_RESET_STATE);
+                memset(pcmBuffer(track, samples * track->channels), 0,
+                    samples * track->channels * sizeof(float));
+                track->pcmEnd += samples * track->channels;
+                track->skipped++;
+                return 0;
+            }
+        } else {
+            track->silentRun = 0;
+        }
+
+        pcm = pcmBuffer(track, OPUS_MAX_FRAME * track->channels);
+        samples = opus_multistream_decode_float(track->opus, buf, size,
+            pcm, OPUS_MAX_FRAME, 0);
+        track->decoded++;
+        if (samples <= 0)
+            return 0;
+
+        // Skip the start, as the header says
+        if (track->opusPreSkip) {
+            uint32_t skip = track->opusPreSkip;
+            if (skip > samples)
+                skip = samples;
+            track->opusPreSkip -= skip;
+            memmove(pcm, pcm + skip * track->channels,
+                (samples - skip) * track->channels * sizeof(float));
+            samples -= skip;
+        }
+        track->pcmEnd += samples * track->channels;
+
+    } else if (track->flac) {
+        // Metadata blocks (comments, etc.) don't start with a frame sync
+        if (!size || buf[0] != 0xFF)
+            return 0;
+        track->flacIn = buf;
+        track->flacInSize = size;
+        FLAC__stream_decoder_process_single(track->flac);
+        track->decoded++;
+        if (FLAC__stream_decoder_get_state(track->flac) == FLAC__STREAM_DECODER_END_OF_STREAM) {
+            // A bad frame wanted more than we had. Start fresh with the next.
+            FLAC__stream_decoder_flush(track->flac);
+        }
+        track->flacInSize = 0;
+
+    }
+
+    // Whatever we decoded counts as sound
+    return 1;
+}
+
+// Set up resampling from the track's rate to the mix's
+void resamplerInit(struct Track *track)
+{
+    struct Resampler *rs = &track->resampler;
+    double cutoff, x, sum;
+    int phase, j;
+
+    rs->step = (double) track->rate / rate;
+    cutoff = rs->step > 1 ? 1 / rs->step : 1;
+    rs->kernel = allocOrDie((RESAMPLE_PHASES + 1) * 2 * RESAMPLE_TAPS * sizeof(float));
+    for (phase = 0; phase <= RESAMPLE_PHASES; phase++) {
+        float *k = rs->kernel + phase * 2 * RESAMPLE_TAPS;
+        sum = 0;
+        for (j = 0; j < 2 * RESAMPLE_TAPS; j++) {
+            // Distance from the output to this tap, in input samples
+            x = j - RESAMPLE_TAPS + 1 - (double) phase / RESAMPLE_PHASES;
+            k[j] = (x == 0 ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x)) *
+                (0.5 + 0.5 * cos(M_PI * x / RESAMPLE_TAPS));
+            sum += k[j];
+        }
+        for (j = 0; j < 2 * RESAMPLE_TAPS; j++)
+            k[j] /= sum;
+    }
+
+    // Start with silence before the first sample, so the first output is at it
+    rs->inSz = 4 * RESAMPLE_TAPS;
+    rs->in = allocOrDie(rs->inSz * track->channels * sizeof(float));
+    rs->inLen = rs->pos = RESAMPLE_TAPS - 1;
+}
+
+/* Resample the samples from this point in the track's buffer (in floats) to
+ * the end, leaving the resampled samples in their place */
+void resample(struct Track *track, size_t from)
+{
+    struct Resampler *rs = &track->resampler;
+    size_t ch = track->channels, inCt = (track->pcmEnd - from) / ch, outCt = 0, drop, i;
+    float *out;
+    uint32_t c;
+    int j;
+
+    // Add them to the resampler's input
+    if (rs->inLen + inCt > rs->inSz) {
+        rs->inSz = (rs->inLen + inCt) * 2;
+        rs->in = realloc(rs->in, rs->inSz * ch * sizeof(float));
+        if (!rs->in) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memcpy(rs->in + rs->inLen * ch, track->pcm + from, inCt * ch * sizeof(float));
+    rs->inLen += inCt;
+    track->pcmEnd = from;
+
+    // Every output whose taps are all in by now
+    while ((size_t) (rs->pos + outCt * rs->step) + RESAMPLE_TAPS < rs->inLen)
+        outCt++;
+    out = pcmBuffer(track, outCt * ch);
+    for (i = 0; i < outCt; i++, rs->pos += rs->step) {
+        size_t at = (size_t) rs->pos;
+        const float *k = rs->kernel + 2 * RESAMPLE_TAPS *
+            (size_t) lrint((rs->pos - at) * RESAMPLE_PHASES);
+        const float *in = rs->in + (at + 1 - RESAMPLE_TAPS) * ch;
+        for (c = 0; c < ch; c++) {
+            float v = 0;
+            for (j = 0; j < 2 * RESAMPLE_TAPS; j++)
+                v += k[j] * in[j * ch + c];
+            out[i * ch + c] = v;
+        }
+    }
+    track->pcmEnd += outCt * ch;
+
+    // Keep only what the next outputs will need
+    drop = (size_t) rs->pos + 1 - RESAMPLE_TAPS;
+    memmove(rs->in, rs->in + drop * ch, (rs->inLen - drop) * ch * sizeof(float));
+    rs->inLen -= drop;
+    rs->pos -= drop;
+}
+
+// Decode a data page, resampling it if need be
+void readData(struct Track *track, const unsigned char *buf, uint32_t size)
+{
+    size_t have = track->pcmEnd - track->pcmStart;
+    int sound = decodeData(track, buf, size);
+    if (track->resampler.step)
+        resample(track, track->pcmStart + have);
+    if (sound)
+        track->soundEnd = track->consumed + track->pcmEnd - track->pcmStart;
+}
+
+// Read and decode until we have this many floats, or the track's done
+void fill(struct Track *track, size_t count)
+{
+    struct OggPage page;
+    while (!track->eof && track->pcmEnd - track->pcmStart < count) {
+        if (!oggReadPage(&track->reader, &page)) {
+            track->eof = 1;
+            break;
+        }
+        if (!track->opus && !track->flac)
+            readHeader(track, page.data, page.size);
+        else
+            readData(track, page.data, page.size);
+    }
+}
+
+/* Get the next frame of this track, in the mix's layout, or NULL if there's
+ * nothing to mix */
+const float *trackFrame(struct Track *track, float *remapped, double *gain0, double *gain1)
+{
+    size_t n = frameLen * track->channels, have;
+    float *frame;
+    const float *out;
+    int silent;
+    size_t i;
+    uint32_t c;
+
+    fill(track, n);
+    have = track->pcmEnd - track->pcmStart;
+    if (have < n) {
+        // Out of data, so silence
+        memset(pcmBuffer(track, n - have), 0, (n - have) * sizeof(float));
+        track->pcmEnd += n - have;
+    }
+    frame = track->pcm + track->pcmStart;
+    silent = track->soundEnd <= track->consumed;
+    track->pcmStart += n;
+    track->consumed += n;
+
+    out = silent ? NULL : frame;
+    *gain0 = *gain1 = 1;
+    if (track->leveler.frames && !levelerPush(&track->leveler, out, &out, gain0, gain1))
+        return NULL;
+    if (!out)
+        return NULL;
+
+    if (track->channels == channels)
+        return out;
+
+    // Mono goes to every channel, anything else channel by channel
+    for (i = 0; i < frameLen; i++) {
+        for (c = 0; c < channels; c++) {
+            if (track->channels == 1)
+                remapped[i*channels + c] = out[i];
+            else if (c < track->channels)
+                remapped[i*channels + c] = out[i*track->channels + c];
+            else
+                remapped[i*channels + c] = 0;
+        }
+    }
+    return remapped;
+}
+
+ssize_t writeAll(int fd, const void *vbuf, size_t count)
+{
+    const unsigned char *buf = (const unsigned char *) vbuf;
+    ssize_t wr = 0, ret;
+    while (wr < count) {
+        ret = write(fd, buf + wr, count - wr);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR)
+                continue;
+            return ret;
+        }
+        wr += ret;
+    }
+    return wr;
+}
+
+void put16(unsigned char **p, uint16_t v)
+{
+    *(*p)++ = v;
+    *(*p)++ = v >> 8;
+}
+
+void put32(unsigned char **p, uint32_t v)
+{
+    put16(p, v);
+    put16(p, v >> 16);
+}
+
+// Write a WAV header for this many samples, RF64 if it's too big for RIFF
+void writeWavHeader(uint64_t samples)
+{
+    unsigned char header[80], *p = header;
+    uint64_t bytes = samples * channels * 2;
+    int rf64 = bytes >= (((uint64_t) 1)<<32) - 36;
+
+    memcpy(p, rf64 ? "RF64" : "RIFF", 4); p += 4;
+    put32(&p, rf64 ? 0xFFFFFFFF : bytes + 36);
+    memcpy(p, "WAVE", 4); p += 4;
+    if (rf64) {
+        memcpy(p, "ds64", 4); p += 4;
+        put32(&p, 28);
+        put32(&p, bytes + 64); put32(&p, (bytes + 64) >> 32);
+        put32(&p, bytes); put32(&p, bytes >> 32);
+        put32(&p, samples); put32(&p, samples >> 32);
+        put32(&p, 0);
+    }
+    memcpy(p, "fmt ", 4); p += 4;
+    put32(&p, 16);
+    put16(&p, 1); // PCM
+    put16(&p, channels);
+    put32(&p, rate);
+    put32(&p, rate * channels * 2);
+    put16(&p, channels * 2);
+    put16(&p, 16);
+    memcpy(p, "data", 4); p += 4;
+    put32(&p, rf64 ? 0xFFFFFFFF : bytes);
+
+    if (writeAll(1, header, p - header) != p - header) {
+        perror("write");
+        exit(1);
+    }
+}
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+void usage()
+{
+    fprintf(stderr, "Use: cookmix [--no-level] [--gain <dB>] [--sparse] [--stats] <duration> <track files...>\n"
+                    "Mixes the corrected tracks (Opus or FLAC Ogg, as from oggcorrect) to\n"
+                    "16-bit WAV of exactly the given duration, in seconds. The tracks, which\n"
+                    "may be FIFOs, are read in step.\n"
+                    "--no-level: Don't level the tracks or the mix, just sum them.\n"
+                    "--gain: Gain applied to the sum, so, given as negative, headroom.\n"
+                    "--sparse: Don't decode silent stretches of Opus tracks.\n"
+                    "--stats: Report throughput on stderr.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct Track *tracks;
+    struct Leveler mixLeveler = {0};
+    int level = 1, stats = 0, trackCt, ti, ai;
+    double duration, gain = 1, start = now(), gain0, gain1, elapsed;
+    uint64_t total, written = 0, frames = 0, trackFrames = 0, mixedFrames = 0;
+    uint64_t decoded = 0, skipped = 0;
+    int mixed;
+    float *mix, *remapped;
+    const float *out;
+    int16_t *s16;
+
+    for (ai = 1; ai < argc && !strncmp(argv[ai], "--", 2); ai++) {
+        if (!strcmp(argv[ai], "--no-level")) {
+            level = 0;
+        } else if (!strcmp(argv[ai], "--gain") && ai + 1 < argc) {
+            gain = pow(10, atof(argv[++ai]) / 20);
+        } else if (!strcmp(argv[ai], "--sparse")) {
+            sparse = 1;
+        } else if (!strcmp(argv[ai], "--stats")) {
+            stats = 1;
+        } else {
+            usage();
+        }
+    }
+    if (argc - ai < 2)
+        usage();
+    duration = atof(argv[ai++]);
+    if (duration < 0)
+        usage();
+
+    mixAdd = mixAddC;
+    toS16 = toS16C;
+    peak = peakC;
+#ifdef MIX_X86
+    mixAdd = mixAddSSE;
+    toS16 = toS16SSE;
+    peak = peakSSE;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        mixAdd = mixAddAVX2;
+#endif
+
+    // Open every track and read its headers, to know what we're mixing
+    trackCt = argc - ai;
+    tracks = allocOrDie(trackCt * sizeof(struct Track));
+    for (ti = 0; ti < trackCt; ti++) {
+        struct Track *track = &tracks[ti];
+        track->path = argv[ai + ti];
+        if (!oggReaderOpen(&track->reader, 1, argv + ai + ti)) {
+            perror(track->path);
+            exit(1);
+        }
+        fill(track, 1);
+        if (!track->rate) {
+            // Nothing usable, so it's silent
+            track->eof = 1;
+            continue;
+        }
+        if (track->rate > rate)
+            rate = track->rate;
+        if (track->channels > channels)
+            channels = track->channels;
+    }
+    if (!rate) {
+        rate = 48000;
+        channels = 1;
+    }
+    frameLen = rate / 2;
+    total = duration * rate;
+
+    for (ti = 0; ti < trackCt; ti++) {
+        struct Track *track = &tracks[ti];
+        if (!track->rate)
+            track->channels = channels;
+        if (track->rate && track->rate != rate) {
+            // Whatever it's decoded so far is the start of what's to resample
+            resamplerInit(track);
+            resample(track, track->pcmStart);
+            if (track->soundEnd > track->consumed)
+                track->soundEnd = track->consumed + track->pcmEnd - track->pcmStart;
+        }
+        if (level)
+            levelerInit(&track->leveler, track->channels);
+    }
+    if (level)
+        levelerInit(&mixLeveler, channels);
+    mix = allocOrDie(frameLen * channels * sizeof(float));
+    remapped = allocOrDie(frameLen * channels * sizeof(float));
+    s16 = allocOrDie(frameLen * channels * sizeof(int16_t));
+
+    writeWavHeader(total);
+
+    while (written < total) {
+        size_t samples = frameLen;
+
+        // Sum a frame of every track that isn't silent
+        mixed = 0;
+        for (ti = 0; ti < trackCt; ti++) {
+            const float *frame = trackFrame(&tracks[ti], remapped, &gain0, &gain1);
+            if (!frame)
+                continue;
+            if (!mixed++)
+                memset(mix, 0, frameLen * channels * sizeof(float));
+            mixAdd(mix, frame, frameLen * channels, gain0,
+                (gain1 - gain0) / (frameLen * channels));
+        }
+        trackFrames += trackCt;
+        mixedFrames += mixed;
+
+        // Nothing to level until the tracks' levelers have caught up
+        if (level && frames++ < LEVEL_DELAY)
+            continue;
+
+        // Level the sum, and out it goes
+        out = mixed ? mix : NULL;
+        gain0 = gain1 = 1;
+        if (level && !levelerPush(&mixLeveler, out, &out, &gain0, &gain1))
+            continue;
+        if (out)
+            toS16(s16, out, frameLen * channels, gain0 * gain,
+                (gain1 - gain0) * gain / (frameLen * channels));
+        else
+            memset(s16, 0, frameLen * channels * sizeof(int16_t));
+        if (samples > total - written)
+            samples = total - written;
+        if (writeAll(1, s16, samples * channels * sizeof(int16_t)) !=
+            samples * channels * sizeof(int16_t)) {
+            perror("write");
+            exit(1);
+        }
+        written += samples;
+    }
+
+    if (stats) {
+        elapsed = now() - start;
+        for (ti = 0; ti < trackCt; ti++) {
+            decoded += tracks[ti].decoded;
+            skipped += tracks[ti].skipped;
+        }
+        fprintf(stderr, "cookmix: %d tracks, %.1f s mixed in %.2f s: %.1fx realtime, "
+                        "%.1f track-seconds per second\n"
+                        "cookmix: %llu packets decoded, %llu skipped; "
+                        "%llu of %llu track frames mixed\n",
+            trackCt, duration, elapsed, duration / elapsed,
+            duration * trackCt / elapsed,
+            (unsigned long long) decoded, (unsigned long long) skipped,
+            (unsigned long long) mixedFrames, (unsigned long long) trackFrames);
+    }
+
+    return 0;
+}
@@ -0,0 +1,1142 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* cookplan reads a recording's users and info files once, and gives
+ * everything the cook scripts used to get from userinfo.js and recinfo.js, a
+ * Node start per track at a time. Its output is meant to be exactly theirs,
+ * so it reads JSON the way JavaScript does: strings are UTF-16, objects keep
+ * their keys in JavaScript's order, and values are converted to strings, and
+ * tested for truth, by JavaScript's rules. */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "oggpage.h"
+
+enum JsonType {
+    JSON_UNDEFINED,
+    JSON_NULL,
+    JSON_FALSE,
+    JSON_TRUE,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+};
+
+// A string, as UTF-16 code units
+struct JsString {
+    uint16_t *units;
+    size_t len, size;
+};
+
+struct JsonMember;
+
+struct JsonValue {
+    enum JsonType type;
+    double number;
+    struct JsString string;
+
+    // Array elements have no keys
+    struct JsonMember *members;
+    size_t count, size;
+};
+
+struct JsonMember {
+    struct JsString key;
+    struct JsonValue *value;
+};
+
+struct JsonParser {
+    const uint16_t *in;
+    size_t len, pos;
+};
+
+static struct JsonValue undefinedValue = {.type = JSON_UNDEFINED};
+
+static void *xrealloc(void *ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (!ptr) {
+        perror("realloc");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void strUnit(struct JsString *str, uint16_t unit)
+{
+    if (str->len >= str->size) {
+        str->size = str->size ? str->size * 2 : 16;
+        str->units = xrealloc(str->units, str->size * sizeof(uint16_t));
+    }
+    str->units[str->len++] = unit;
+}
+
+static void strAscii(struct JsString *str, const char *ascii)
+{
+    for (; *ascii; ascii++)
+        strUnit(str, (unsigned char) *ascii);
+}
+
+static void strAppend(struct JsString *str, const struct JsString *other)
+{
+    size_t i;
+    for (i = 0; i < other->len; i++)
+        strUnit(str, other->units[i]);
+}
+
+static int startsWithAscii(const struct JsString *str, const char *ascii)
+{
+    size_t i;
+    for (i = 0; ascii[i]; i++)
+        if (i >= str->len || str->units[i] != (unsigned char) ascii[i])
+            return 0;
+    return 1;
+}
+
+static int strEqualsAscii(const struct JsString *str, const char *ascii)
+{
+    size_t i;
+    for (i = 0; i < str->len && ascii[i]; i++)
+        if (str->units[i] != (unsigned char) ascii[i])
+            return 0;
+    return i == str->len && !ascii[i];
+}
+
+/* Decode UTF-8 into UTF-16 as Node does when reading a file as utf8, with
+ * U+FFFD for anything invalid */
+static void strUtf8(struct JsString *str, const unsigned char *in, size_t len)
+{
+    size_t i = 0;
+    while (i < len) {
+        uint32_t c = in[i];
+        int extra, j;
+        if (c < 0x80) {
+            strUnit(str, c);
+            i++;
+            continue;
+        } else if (c >= 0xC2 && c < 0xE0) {
+            extra = 1;
+            c &= 0x1F;
+        } else if (c >= 0xE0 && c < 0xF0) {
+            extra = 2;
+            c &= 0x0F;
+        } else if (c >= 0xF0 && c < 0xF5) {
+            extra = 3;
+            c &= 0x07;
+        } else {
+            strUnit(str, 0xFFFD);
+            i++;
+            continue;
+        }
+        /* A bad sequence becomes one U+FFFD for as much of it as could have
+         * started a good one */
+        for (j = 1; j <= extra; j++) {
+            unsigned char lo = 0x80, hi = 0xBF;
+            if (j == 1) {
+                if (in[i] == 0xE0) lo = 0xA0;
+                else if (in[i] == 0xED) hi = 0x9F;
+                else if (in[i] == 0xF0) lo = 0x90;
+                else if (in[i] == 0xF4) hi = 0x8F;
+            }
+            if (i + j >= len || in[i+j] < lo || in[i+j] > hi)
+                break;
+            c = (c << 6) | (in[i+j] & 0x3F);
+        }
+        if (j <= extra) {
+            strUnit(str, 0xFFFD);
+            i += j;
+            continue;
+        }
+        i += j;
+        if (c >= 0x10000) {
+            c -= 0x10000;
+            strUnit(str, 0xD800 | (c >> 10));
+            strUnit(str, 0xDC00 | (c & 0x3FF));
+        } else {
+            strUnit(str, c);
+        }
+    }
+}
+
+// Write a string as UTF-8, with U+FFFD for lone surrogates, as Node does
+static void writeUtf8(FILE *out, const struct JsString *str)
+{
+    size_t i;
+    for (i = 0; i < str->len; i++) {
+        uint32_t c = str->units[i];
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < str->len &&
+            str->units[i+1] >= 0xDC00 && str->units[i+1] < 0xE000) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (str->units[i+1] - 0xDC00);
+            i++;
+        } else if (c >= 0xD800 && c < 0xE000) {
+            c = 0xFFFD;
+        }
+
+        if (c < 0x80) {
+            putc(c, out);
+        } else if (c < 0x800) {
+            putc(0xC0 | (c >> 6), out);
+            putc(0x80 | (c & 0x3F), out);
+        } else if (c < 0x10000) {
+            putc(0xE0 | (c >> 12), out);
+            putc(0x80 | ((c >> 6) & 0x3F), out);
+            putc(0x80 | (c & 0x3F), out);
+        } else {
+            putc(0xF0 | (c >> 18), out);
+            putc(0x80 | ((c >> 12) & 0x3F), out);
+            putc(0x80 | ((c >> 6) & 0x3F), out);
+            putc(0x80 | (c & 0x3F), out);
+        }
+    }
+}
+
+// Number to string, as JavaScript's Number.prototype.toString
+static void numberString(char *buf, double num)
+{
+    char digits[32], *exp;
+    int precision, point, ndigits, i;
+
+    if (isnan(num)) {
+        strcpy(buf, "NaN");
+        return;
+    } else if (isinf(num)) {
+        strcpy(buf, (num < 0) ? "-Infinity" : "Infinity");
+        return;
+    } else if (num == 0) {
+        strcpy(buf, "0");
+        return;
+    }
+    if (num < 0) {
+        *buf++ = '-';
+        num = -num;
+    }
+
+    // Find the shortest representation that reads back the same
+    for (precision = 1; precision < 17; precision++) {
+        snprintf(digits, sizeof(digits), "%.*e", precision - 1, num);
+        if (strtod(digits, NULL) == num)
+            break;
+    }
+    snprintf(digits, sizeof(digits), "%.*e", precision - 1, num);
+    exp = strchr(digits, 'e');
+    point = atoi(exp + 1) + 1;
+    *exp = 0;
+    if (digits[1] == '.')
+        memmove(digits + 1, digits + 2, strlen(digits + 2) + 1);
+    ndigits = strlen(digits);
+    while (ndigits > 1 && digits[ndigits-1] == '0')
+        digits[--ndigits] = 0;
+
+    if (ndigits <= point && point <= 21) {
+        // An integer
+        strcpy(buf, digits);
+        for (i = ndigits; i < point; i++)
+            strcat(buf, "0");
+    } else if (0 < point && point <= 21) {
+        sprintf(buf, "%.*s.%s", point, digits, digits + point);
+    } else if (-6 < point && point <= 0) {
+        strcpy(buf, "0.");
+        for (i = point; i < 0; i++)
+            strcat(buf, "0");
+        strcat(buf, digits);
+    } else if (ndigits == 1) {
+        sprintf(buf, "%se%c%d", digits, (point > 0) ? '+' : '-', abs(point - 1));
+    } else {
+        sprintf(buf, "%c.%se%c%d", digits[0], digits + 1, (point > 0) ? '+' : '-', abs(point - 1));
+    }
+}
+
+// Append this value converted to a string, as JavaScript's String()
+static void strValue(struct JsString *str, const struct JsonValue *value)
+{
+    char buf[64];
+    size_t i;
+
+    switch (value->type) {
+        case JSON_UNDEFINED: strAscii(str, "undefined"); break;
+        case JSON_NULL: strAscii(str, "null"); break;
+        case JSON_FALSE: strAscii(str, "false"); break;
+        case JSON_TRUE: strAscii(str, "true"); break;
+        case JSON_NUMBER:
+            numberString(buf, value->number);
+            strAscii(str, buf);
+            break;
+        case JSON_STRING: strAppend(str, &value->string); break;
+        case JSON_OBJECT: strAscii(str, "[object Object]"); break;
+        case JSON_ARRAY:
+            for (i = 0; i < value->count; i++) {
+                const struct JsonValue *el = value->members[i].value;
+                if (i)
+                    strUnit(str, ',');
+                if (el->type != JSON_NULL && el->type != JSON_UNDEFINED)
+                    strValue(str, el);
+            }
+            break;
+    }
+}
+
+// JavaScript's truthiness
+static int truthy(const struct JsonValue *value)
+{
+    switch (value->type) {
+        case JSON_UNDEFINED:
+        case JSON_NULL:
+        case JSON_FALSE:
+            return 0;
+        case JSON_NUMBER:
+            return value->number != 0 && !isnan(value->number);
+        case JSON_STRING:
+            return value->string.len != 0;
+        default:
+            return 1;
+    }
+}
+
+// a || b
+static const struct JsonValue *or(const struct JsonValue *a, const struct JsonValue *b)
+{
+    return truthy(a) ? a : b;
+}
+
+// Parse an array index key, or return -1 if it isn't one
+static int64_t arrayIndex(const struct JsString *key)
+{
+    int64_t index = 0;
+    size_t i;
+    if (!key->len || key->len > 10 || (key->len > 1 && key->units[0] == '0'))
+        return -1;
+    for (i = 0; i < key->len; i++) {
+        if (key->units[i] < '0' || key->units[i] > '9')
+            return -1;
+        index = index * 10 + key->units[i] - '0';
+    }
+    return (index < 0xFFFFFFFFLL) ? index : -1;
+}
+
+// Get a property, or undefined
+static const struct JsonValue *getKey(const struct JsonValue *value, const char *key)
+{
+    size_t i;
+    if (value->type == JSON_OBJECT) {
+        for (i = 0; i < value->count; i++)
+            if (strEqualsAscii(&value->members[i].key, key))
+                return value->members[i].value;
+    } else if (value->type == JSON_ARRAY) {
+        struct JsString skey = {0};
+        int64_t index;
+        strAscii(&skey, key);
+        index = arrayIndex(&skey);
+        free(skey.units);
+        if (index >= 0 && (size_t) index < value->count)
+            return value->members[index].value;
+    }
+    return &undefinedValue;
+}
+
+static void deleteKey(struct JsonValue *value, const char *key)
+{
+    size_t i;
+    if (value->type != JSON_OBJECT)
+        return;
+    for (i = 0; i < value->count; i++) {
+        if (strEqualsAscii(&value->members[i].key, key)) {
+            memmove(value->members + i, value->members + i + 1,
+                    (value->count - i - 1) * sizeof(struct JsonMember));
+            value->count--;
+            return;
+        }
+    }
+}
+
+static void addMember(struct JsonValue *value, struct JsString key, struct JsonValue *member)
+{
+    size_t i;
+
+    // A repeated key keeps its place, but takes the new value
+    if (value->type == JSON_OBJECT) {
+        for (i = 0; i < value->count; i++) {
+            struct JsString *other = &value->members[i].key;
+            if (other->len == key.len &&
+                !memcmp(other->units, key.units, key.len * sizeof(uint16_t))) {
+                value->members[i].value = member;
+                free(key.units);
+                return;
+            }
+        }
+    }
+
+    if (value->count >= value->size) {
+        value->size = value->size ? value->size * 2 : 8;
+        value->members = xrealloc(value->members, value->size * sizeof(struct JsonMember));
+    }
+    value->members[value->count].key = key;
+    value->members[value->count].value = member;
+    value->count++;
+}
+
+static void setKey(struct JsonValue *value, const char *key, struct JsonValue *member)
+{
+    struct JsString skey = {0};
+    if (value->type != JSON_OBJECT)
+        return;
+    strAscii(&skey, key);
+    addMember(value, skey, member);
+}
+
+static int compareIndexKeys(const void *lv, const void *rv)
+{
+    int64_t l = arrayIndex(&((const struct JsonMember *) lv)->key);
+    int64_t r = arrayIndex(&((const struct JsonMember *) rv)->key);
+    return (l > r) - (l < r);
+}
+
+/* JavaScript objects put array index keys first, in numeric order, and then
+ * the rest in the order they were added */
+static void orderKeys(struct JsonValue *value)
+{
+    struct JsonMember *ordered;
+    size_t i, indices = 0, rest;
+
+    for (i = 0; i < value->count; i++)
+        if (arrayIndex(&value->members[i].key) >= 0)
+            indices++;
+    if (!indices)
+        return;
+
+    ordered = xrealloc(NULL, value->count * sizeof(struct JsonMember));
+    rest = indices;
+    indices = 0;
+    for (i = 0; i < value->count; i++) {
+        if (arrayIndex(&value->members[i].key) >= 0)
+            ordered[indices++] = value->members[i];
+        else
+            ordered[rest++] = value->members[i];
+    }
+    qsort(ordered, indices, sizeof(struct JsonMember), compareIndexKeys);
+    free(value->members);
+    value->members = ordered;
+    value->size = value->count;
+}
+
+static void skipSpace(struct JsonParser *parser)
+{
+    while (parser->pos < parser->len) {
+        uint16_t c = parser->in[parser->pos];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+            break;
+        parser->pos++;
+    }
+}
+
+static int parseHex(struct JsonParser *parser, uint16_t *unit)
+{
+    int i;
+    *unit = 0;
+    if (parser->pos + 4 > parser->len)
+        return 0;
+    for (i = 0; i < 4; i++) {
+        uint16_t c = parser->in[parser->pos++];
+        *unit <<= 4;
+        if (c >= '0' && c <= '9')
+            *unit |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            *unit |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            *unit |= c - 'A' + 10;
+        else
+            return 0;
+    }
+    return 1;
+}
+
+static int parseString(struct JsonParser *parser, struct JsString *str)
+{
+    memset(str, 0, sizeof(*str));
+    parser->pos++; // The "
+    while (parser->pos < parser->len) {
+        uint16_t c = parser->in[parser->pos++], unit;
+        if (c == '"') {
+            return 1;
+        } else if (c < 0x20) {
+            break;
+        } else if (c != '\\') {
+            strUnit(str, c);
+            continue;
+        }
+
+        if (parser->pos >= parser->len)
+            break;
+        switch (parser->in[parser->pos++]) {
+            case '"': strUnit(str, '"'); break;
+            case '\\': strUnit(str, '\\'); break;
+            case '/': strUnit(str, '/'); break;
+            case 'b': strUnit(str, '\b'); break;
+            case 'f': strUnit(str, '\f'); break;
+            case 'n': strUnit(str, '\n'); break;
+            case 'r': strUnit(str, '\r'); break;
+            case 't': strUnit(str, '\t'); break;
+            case 'u':
+                if (!parseHex(parser, &unit))
+                    goto fail;
+                strUnit(str, unit);
+                break;
+            default:
+                goto fail;
+        }
+    }
+
+fail:
+    free(str->units);
+    return 0;
+}
+
+static int parseNumber(struct JsonParser *parser, double *number)
+{
+    char buf[512];
+    size_t start = parser->pos, len;
+    const uint16_t *in = parser->in;
+
+#define DIGIT(i) ((i) < parser->len && in[i] >= '0' && in[i] <= '9')
+    if (parser->pos < parser->len && in[parser->pos] == '-')
+        parser->pos++;
+    if (!DIGIT(parser->pos))
+        return 0;
+    if (in[parser->pos] == '0')
+        parser->pos++;
+    else
+        while (DIGIT(parser->pos))
+            parser->pos++;
+    if (parser->pos < parser->len && in[parser->pos] == '.') {
+        parser->pos++;
+        if (!DIGIT(parser->pos))
+            return 0;
+        while (DIGIT(parser->pos))
+            parser->pos++;
+    }
+    if (parser->pos < parser->len && (in[parser->pos] == 'e' || in[parser->pos] == 'E')) {
+        parser->pos++;
+        if (parser->pos < parser->len && (in[parser->pos] == '+' || in[parser->pos] == '-'))
+            parser->pos++;
+        if (!DIGIT(parser->pos))
+            return 0;
+        while (DIGIT(parser->pos))
+            parser->pos++;
+    }
+#undef DIGIT
+
+    len = parser->pos - start;
+    if (len >= sizeof(buf))
+        len = sizeof(buf) - 1;
+    for (size_t i = 0; i < len; i++)
+        buf[i] = in[start + i];
+    buf[len] = 0;
+    *number = strtod(buf, NULL);
+    return 1;
+}
+
+static int parseLiteral(struct JsonParser *parser, const char *literal)
+{
+    size_t len = strlen(literal), i;
+    if (parser->pos + len > parser->len)
+        return 0;
+    for (i = 0; i < len; i++)
+        if (parser->in[parser->pos + i] != (unsigned char) literal[i])
+            return 0;
+    parser->pos += len;
+    return 1;
+}
+
+static struct JsonValue *parseValue(struct JsonParser *parser)
+{
+    struct JsonValue *value = xrealloc(NULL, sizeof(struct JsonValue));
+    memset(value, 0, sizeof(*value));
+
+    skipSpace(parser);
+    if (parser->pos >= parser->len)
+        return NULL;
+
+    switch (parser->in[parser->pos]) {
+        case 'n':
+            value->type = JSON_NULL;
+            return parseLiteral(parser, "null") ? value : NULL;
+        case 't':
+            value->type = JSON_TRUE;
+            return parseLiteral(parser, "true") ? value : NULL;
+        case 'f':
+            value->type = JSON_FALSE;
+            return parseLiteral(parser, "false") ? value : NULL;
+        case '"':
+            value->type = JSON_STRING;
+            return parseString(parser, &value->string) ? value : NULL;
+
+        case '[':
+            value->type = JSON_ARRAY;
+            parser->pos++;
+            skipSpace(parser);
+            if (parser->pos < parser->len && parser->in[parser->pos] == ']') {
+                parser->pos++;
+                return value;
+            }
+            while (1) {
+                struct JsString noKey = {0};
+                struct JsonValue *el = parseValue(parser);
+                if (!el)
+                    return NULL;
+                addMember(value, noKey, el);
+                skipSpace(parser);
+                if (parser->pos >= parser->len)
+                    return NULL;
+                if (parser->in[parser->pos] == ']') {
+                    parser->pos++;
+                    return value;
+                } else if (parser->in[parser->pos] != ',') {
+                    return NULL;
+                }
+                parser->pos++;
+            }
+
+        case '{':
+            value->type = JSON_OBJECT;
+            parser->pos++;
+            skipSpace(parser);
+            if (parser->pos < parser->len && parser->in[parser->pos] == '}') {
+                parser->pos++;
+                return value;
+            }
+            while (1) {
+                struct JsString key;
+                struct JsonValue *member;
+                skipSpace(parser);
+                if (parser->pos >= parser->len || parser->in[parser->pos] != '"' ||
+                    !parseString(parser, &key))
+                    return NULL;
+                skipSpace(parser);
+                if (parser->pos >= parser->len || parser->in[parser->pos] != ':')
+                    return NULL;
+                parser->pos++;
+                if (!(member = parseValue(parser)))
+                    return NULL;
+                addMember(value, key, member);
+                skipSpace(parser);
+                if (parser->pos >= parser->len)
+                    return NULL;
+                if (parser->in[parser->pos] == '}') {
+                    parser->pos++;
+                    orderKeys(value);
+                    return value;
+                } else if (parser->in[parser->pos] != ',') {
+                    return NULL;
+                }
+                parser->pos++;
+            }
+
+        default:
+            value->type = JSON_NUMBER;
+            return parseNumber(parser, &value->number) ? value : NULL;
+    }
+}
+
+/* Parse this text as JSON, wrapped in these brackets (if any), as JSON.parse.
+ * Returns NULL if it isn't valid. Nothing's ever freed; we don't live long
+ * enough to care. */
+static struct JsonValue *parseJson(const struct JsString *text, const char *open, const char *close)
+{
+    struct JsString all = {0};
+    struct JsonParser parser;
+    struct JsonValue *value;
+
+    strAscii(&all, open);
+    strAppend(&all, text);
+    strAscii(&all, close);
+    parser.in = all.units;
+    parser.len = all.len;
+    parser.pos = 0;
+
+    value = parseValue(&parser);
+    skipSpace(&parser);
+    if (value && parser.pos != parser.len)
+        value = NULL;
+    return value;
+}
+
+// Write a string as JSON, as JSON.stringify
+static void writeJsonString(FILE *out, const struct JsString *str)
+{
+    struct JsString run = {0};
+    size_t i;
+
+    putc('"', out);
+    for (i = 0; i < str->len; i++) {
+        uint16_t c = str->units[i];
+        const char *escape = NULL;
+        char buf[8];
+
+        if (c == '"') escape = "\\\"";
+        else if (c == '\\') escape = "\\\\";
+        else if (c == '\b') escape = "\\b";
+        else if (c == '\f') escape = "\\f";
+        else if (c == '\n') escape = "\\n";
+        else if (c == '\r') escape = "\\r";
+        else if (c == '\t') escape = "\\t";
+        else if (c < 0x20) {
+            sprintf(buf, "\\u%04x", c);
+            escape = buf;
+        } else if (c >= 0xD800 && c < 0xDC00 && i + 1 < str->len &&
+                   str->units[i+1] >= 0xDC00 && str->units[i+1] < 0xE000) {
+            // A proper pair
+            strUnit(&run, c);
+            strUnit(&run, str->units[++i]);
+            continue;
+        } else if (c >= 0xD800 && c < 0xE000) {
+            // Lone surrogates are escaped
+            sprintf(buf, "\\u%04x", c);
+            escape = buf;
+        }
+
+        if (escape) {
+            writeUtf8(out, &run);
+            run.len = 0;
+            fputs(escape, out);
+        } else {
+            strUnit(&run, c);
+        }
+    }
+    writeUtf8(out, &run);
+    free(run.units);
+    putc('"', out);
+}
+
+// Write a value as JSON, as JSON.stringify
+static void writeJson(FILE *out, const struct JsonValue *value)
+{
+    char buf[64];
+    size_t i;
+
+    switch (value->type) {
+        case JSON_UNDEFINED:
+        case JSON_NULL:
+            fputs("null", out);
+            break;
+        case JSON_FALSE: fputs("false", out); break;
+        case JSON_TRUE: fputs("true", out); break;
+        case JSON_NUMBER:
+            if (isfinite(value->number)) {
+                numberString(buf, value->number);
+                fputs(buf, out);
+            } else {
+                fputs("null", out);
+            }
+            break;
+        case JSON_STRING: writeJsonString(out, &value->string); break;
+        case JSON_ARRAY:
+            putc('[', out);
+            for (i = 0; i < value->count; i++) {
+                if (i)
+                    putc(',', out);
+                writeJson(out, value->members[i].value);
+            }
+            putc(']', out);
+            break;
+        case JSON_OBJECT:
+            putc('{', out);
+            for (i = 0; i < value->count; i++) {
+                if (i)
+                    putc(',', out);
+                writeJsonString(out, &value->members[i].key);
+                putc(':', out);
+                writeJson(out, value->members[i].value);
+            }
+            putc('}', out);
+            break;
+    }
+}
+
+// Read $ID.ogg.<ext>, or give this default text if we can't
+static struct JsString readFile(const char *id, const char *ext, const char *def)
+{
+    struct JsString text = {0};
+    char *path;
+    FILE *f;
+    unsigned char *buf = NULL;
+    size_t len = 0, size = 0, rd;
+
+    path = xrealloc(NULL, strlen(id) + strlen(ext) + 6);
+    sprintf(path, "%s.ogg.%s", id, ext);
+    f = fopen(path, "rb");
+    free(path);
+    if (!f) {
+        strAscii(&text, def);
+        return text;
+    }
+    while (1) {
+        if (len >= size) {
+            size = size ? size * 2 : 4096;
+            buf = xrealloc(buf, size);
+        }
+        rd = fread(buf + len, 1, size - len, f);
+        if (rd == 0)
+            break;
+        len += rd;
+    }
+    fclose(f);
+
+    strUtf8(&text, buf, len);
+    free(buf);
+    return text;
+}
+
+// Read the users, in either the current format (an object) or the old (an array)
+static struct JsonValue *readUsers(const char *id, int allowOld)
+{
+    struct JsString text = readFile(id, "users", "");
+    struct JsonValue *users = parseJson(&text, "{", "}");
+    if (!users && allowOld)
+        users = parseJson(&text, "[", "]");
+    if (!users) {
+        users = xrealloc(NULL, sizeof(struct JsonValue));
+        memset(users, 0, sizeof(*users));
+        users->type = JSON_OBJECT;
+    }
+    free(text.units);
+    return users;
+}
+
+/* Get a track's name, or some property of the user, as userinfo.js would.
+ * Returns NULL where userinfo.js would fail outright. */
+static const struct JsonValue *userValue(const struct JsonValue *users, int track,
+                                         const char *param, struct JsString *name)
+{
+    static struct JsonValue empty = {.type = JSON_STRING}, named = {.type = JSON_STRING};
+    const struct JsonValue *user, *discrim, *username;
+    char key[16];
+    size_t i;
+
+    snprintf(key, sizeof(key), "%d", track);
+    user = getKey(users, key);
+    if (!truthy(user))
+        return &empty;
+
+    if (param) {
+        const struct JsonValue *val = getKey(user, param);
+        return truthy(val) ? val : &empty;
+    }
+
+    if (user->type != JSON_OBJECT && user->type != JSON_ARRAY) {
+        // Old style, just the name
+        return user;
+    }
+
+    // Discord's new usernames have a discriminator of 0, and don't show it
+    discrim = or(getKey(user, "discrim"), getKey(user, "discriminator"));
+    username = or(getKey(user, "name"), getKey(user, "username"));
+    name->len = 0;
+    if (discrim->type == JSON_NUMBER && discrim->number == 0) {
+        if (username->type != JSON_STRING)
+            return NULL;
+        strAppend(name, &username->string);
+    } else {
+        strValue(name, username);
+        strUnit(name, '#');
+        strValue(name, discrim);
+    }
+
+    // Anything that isn't alphanumeric (per UTF-16 unit) becomes _
+    for (i = 0; i < name->len; i++) {
+        uint16_t c = name->units[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+            name->units[i] = '_';
+    }
+    named.string = *name;
+    return &named;
+}
+
+// Decode base64 as Node's Buffer.from does, skipping anything that isn't base64
+static void writeBase64(FILE *out, const struct JsString *str, size_t start)
+{
+    uint32_t bits = 0;
+    int nbits = 0;
+    size_t i;
+
+    for (i = start; i < str->len; i++) {
+        uint16_t c = str->units[i];
+        int v;
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '+' || c == '-') v = 62;
+        else if (c == '/' || c == '_') v = 63;
+        else if (c == '=' || c == ',') break;
+        else continue;
+        bits = (bits << 6) | v;
+        nbits += 6;
+        if (nbits >= 8) {
+            nbits -= 8;
+            putc((bits >> nbits) & 0xFF, out);
+        }
+    }
+}
+
+// userinfo.js <ID> <track> [<param> [datauri]]
+static int user(const char *id, const char *trackStr, const char *param, int datauri)
+{
+    struct JsonValue *users = readUsers(id, 1);
+    struct JsString name = {0};
+    const struct JsonValue *val = userValue(users, atoi(trackStr), param, &name);
+
+    if (!val || val->type != JSON_STRING)
+        return 1;
+
+    if (datauri && startsWithAscii(&val->string, "data:")) {
+        size_t i;
+        for (i = 0; i < val->string.len && val->string.units[i] != ','; i++);
+        if (i == val->string.len)
+            return 1;
+        writeBase64(stdout, &val->string, i + 1);
+        return 0;
+    }
+
+    writeUtf8(stdout, &val->string);
+    return val->string.len ? 0 : 1;
+}
+
+// recinfo.js's username format
+static int infoUsername(struct JsString *out, const struct JsonValue *d, const struct JsonValue *id)
+{
+    const struct JsonValue *discrim, *globalName;
+    struct JsString username = {0};
+
+    if (d->type == JSON_UNDEFINED || d->type == JSON_NULL)
+        return 0;
+    discrim = getKey(d, "discriminator");
+    strValue(&username, getKey(d, "username"));
+    if (!(discrim->type == JSON_NUMBER && discrim->number == 0)) {
+        strUnit(&username, '#');
+        strValue(&username, discrim);
+    }
+
+    globalName = getKey(d, "globalName");
+    if (truthy(globalName)) {
+        strValue(out, globalName);
+        strAscii(out, " (");
+        strAppend(out, &username);
+        strUnit(out, ')');
+    } else {
+        strAppend(out, &username);
+    }
+    strAscii(out, " (");
+    strValue(out, or(getKey(d, "id"), id));
+    strUnit(out, ')');
+    free(username.units);
+    return 1;
+}
+
+// The name and ID of a guild or channel
+static void infoPlace(struct JsString *out, const struct JsonValue *info, const char *key)
+{
+    char extraKey[32];
+    const struct JsonValue *extra;
+
+    snprintf(extraKey, sizeof(extraKey), "%sExtra", key);
+    extra = getKey(info, extraKey);
+    if (truthy(extra)) {
+        strValue(out, getKey(extra, "name"));
+        strAscii(out, " (");
+        strValue(out, getKey(extra, "id"));
+        strUnit(out, ')');
+    } else {
+        strValue(out, getKey(info, key));
+    }
+}
+
+// recinfo.js <ID> [text]
+static int info(const char *id, int text)
+{
+    struct JsString infoText = readFile(id, "info", "{}");
+    struct JsonValue *info = parseJson(&infoText, "", "");
+    struct JsonValue *users = readUsers(id, 0);
+    struct JsString out = {0};
+    size_t i;
+    int ui;
+
+    if (!info || info->type == JSON_NULL) {
+        fprintf(stderr, "Invalid info\n");
+        return 1;
+    }
+
+    deleteKey(users, "0");
+    for (i = 0; i < users->count; i++) {
+        struct JsonValue *u = users->members[i].value;
+        if (u->type == JSON_NULL) {
+            fprintf(stderr, "Invalid users\n");
+            return 1;
+        }
+        deleteKey(u, "avatar");
+    }
+    setKey(info, "tracks", users);
+    deleteKey(info, "key");
+    deleteKey(info, "delete");
+    deleteKey(info, "features");
+
+    if (!text) {
+        writeJson(stdout, info);
+        putchar('\n');
+        return 0;
+    }
+
+    strAscii(&out, "Recording ");
+    strUtf8(&out, (const unsigned char *) id, strlen(id));
+    strAscii(&out, "\r\n\r\nGuild:\t\t");
+    infoPlace(&out, info, "guild");
+    strAscii(&out, "\r\nChannel:\t");
+    infoPlace(&out, info, "channel");
+    strAscii(&out, "\r\nRequester:\t");
+    if (!infoUsername(&out, getKey(info, "requesterExtra"), getKey(info, "requesterId"))) {
+        fprintf(stderr, "No requester\n");
+        return 1;
+    }
+    strAscii(&out, "\r\nStart time:\t");
+    strValue(&out, getKey(info, "startTime"));
+    strAscii(&out, "\r\n\r\nTracks:\r\n");
+    writeUtf8(stdout, &out);
+
+    for (ui = 1; ; ui++) {
+        char key[16];
+        const struct JsonValue *u;
+        snprintf(key, sizeof(key), "%d", ui);
+        u = getKey(users, key);
+        if (!truthy(u))
+            break;
+        out.len = 0;
+        strUnit(&out, '\t');
+        infoUsername(&out, u, &undefinedValue);
+        strAscii(&out, "\r\n");
+        writeUtf8(stdout, &out);
+    }
+    return 0;
+}
+
+// The whole plan: a line per track of its number, stream, codec, avatar and name
+static int plan(const char *id)
+{
+    struct JsonValue *users = readUsers(id, 1);
+    struct JsString name = {0};
+    struct OggReader reader;
+    struct OggPage page;
+    uint32_t *streams = NULL;
+    const char **codecs = NULL;
+    int streamCt = 0, width, si;
+    char *path;
+
+    // Find the tracks, as oggtracks does
+    path = xrealloc(NULL, strlen(id) + 13);
+    sprintf(path, "%s.ogg.header1", id);
+    if (!oggReaderOpen(&reader, 1, &path)) {
+        perror(path);
+        return 1;
+    }
+    while (oggReadPage(&reader, &page)) {
+        const unsigned char *buf = page.data;
+        const char *codec;
+        uint32_t skip = 0;
+
+        // Is it VAD data?
+        if (page.size > 8 && !memcmp(buf, "ECVADD", 6))
+            skip = 8 + *((const unsigned short *) (buf+6));
+        if (page.size < skip + 5)
+            continue;
+
+        // Is it a header?
+        if (!memcmp(buf + skip, "Opus", 4))
+            codec = "opus";
+        else if (!memcmp(buf + skip, "\x7f""FLAC", 5))
+            codec = "flac";
+        else
+            continue;
+
+        for (si = 0; si < streamCt && streams[si] != page.header->streamNo; si++);
+        if (si < streamCt)
+            continue;
+        streams = xrealloc(streams, (streamCt + 1) * sizeof(uint32_t));
+        codecs = xrealloc(codecs, (streamCt + 1) * sizeof(const char *));
+        streams[streamCt] = page.header->streamNo;
+        codecs[streamCt] = codec;
+        streamCt++;
+    }
+    oggReaderFree(&reader);
+    free(path);
+
+    // Track numbers are as wide as the biggest, as seq -w
+    for (width = 1, si = streamCt; si >= 10; si /= 10, width++);
+
+    for (si = 0; si < streamCt; si++) {
+        const struct JsonValue *val = userValue(users, si + 1, NULL, &name);
+        int avatar = truthy(userValue(users, si + 1, "avatar", NULL));
+        printf("%0*d\t%u\t%s\t%d\t", width, si + 1, streams[si], codecs[si], avatar);
+        if (val && val->type == JSON_STRING) {
+            // Old-style names aren't sanitized, but mustn't break the table
+            struct JsString clean = val->string;
+            size_t i;
+            for (i = 0; i < clean.len; i++) {
+                uint16_t c = clean.units[i];
+                if (c == '\t' || c == '\n' || c == '\r') {
+                    if (clean.units == val->string.units) {
+                        clean.units = xrealloc(NULL, clean.len * sizeof(uint16_t));
+                        memcpy(clean.units, val->string.units, clean.len * sizeof(uint16_t));
+                    }
+                    clean.units[i] = '_';
+                }
+            }
+            writeUtf8(stdout, &clean);
+        }
+        putchar('\n');
+    }
+    return 0;
+}
+
+void usage()
+{
+    fprintf(stderr, "Use: cookplan <command> <ID>\n"
+                    "Commands:\n"
+                    "  plan <ID>: Print a line per track, of its track number, stream\n"
+                    "      number, codec, whether it has an avatar (1 or 0), and the name to\n"
+                    "      use in its file name (if any), separated by tabs.\n"
+                    "  user <ID> <track> [<property> [datauri]]: Print the track's name, or\n"
+                    "      the given property of its user, as userinfo.js.\n"
+                    "  info <ID> [text]: Print the recording's info, as recinfo.js.\n"
+                    "The recording's files are read from the current directory.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && !strcmp(argv[1], "plan")) {
+        return plan(argv[2]);
+    } else if (argc >= 4 && argc <= 6 && !strcmp(argv[1], "user")) {
+        return user(argv[2], argv[3], (argc > 4) ? argv[4] : NULL,
+                    argc > 5 && !strcmp(argv[5], "datauri"));
+    } else if ((argc == 3 || argc == 4) && !strcmp(argv[1], "info")) {
+        return info(argv[2], argc == 4 && !strcmp(argv[3], "text"));
+    }
+    usage();
+    return 1;
+}
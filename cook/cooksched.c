@@ -0,0 +1,452 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* cooksched hands out a fixed number of slots (by default, one per core) to
+ * per-track cook jobs, across every cook running at once, so that a big
+ * recording doesn't start all of its tracks at once and thrash. There's no
+ * daemon: the state is in a small shared file (in /dev/shm), under a robust
+ * process-shared mutex, and each job holds its slot as long as its process
+ * lives, so a job that's killed gives its slot back. When a slot is free, it
+ * goes to the waiting job whose recording has the fewest slots already, so
+ * recordings share fairly, and then to the one expected to cost the most, so
+ * the longest tracks start first. */
+
+#define _GNU_SOURCE // For sched_getaffinity
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SCHED_MAGIC 0x4353636b // "kcSC"
+#define SCHED_VERSION 1
+
+#define MAX_SLOTS 256
+#define MAX_WAITERS 4096
+#define ID_LEN 32
+
+// How often (in ms) waiters check for jobs that died without saying so
+#define POLL_MS 250
+
+struct Job {
+    pid_t pid;
+    uint64_t pidStart; // The process's start time, in case the pid is reused
+    char id[ID_LEN];
+    uint64_t cost;
+    uint64_t seq;
+    uint64_t since; // In ns
+};
+
+struct Sched {
+    uint32_t magic, version;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    uint32_t slotCt, slotsUsed, waiterCt;
+    uint64_t seq;
+    struct Job slots[MAX_SLOTS];
+    struct Job waiters[MAX_WAITERS];
+
+    // Since the state was made
+    uint64_t admitted, waitTotal, waitMax;
+};
+
+static struct Sched *sched;
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// A process's start time, from /proc, or 0 if it's gone
+static uint64_t procStart(pid_t pid)
+{
+    char path[32], buf[1024], *field;
+    unsigned long long start = 0;
+    ssize_t rd;
+    int fd, i;
+
+    sprintf(path, "/proc/%d/stat", (int) pid);
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    rd = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (rd <= 0)
+        return 0;
+    buf[rd] = 0;
+
+    // The name can contain anything, so count fields from after it
+    field = strrchr(buf, ')');
+    if (!field)
+        return 0;
+    for (i = 2; i < 22 && field; i++)
+        field = strchr(field + 1, ' ');
+    if (!field || sscanf(field + 1, "%llu", &start) != 1)
+        return 0;
+    return start + 1; // So that 0 is never a valid start
+}
+
+static int alive(const struct Job *job)
+{
+    return procStart(job->pid) == job->pidStart;
+}
+
+static void lock()
+{
+    int ret = pthread_mutex_lock(&sched->lock);
+    if (ret == EOWNERDEAD) {
+        // Whoever died held it only for a moment, so the state is sound
+        pthread_mutex_consistent(&sched->lock);
+    } else if (ret) {
+        errno = ret;
+        perror("pthread_mutex_lock");
+        exit(1);
+    }
+}
+
+static void unlock()
+{
+    pthread_mutex_unlock(&sched->lock);
+}
+
+// Open the shared state, making it if there isn't one
+static void openSched(const char *path, uint32_t slots)
+{
+    struct stat sbuf;
+    int fd;
+
+    // Anyone who can write it can hold up every cook, so it's only ours
+    fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    if (flock(fd, LOCK_EX) < 0 || fstat(fd, &sbuf) < 0) {
+        perror(path);
+        exit(1);
+    }
+    if (sbuf.st_size != sizeof(struct Sched) && ftruncate(fd, sizeof(struct Sched)) < 0) {
+        perror(path);
+        exit(1);
+    }
+
+    sched = mmap(NULL, sizeof(struct Sched), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (sched == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    if (sched->magic != SCHED_MAGIC || sched->version != SCHED_VERSION) {
+        pthread_mutexattr_t mattr;
+        pthread_condattr_t cattr;
+        cpu_set_t cpus;
+
+        memset(sched, 0, sizeof(struct Sched));
+        pthread_mutexattr_init(&mattr);
+        pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&sched->lock, &mattr);
+        pthread_condattr_init(&cattr);
+        pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+        pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+        pthread_cond_init(&sched->cond, &cattr);
+
+        /* The number of slots is set once, by whoever creates the state, so
+         * that a later -j can't change it under the jobs already holding
+         * them */
+        sched->slotCt = 1;
+        if (slots)
+            sched->slotCt = slots;
+        else if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 0)
+            sched->slotCt = CPU_COUNT(&cpus);
+        if (sched->slotCt > MAX_SLOTS)
+            sched->slotCt = MAX_SLOTS;
+        sched->magic = SCHED_MAGIC;
+        sched->version = SCHED_VERSION;
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+// Forget jobs and waiters that died without saying so
+static void reap()
+{
+    uint32_t i;
+    int freed = 0;
+
+    for (i = 0; i < sched->slotsUsed; i++) {
+        if (!alive(&sched->slots[i])) {
+            sched->slots[i--] = sched->slots[--sched->slotsUsed];
+            freed = 1;
+        }
+    }
+    for (i = 0; i < sched->waiterCt; i++) {
+        if (!alive(&sched->waiters[i]))
+            sched->waiters[i--] = sched->waiters[--sched->waiterCt];
+    }
+    if (freed)
+        pthread_cond_broadcast(&sched->cond);
+}
+
+static uint32_t running(const char *id)
+{
+    uint32_t i, ct = 0;
+    for (i = 0; i < sched->slotsUsed; i++)
+        ct += !strcmp(sched->slots[i].id, id);
+    return ct;
+}
+
+// Does waiter l go before waiter r?
+static int before(const struct Job *l, uint32_t lRunning, const struct Job *r, uint32_t rRunning)
+{
+    if (lRunning != rRunning)
+        return lRunning < rRunning;
+    if (l->cost != r->cost)
+        return l->cost > r->cost;
+    return l->seq < r->seq;
+}
+
+// How many waiters go before this one
+static uint32_t rank(const struct Job *self)
+{
+    uint32_t selfRunning = running(self->id), i, ct = 0;
+    for (i = 0; i < sched->waiterCt; i++) {
+        const struct Job *other = &sched->waiters[i];
+        if (other->seq != self->seq && before(other, running(other->id), self, selfRunning))
+            ct++;
+    }
+    return ct;
+}
+
+// Wait for a slot, to be held by holder
+static void acquire(const char *id, uint64_t cost, pid_t holder)
+{
+    struct Job self = {0};
+    uint64_t waited;
+    uint32_t i;
+
+    self.pid = getpid();
+    self.pidStart = procStart(self.pid);
+    snprintf(self.id, ID_LEN, "%s", id);
+    self.cost = cost;
+    self.since = now();
+
+    lock();
+    reap();
+    self.seq = sched->seq++;
+    if (sched->waiterCt >= MAX_WAITERS) {
+        // Don't hold anything up for the sake of bookkeeping
+        unlock();
+        fprintf(stderr, "cooksched: Too many waiters, running anyway\n");
+        return;
+    }
+    sched->waiters[sched->waiterCt++] = self;
+
+    while (!(sched->slotsUsed < sched->slotCt && rank(&self) < sched->slotCt - sched->slotsUsed)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_nsec += POLL_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&sched->cond, &sched->lock, &ts) == EOWNERDEAD)
+            pthread_mutex_consistent(&sched->lock);
+        reap();
+    }
+
+    for (i = 0; i < sched->waiterCt; i++) {
+        if (sched->waiters[i].seq == self.seq) {
+            sched->waiters[i] = sched->waiters[--sched->waiterCt];
+            break;
+        }
+    }
+
+    waited = now() - self.since;
+    self.pid = holder;
+    self.pidStart = procStart(holder);
+    self.since = now();
+    sched->slots[sched->slotsUsed++] = self;
+    sched->admitted++;
+    sched->waitTotal += waited;
+    if (waited > sched->waitMax)
+        sched->waitMax = waited;
+
+    // Another waiter may be next in line for another free slot
+    pthread_cond_broadcast(&sched->cond);
+    unlock();
+}
+
+// Give back a slot held by one of these
+static void release(pid_t a, pid_t b)
+{
+    uint32_t i;
+    lock();
+    for (i = 0; i < sched->slotsUsed; i++) {
+        if (sched->slots[i].pid == a || sched->slots[i].pid == b) {
+            sched->slots[i] = sched->slots[--sched->slotsUsed];
+            break;
+        }
+    }
+    pthread_cond_broadcast(&sched->cond);
+    unlock();
+}
+
+// Print the state as JSON
+static void printStat()
+{
+    struct Recording {
+        char id[ID_LEN];
+        uint32_t running, queued;
+        uint64_t queuedCost;
+    } *recs;
+    uint32_t recCt = 0, i, j;
+    uint64_t t = now(), oldest = 0;
+
+    recs = calloc(MAX_SLOTS + MAX_WAITERS, sizeof(struct Recording));
+    if (!recs) {
+        perror("calloc");
+        exit(1);
+    }
+
+    lock();
+    reap();
+    for (i = 0; i < sched->slotsUsed + sched->waiterCt; i++) {
+        const struct Job *job = (i < sched->slotsUsed) ?
+            &sched->slots[i] : &sched->waiters[i - sched->slotsUsed];
+        for (j = 0; j < recCt && strcmp(recs[j].id, job->id); j++);
+        if (j == recCt)
+            memcpy(recs[recCt++].id, job->id, ID_LEN);
+        if (i < sched->slotsUsed) {
+            recs[j].running++;
+        } else {
+            recs[j].queued++;
+            recs[j].queuedCost += job->cost;
+            if (t - job->since > oldest)
+                oldest = t - job->since;
+        }
+    }
+
+    printf("{\"slots\":%u,\"running\":%u,\"queued\":%u,\"admitted\":%llu,"
+           "\"waitAvg\":%.3f,\"waitMax\":%.3f,\"oldestWait\":%.3f,\"recordings\":[",
+           sched->slotCt, sched->slotsUsed, sched->waiterCt,
+           (unsigned long long) sched->admitted,
+           sched->admitted ? sched->waitTotal / 1e9 / sched->admitted : 0.0,
+           sched->waitMax / 1e9, oldest / 1e9);
+    unlock();
+
+    for (i = 0; i < recCt; i++) {
+        // IDs are alphanumeric, but don't let anything else break the JSON
+        for (j = 0; recs[i].id[j]; j++) {
+            if (recs[i].id[j] == '"' || recs[i].id[j] == '\\' || recs[i].id[j] < ' ')
+                recs[i].id[j] = '_';
+        }
+        printf("%s{\"id\":\"%s\",\"running\":%u,\"queued\":%u,\"queuedCost\":%llu}",
+               i ? "," : "", recs[i].id, recs[i].running, recs[i].queued,
+               (unsigned long long) recs[i].queuedCost);
+    }
+    printf("]}\n");
+    free(recs);
+}
+
+void usage()
+{
+    fprintf(stderr, "Use: cooksched [-s <state file>] [-j <slots>] <command>\n"
+                    "Commands:\n"
+                    "  wait <ID> <cost>: Wait for a slot, which is then held by the calling\n"
+                    "      shell, until it exits or runs done.\n"
+                    "  done: Give back the calling shell's slot.\n"
+                    "  run <ID> <cost> <command...>: Run a command in a slot.\n"
+                    "  stat: Print the slots and queue as JSON.\n"
+                    "Cost is the job's expected cost, such as its track's size, and more costly\n"
+                    "jobs go first. There are as many slots as cores, or as -j says, as set\n"
+                    "by whichever call creates the state file; -j is ignored after that.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = "/dev/shm/cooksched";
+    uint32_t slots = 0;
+    int ai;
+
+    for (ai = 1; ai < argc && argv[ai][0] == '-'; ai++) {
+        if (!strcmp(argv[ai], "-s") && ai + 1 < argc) {
+            path = argv[++ai];
+        } else if (!strcmp(argv[ai], "-j") && ai + 1 < argc) {
+            slots = atoi(argv[++ai]);
+            if (slots < 1)
+                usage();
+        } else {
+            usage();
+        }
+    }
+    if (ai >= argc)
+        usage();
+
+    openSched(path, slots);
+
+    if (!strcmp(argv[ai], "wait") && ai + 3 == argc) {
+        acquire(argv[ai + 1], strtoull(argv[ai + 2], NULL, 10), getppid());
+
+    } else if (!strcmp(argv[ai], "done") && ai + 1 == argc) {
+        /* The shell may well exec us as its last command, in which case we're
+         * the process that holds the slot */
+        release(getppid(), getpid());
+
+    } else if (!strcmp(argv[ai], "run") && ai + 3 < argc) {
+        pid_t pid;
+        int status;
+
+        acquire(argv[ai + 1], strtoull(argv[ai + 2], NULL, 10), getpid());
+        pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(1);
+        } else if (pid == 0) {
+            execvp(argv[ai + 3], argv + ai + 3);
+            perror(argv[ai + 3]);
+            exit(127);
+        }
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+        release(getpid(), getpid());
+        return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+    } else if (!strcmp(argv[ai], "stat") && ai + 1 == argc) {
+        printStat();
+
+    } else {
+        usage();
+
+    }
+
+    return 0;
+}
@@ -0,0 +1,849 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* cookzip writes a zip file to stdout, like zip -FI -, but reads all of its
+ * inputs (usually FIFOs) at once, so no input's writer is ever stuck waiting
+ * for the ones before it. One entry is streamed out at a time, with a data
+ * descriptor, since we don't know its size until it ends. Everything else
+ * that comes in meanwhile is compressed and spooled, in memory up to a point
+ * and then in temporary files. Finished entries are written out whole, so
+ * they go first; otherwise, the entry that's furthest along is streamed next.
+ * Zip64 is used as needed, and always for streamed entries.
+ *
+ * Compression is done like pigz: each entry is cut into blocks, primed with
+ * the end of the block before as a dictionary, and compressed by a pool of
+ * threads. Each block but the last ends with a sync flush, so they can simply
+ * be put together in order. Files that are already compressed (FLAC, Opus,
+ * etc.) are stored. */
+
+#define _GNU_SOURCE // For sched_getaffinity
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+// How much we spool in memory, across all entries, before using files
+#define SPOOL_MEMORY (64*1024*1024)
+
+#define READ_SIZE (64*1024)
+
+// Size of each block compressed on its own, and how much it's primed with
+#define BLOCK_SIZE (128*1024)
+#define DICT_SIZE (32*1024)
+
+// Blocks per thread in flight at once, before we stop reading
+#define BLOCKS_PER_THREAD 4
+
+// A block of input to compress, and its output once it's compressed
+struct Block {
+    struct Block *next; // In its entry's list
+    struct Block *nextWork; // In the work queue
+
+    // Input, after dictSize bytes of dictionary
+    unsigned char *in;
+    size_t dictSize, size;
+    int last;
+
+    unsigned char *out;
+    size_t outSize;
+    uint32_t crc;
+    int done;
+};
+
+struct Entry {
+    char *path, *name;
+    int fd;
+    mode_t mode;
+    uint16_t dosTime, dosDate;
+
+    /* Have we reached the end of the input, compressed it all, and written it
+     * all out? */
+    int eof, compressed, written;
+
+    // Compression, if any, with the block we're filling and those in progress
+    int level;
+    struct Block *block, *blocks, *blocksTail;
+
+    uint32_t crc;
+    uint64_t size, compressedSize;
+
+    // Where its local header is, and was it streamed (zip64, with a descriptor)?
+    uint64_t offset;
+    int streamed;
+
+    // Compressed data not yet written, in memory and then in a file
+    unsigned char *spool;
+    size_t spoolUsed, spoolSz;
+    FILE *spoolFile;
+    uint64_t spoolFileSize;
+};
+
+static struct Entry *entries = NULL;
+static int entryCt = 0, entrySz = 0;
+
+// Entries in the order they were written, for the central directory
+static struct Entry **order = NULL;
+static int orderCt = 0;
+
+static size_t spoolMemory = 0;
+
+// Our compression threads, their work, and the pipe they wake us with
+static int level = 6;
+static int threadCt = 0;
+static pthread_mutex_t workLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workCond = PTHREAD_COND_INITIALIZER;
+static struct Block *work = NULL, *workTail = NULL;
+static int wakePipe[2];
+static int inFlight = 0;
+
+// Our output, buffered
+static unsigned char outBuf[READ_SIZE];
+static size_t outUsed = 0;
+static uint64_t outOffset = 0;
+
+void flushOut()
+{
+    size_t wr = 0;
+    ssize_t ret;
+    while (wr < outUsed) {
+        ret = write(1, outBuf + wr, outUsed - wr);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR)
+                continue;
+            perror("write");
+            exit(1);
+        }
+        wr += ret;
+    }
+    outUsed = 0;
+}
+
+void output(const void *vbuf, size_t size)
+{
+    const unsigned char *buf = vbuf;
+    outOffset += size;
+    while (size) {
+        size_t part = sizeof(outBuf) - outUsed;
+        if (part > size)
+            part = size;
+        memcpy(outBuf + outUsed, buf, part);
+        outUsed += part;
+        buf += part;
+        size -= part;
+        if (outUsed == sizeof(outBuf))
+            flushOut();
+    }
+}
+
+void output16(uint16_t v)
+{
+    unsigned char b[2] = {v, v >> 8};
+    output(b, 2);
+}
+
+void output32(uint32_t v)
+{
+    output16(v);
+    output16(v >> 16);
+}
+
+void output64(uint64_t v)
+{
+    output32(v);
+    output32(v >> 32);
+}
+
+void spoolAppend(struct Entry *entry, const unsigned char *buf, size_t size)
+{
+    if (!entry->spoolFile && spoolMemory + size <= SPOOL_MEMORY) {
+        if (entry->spoolUsed + size > entry->spoolSz) {
+            size_t sz = entry->spoolSz ? entry->spoolSz * 2 : READ_SIZE;
+            while (sz < entry->spoolUsed + size)
+                sz *= 2;
+            entry->spool = realloc(entry->spool, sz);
+            if (!entry->spool) {
+                perror("realloc");
+                exit(1);
+            }
+            entry->spoolSz = sz;
+        }
+        memcpy(entry->spool + entry->spoolUsed, buf, size);
+        entry->spoolUsed += size;
+        spoolMemory += size;
+        return;
+    }
+
+    // Out of memory to spool in, so use a file
+    if (!entry->spoolFile) {
+        entry->spoolFile = tmpfile();
+        if (!entry->spoolFile) {
+            perror("tmpfile");
+            exit(1);
+        }
+    }
+    if (fwrite(buf, 1, size, entry->spoolFile) != size) {
+        perror("tmpfile");
+        exit(1);
+    }
+    entry->spoolFileSize += size;
+}
+
+uint64_t spoolSize(struct Entry *entry)
+{
+    return entry->spoolUsed + entry->spoolFileSize;
+}
+
+// Write out everything spooled for this entry
+void drainSpool(struct Entry *entry)
+{
+    output(entry->spool, entry->spoolUsed);
+    spoolMemory -= entry->spoolUsed;
+    free(entry->spool);
+    entry->spool = NULL;
+    entry->spoolUsed = entry->spoolSz = 0;
+
+    if (entry->spoolFile) {
+        unsigned char buf[READ_SIZE];
+        size_t rd;
+        rewind(entry->spoolFile);
+        while ((rd = fread(buf, 1, sizeof(buf), entry->spoolFile)) > 0)
+            output(buf, rd);
+        if (ferror(entry->spoolFile)) {
+            perror("tmpfile");
+            exit(1);
+        }
+        fclose(entry->spoolFile);
+        entry->spoolFile = NULL;
+        entry->spoolFileSize = 0;
+    }
+}
+
+static struct Entry *current = NULL;
+
+// Compressed data for this entry, to go out now or later
+void sink(struct Entry *entry, const unsigned char *buf, size_t size)
+{
+    entry->compressedSize += size;
+    if (entry == current)
+        output(buf, size);
+    else
+        spoolAppend(entry, buf, size);
+}
+
+// Compress a block, in a compression thread
+void compressBlock(z_stream *z, struct Block *block)
+{
+    size_t outSz = deflateBound(z, block->size) + 16;
+    int ret;
+
+    block->crc = crc32(0, block->in + block->dictSize, block->size);
+
+    deflateReset(z);
+    if (block->dictSize)
+        deflateSetDictionary(z, block->in, block->dictSize);
+    z->next_in = block->in + block->dictSize;
+    z->avail_in = block->size;
+    block->outSize = 0;
+    block->out = NULL;
+    do {
+        if (block->outSize == 0 || z->avail_out == 0) {
+            if (block->out)
+                outSz *= 2;
+            block->out = realloc(block->out, outSz);
+            if (!block->out) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        z->next_out = block->out + block->outSize;
+        z->avail_out = outSz - block->outSize;
+        ret = deflate(z, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+        block->outSize = outSz - z->avail_out;
+    } while (block->last ? ret != Z_STREAM_END : z->avail_out == 0);
+}
+
+void *compressThread(void *ignore)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "Failed to initialize compression\n");
+        exit(1);
+    }
+
+    while (1) {
+        struct Block *block;
+
+        pthread_mutex_lock(&workLock);
+        while (!work)
+            pthread_cond_wait(&workCond, &workLock);
+        block = work;
+        work = block->nextWork;
+        if (!work)
+            workTail = NULL;
+        pthread_mutex_unlock(&workLock);
+
+        compressBlock(&z, block);
+
+        pthread_mutex_lock(&workLock);
+        block->done = 1;
+        pthread_mutex_unlock(&workLock);
+
+        // If the pipe's full, we're already being woken
+        while (write(wakePipe[1], "", 1) < 0 && errno == EINTR);
+    }
+
+    return NULL;
+}
+
+void startThreads()
+{
+    cpu_set_t cpus;
+    int ti;
+
+    // As many threads as we're allowed cores, unless told otherwise
+    if (!threadCt) {
+        threadCt = 1;
+        if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 1)
+            threadCt = CPU_COUNT(&cpus);
+    }
+
+    if (pipe(wakePipe) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+
+    for (ti = 0; ti < threadCt; ti++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, compressThread, NULL) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+}
+
+// Start a block for this entry, primed with the end of the last one
+void newBlock(struct Entry *entry, struct Block *prev)
+{
+    struct Block *block = calloc(1, sizeof(struct Block));
+    if (!block || !(block->in = malloc(DICT_SIZE + BLOCK_SIZE))) {
+        perror("malloc");
+        exit(1);
+    }
+    if (prev) {
+        block->dictSize = prev->size < DICT_SIZE ? prev->size : DICT_SIZE;
+        memcpy(block->in, prev->in + prev->dictSize + prev->size - block->dictSize,
+               block->dictSize);
+    }
+    entry->block = block;
+}
+
+// Hand this entry's block over to be compressed
+void submitBlock(struct Entry *entry, int last)
+{
+    struct Block *block = entry->block;
+    block->last = last;
+
+    if (entry->blocksTail)
+        entry->blocksTail->next = block;
+    else
+        entry->blocks = block;
+    entry->blocksTail = block;
+    inFlight++;
+
+    pthread_mutex_lock(&workLock);
+    if (workTail)
+        workTail->nextWork = block;
+    else
+        work = block;
+    workTail = block;
+    pthread_cond_signal(&workCond);
+    pthread_mutex_unlock(&workLock);
+
+    if (last)
+        entry->block = NULL;
+    else
+        newBlock(entry, block);
+}
+
+void finishCurrent();
+
+// Take whatever's been compressed, in order
+void collectBlocks()
+{
+    char buf[256];
+    int ei;
+
+    while (read(wakePipe[0], buf, sizeof(buf)) > 0);
+
+    pthread_mutex_lock(&workLock);
+    for (ei = 0; ei < entryCt; ei++) {
+        struct Entry *entry = &entries[ei];
+        struct Block *block;
+        while ((block = entry->blocks) && block->done) {
+            pthread_mutex_unlock(&workLock);
+
+            entry->crc = crc32_combine(entry->crc, block->crc, block->size);
+            entry->size += block->size;
+            sink(entry, block->out, block->outSize);
+            if (block->last) {
+                entry->compressed = 1;
+                if (entry == current)
+                    finishCurrent();
+            }
+
+            entry->blocks = block->next;
+            if (!entry->blocks)
+                entry->blocksTail = NULL;
+            free(block->in);
+            free(block->out);
+            free(block);
+            inFlight--;
+
+            pthread_mutex_lock(&workLock);
+        }
+    }
+    pthread_mutex_unlock(&workLock);
+}
+
+void localHeader(struct Entry *entry, int streamed)
+{
+    int zip64 = streamed ||
+        entry->size >= 0xFFFFFFFF || entry->compressedSize >= 0xFFFFFFFF;
+    size_t nameLen = strlen(entry->name);
+
+    entry->offset = outOffset;
+    entry->streamed = streamed;
+
+    output32(0x04034b50);
+    output16(zip64 ? 45 : 20);
+    output16(streamed ? 0x0008 : 0);
+    output16(entry->level ? 8 : 0);
+    output16(entry->dosTime);
+    output16(entry->dosDate);
+    output32(streamed ? 0 : entry->crc);
+    output32(zip64 ? 0xFFFFFFFF : entry->compressedSize);
+    output32(zip64 ? 0xFFFFFFFF : entry->size);
+    output16(nameLen);
+    output16(zip64 ? 20 : 0);
+    output(entry->name, nameLen);
+    if (zip64) {
+        output16(0x0001);
+        output16(16);
+        output64(streamed ? 0 : entry->size);
+        output64(streamed ? 0 : entry->compressedSize);
+    }
+
+    order[orderCt++] = entry;
+}
+
+// Done with the entry being streamed
+void finishCurrent()
+{
+    struct Entry *entry = current;
+    output32(0x08074b50);
+    output32(entry->crc);
+    output64(entry->compressedSize);
+    output64(entry->size);
+    entry->written = 1;
+    current = NULL;
+}
+
+void readEntry(struct Entry *entry)
+{
+    unsigned char sbuf[READ_SIZE], *buf = sbuf;
+    size_t size = sizeof(sbuf);
+    struct Block *block = entry->block;
+    ssize_t rd;
+
+    // Compressed data goes straight into its block
+    if (block) {
+        buf = block->in + block->dictSize + block->size;
+        size = BLOCK_SIZE - block->size;
+    }
+
+    rd = read(entry->fd, buf, size);
+    if (rd < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if (rd < 0) {
+        perror(entry->path);
+        rd = 0;
+    }
+
+    if (rd > 0) {
+        if (block) {
+            block->size += rd;
+            if (block->size == BLOCK_SIZE)
+                submitBlock(entry, 0);
+        } else {
+            entry->crc = crc32(entry->crc, buf, rd);
+            entry->size += rd;
+            sink(entry, buf, rd);
+        }
+        return;
+    }
+
+    // End of this input
+    close(entry->fd);
+    entry->fd = -1;
+    entry->eof = 1;
+    if (block) {
+        submitBlock(entry, 1);
+    } else {
+        entry->compressed = 1;
+        if (entry == current)
+            finishCurrent();
+    }
+}
+
+// Decide what to write next, if there's anything we can
+void pickNext()
+{
+    struct Entry *best = NULL;
+    int ei;
+
+    for (ei = 0; ei < entryCt; ei++) {
+        struct Entry *entry = &entries[ei];
+        if (entry->written)
+            continue;
+
+        if (entry->compressed) {
+            // All here, so out it goes, sizes and all
+            localHeader(entry, 0);
+            drainSpool(entry);
+            entry->written = 1;
+            continue;
+        }
+
+        if (spoolSize(entry) && (!best || spoolSize(entry) > spoolSize(best)))
+            best = entry;
+    }
+
+    if (best) {
+        // Stream the one that's furthest along
+        current = best;
+        localHeader(best, 1);
+        drainSpool(best);
+    }
+}
+
+void dosTime(struct Entry *entry, time_t t)
+{
+    struct tm *tm = localtime(&t);
+    if (!tm || tm->tm_year < 80) {
+        entry->dosTime = 0;
+        entry->dosDate = (1 << 5) | 1;
+        return;
+    }
+    entry->dosTime = (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2);
+    entry->dosDate = ((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday;
+}
+
+// Is this file already compressed, by its name?
+int isCompressed(const char *name)
+{
+    static const char *exts[] = {
+        "aac", "flac", "m4a", "mp3", "oga", "ogg", "opus", "ra", "zip", NULL
+    };
+    const char *ext = strrchr(name, '.');
+    int i;
+    if (!ext || strchr(ext, '/'))
+        return 0;
+    for (i = 0; exts[i]; i++) {
+        if (!strcasecmp(ext + 1, exts[i]))
+            return 1;
+    }
+    return 0;
+}
+
+void addEntry(const char *path, int recurse);
+
+void addDirectory(const char *path)
+{
+    DIR *dir = opendir(path);
+    struct dirent *de;
+    if (!dir) {
+        perror(path);
+        return;
+    }
+    while ((de = readdir(dir))) {
+        char *sub;
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        sub = malloc(strlen(path) + strlen(de->d_name) + 2);
+        if (!sub) {
+            perror("malloc");
+            exit(1);
+        }
+        sprintf(sub, "%s/%s", path, de->d_name);
+        addEntry(sub, 1);
+        free(sub);
+    }
+    closedir(dir);
+}
+
+void addEntry(const char *path, int recurse)
+{
+    struct Entry *entry;
+    struct stat sbuf;
+    const char *name = path;
+    int fd;
+
+    if (stat(path, &sbuf) < 0) {
+        perror(path);
+        return;
+    }
+    if (S_ISDIR(sbuf.st_mode)) {
+        if (recurse)
+            addDirectory(path);
+        else
+            fprintf(stderr, "%s: Is a directory, skipping\n", path);
+        return;
+    }
+
+    // Don't wait for FIFO writers to open
+    fd = open(path, O_RDONLY|O_NONBLOCK);
+    if (fd < 0) {
+        perror(path);
+        return;
+    }
+
+    if (entryCt >= entrySz) {
+        entrySz = entrySz ? entrySz * 2 : 16;
+        entries = realloc(entries, entrySz * sizeof(struct Entry));
+        if (!entries) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    entry = &entries[entryCt++];
+    memset(entry, 0, sizeof(*entry));
+
+    // Zip names are relative
+    while (name[0] == '/')
+        name++;
+    while (!strncmp(name, "./", 2))
+        name += 2;
+    entry->path = strdup(path);
+    entry->name = strdup(name);
+    if (!entry->path || !entry->name) {
+        perror("strdup");
+        exit(1);
+    }
+
+    entry->fd = fd;
+    entry->mode = sbuf.st_mode & 0777;
+    dosTime(entry, sbuf.st_mtime);
+    entry->crc = crc32(0, NULL, 0);
+    entry->level = isCompressed(name) ? 0 : level;
+    if (entry->level)
+        newBlock(entry, NULL);
+}
+
+void centralDirectory()
+{
+    uint64_t start = outOffset, size;
+    int ei;
+
+    for (ei = 0; ei < orderCt; ei++) {
+        struct Entry *entry = order[ei];
+        size_t nameLen = strlen(entry->name);
+        int bigSize = entry->size >= 0xFFFFFFFF;
+        int bigCompressed = entry->compressedSize >= 0xFFFFFFFF;
+        int bigOffset = entry->offset >= 0xFFFFFFFF;
+        int extraLen = (bigSize + bigCompressed + bigOffset) * 8;
+        int zip64 = entry->streamed || extraLen;
+
+        output32(0x02014b50);
+        output16(0x0300 | 45); // Unix, 4.5
+        output16(zip64 ? 45 : 20);
+        output16(entry->streamed ? 0x0008 : 0);
+        output16(entry->level ? 8 : 0);
+        output16(entry->dosTime);
+        output16(entry->dosDate);
+        output32(entry->crc);
+        output32(bigCompressed ? 0xFFFFFFFF : entry->compressedSize);
+        output32(bigSize ? 0xFFFFFFFF : entry->size);
+        output16(nameLen);
+        output16(extraLen ? extraLen + 4 : 0);
+        output16(0); // Comment
+        output16(0); // Disk
+        output16(0); // Internal attributes
+        output32((uint32_t) (S_IFREG | entry->mode) << 16);
+        output32(bigOffset ? 0xFFFFFFFF : entry->offset);
+        output(entry->name, nameLen);
+        if (extraLen) {
+            output16(0x0001);
+            output16(extraLen);
+            if (bigSize)
+                output64(entry->size);
+            if (bigCompressed)
+                output64(entry->compressedSize);
+            if (bigOffset)
+                output64(entry->offset);
+        }
+    }
+    size = outOffset - start;
+
+    if (orderCt >= 0xFFFF || size >= 0xFFFFFFFF || start >= 0xFFFFFFFF) {
+        // Zip64 end of central directory record and locator
+        uint64_t zip64End = outOffset;
+        output32(0x06064b50);
+        output64(44);
+        output16(0x0300 | 45);
+        output16(45);
+        output32(0);
+        output32(0);
+        output64(orderCt);
+        output64(orderCt);
+        output64(size);
+        output64(start);
+
+        output32(0x07064b50);
+        output32(0);
+        output64(zip64End);
+        output32(1);
+    }
+
+    output32(0x06054b50);
+    output16(0);
+    output16(0);
+    output16(orderCt >= 0xFFFF ? 0xFFFF : orderCt);
+    output16(orderCt >= 0xFFFF ? 0xFFFF : orderCt);
+    output32(size >= 0xFFFFFFFF ? 0xFFFFFFFF : size);
+    output32(start >= 0xFFFFFFFF ? 0xFFFFFFFF : start);
+    output16(0);
+}
+
+void usage()
+{
+    fprintf(stderr, "Use: cookzip [-0...-9] [-r] [-p <threads>] <files...>\n"
+                    "Writes a zip of the files to stdout. Files may be FIFOs, which are all\n"
+                    "read at once. -r recurses into directories. Files are compressed with\n"
+                    "as many threads as there are cores, or as -p says, except for those\n"
+                    "that are already compressed, such as FLAC and Opus, which are stored.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int recurse = 0, ai, ei, ret;
+    struct pollfd *pfds;
+    struct Entry **pentries;
+
+    for (ai = 1; ai < argc && argv[ai][0] == '-' && argv[ai][1]; ai++) {
+        const char *arg = argv[ai];
+        if (arg[1] >= '0' && arg[1] <= '9' && !arg[2]) {
+            level = arg[1] - '0';
+        } else if (!strcmp(arg, "-r")) {
+            recurse = 1;
+        } else if (!strcmp(arg, "-p") && ai + 1 < argc) {
+            threadCt = atoi(argv[++ai]);
+            if (threadCt < 1)
+                usage();
+        } else if (!strcmp(arg, "--")) {
+            ai++;
+            break;
+        } else {
+            usage();
+        }
+    }
+    if (ai >= argc)
+        usage();
+
+    for (; ai < argc; ai++)
+        addEntry(argv[ai], recurse);
+    for (ei = 0; ei < entryCt && !entries[ei].level; ei++);
+    if (ei < entryCt)
+        startThreads();
+    else
+        threadCt = 0;
+
+    order = malloc((entryCt + 1) * sizeof(struct Entry *));
+    pfds = malloc((entryCt + 2) * sizeof(struct pollfd));
+    pentries = malloc((entryCt + 2) * sizeof(struct Entry *));
+    if (!order || !pfds || !pentries) {
+        perror("malloc");
+        exit(1);
+    }
+
+    while (orderCt < entryCt || current) {
+        int pfdCt = 0;
+
+        if (!current)
+            pickNext();
+
+        /* Wait for any input, unless we've got as much compression to do as
+         * we care to hold, or for compressed blocks */
+        if (!threadCt || inFlight < threadCt * BLOCKS_PER_THREAD) {
+            for (ei = 0; ei < entryCt; ei++) {
+                if (entries[ei].eof)
+                    continue;
+                pfds[pfdCt].fd = entries[ei].fd;
+                pfds[pfdCt].events = POLLIN;
+                pentries[pfdCt++] = &entries[ei];
+            }
+        }
+        if (inFlight) {
+            pfds[pfdCt].fd = wakePipe[0];
+            pfds[pfdCt].events = POLLIN;
+            pentries[pfdCt++] = NULL;
+        }
+        if (!pfdCt)
+            continue;
+
+        ret = poll(pfds, pfdCt, 0);
+        if (ret == 0) {
+            // Nothing yet, so our reader may as well have what we've got
+            flushOut();
+            ret = poll(pfds, pfdCt, -1);
+        }
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(1);
+        }
+        for (ei = 0; ei < pfdCt; ei++) {
+            if (!pfds[ei].revents)
+                continue;
+            if (pentries[ei])
+                readEntry(pentries[ei]);
+            else
+                collectBlocks();
+        }
+    }
+
+    centralDirectory();
+    flushOut();
+    return 0;
+}
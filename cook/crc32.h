@@ -3,6 +3,7 @@
 
 #if 0
 #include <stdio.h>
+#include <string.h>
 #endif
 #include <stdint.h>
 #include <stdlib.h>
@@ -77,7 +78,9 @@ static uint32_t crc32_for_byte(uint32_t r) {
 }
 #endif
 
-static void crc32(const void *data, size_t n_bytes, uint32_t* crc) {
+/* Byte-at-a-time version. Used for short runs and as the reference for the
+ * faster versions below. */
+static void crc32_bytewise(const void *data, size_t n_bytes, uint32_t* crc) {
 #if 0
   static uint32_t crc32_table[0x100];
   if(!crc32_table[1]) {
@@ -100,6 +103,132 @@ static void crc32(const void *data, size_t n_bytes, uint32_t* crc) {
     *crc = crc32_table[(*crc >> 24) ^ ((uint8_t*)data)[i]] ^ *crc << 8;
 }
 
+/* Slicing-by-8: crc32_tables8[k][i] is the CRC of byte i followed by k zero
+ * bytes, so eight bytes can be folded in with eight independent lookups.
+ * Filled in by crc32_init. */
+static uint32_t crc32_tables8[8][0x100];
+
+static void crc32_slice8(const void *data, size_t n_bytes, uint32_t* crc) {
+  const uint8_t *p = (const uint8_t *) data;
+  uint32_t c = *crc;
+
+  for (; n_bytes >= 8; p += 8, n_bytes -= 8) {
+    uint32_t a = c ^ ((uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+                      (uint32_t) p[2] << 8 | p[3]);
+    c = crc32_tables8[7][a >> 24] ^ crc32_tables8[6][(a >> 16) & 0xFF] ^
+        crc32_tables8[5][(a >> 8) & 0xFF] ^ crc32_tables8[4][a & 0xFF] ^
+        crc32_tables8[3][p[4]] ^ crc32_tables8[2][p[5]] ^
+        crc32_tables8[1][p[6]] ^ crc32_tables8[0][p[7]];
+  }
+
+  *crc = c;
+  crc32_bytewise(p, n_bytes, crc);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* Carry-less multiplication. The CRC is (message * x^32) mod P, so a 128-bit
+ * block followed by k more bits can be folded forward by multiplying its two
+ * 64-bit halves by x^(k+64) mod P and x^k mod P, without reducing anything
+ * until the very end. We fold four blocks at a time (k = 512) and then one
+ * (k = 128), and leave the last 128 bits and the tail to the tables. Ogg's
+ * CRC isn't bit-reflected, so the blocks just need byte-swapping to be read
+ * as polynomials. */
+static uint64_t crc32_fold128[2], crc32_fold512[2];
+
+#define CRC32_PCLMUL_MIN 64
+
+// x^n mod P
+static uint32_t crc32_xpow(int n) {
+  uint32_t r = 1;
+  while (n--)
+    r = (r << 1) ^ ((r & 0x80000000U) ? 0x04c11db7U : 0);
+  return r;
+}
+
+__attribute__((target("pclmul,ssse3")))
+static __m128i crc32_fold(__m128i acc, __m128i k, __m128i next) {
+  return _mm_xor_si128(next, _mm_xor_si128(
+    _mm_clmulepi64_si128(acc, k, 0x00),
+    _mm_clmulepi64_si128(acc, k, 0x11)));
+}
+
+__attribute__((target("pclmul,ssse3")))
+static void crc32_pclmul(const void *data, size_t n_bytes, uint32_t* crc) {
+  const uint8_t *p = (const uint8_t *) data;
+  const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                     8, 9, 10, 11, 12, 13, 14, 15);
+  const __m128i k128 = _mm_loadu_si128((const __m128i *) crc32_fold128);
+  const __m128i k512 = _mm_loadu_si128((const __m128i *) crc32_fold512);
+  __m128i a0, a1, a2, a3;
+  uint8_t last[16];
+
+  if (n_bytes < CRC32_PCLMUL_MIN) {
+    crc32_slice8(data, n_bytes, crc);
+    return;
+  }
+
+#define CRC32_LOAD(off) _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (p + (off))), bswap)
+  /* A running CRC is the same as XORing it into the first four bytes of the
+   * message and starting from 0 */
+  a0 = _mm_xor_si128(CRC32_LOAD(0), _mm_set_epi64x((uint64_t) *crc << 32, 0));
+  a1 = CRC32_LOAD(16);
+  a2 = CRC32_LOAD(32);
+  a3 = CRC32_LOAD(48);
+  p += 64;
+  n_bytes -= 64;
+
+  for (; n_bytes >= 64; p += 64, n_bytes -= 64) {
+    a0 = crc32_fold(a0, k512, CRC32_LOAD(0));
+    a1 = crc32_fold(a1, k512, CRC32_LOAD(16));
+    a2 = crc32_fold(a2, k512, CRC32_LOAD(32));
+    a3 = crc32_fold(a3, k512, CRC32_LOAD(48));
+  }
+
+  a0 = crc32_fold(a0, k128, a1);
+  a0 = crc32_fold(a0, k128, a2);
+  a0 = crc32_fold(a0, k128, a3);
+
+  for (; n_bytes >= 16; p += 16, n_bytes -= 16)
+    a0 = crc32_fold(a0, k128, CRC32_LOAD(0));
+#undef CRC32_LOAD
+
+  // Now finish off with the tables
+  _mm_storeu_si128((__m128i *) last, _mm_shuffle_epi8(a0, bswap));
+  *crc = 0;
+  crc32_slice8(last, sizeof(last), crc);
+  crc32_slice8(p, n_bytes, crc);
+}
+#endif
+
+static void (*crc32_impl)(const void *, size_t, uint32_t *) = crc32_slice8;
+
+__attribute__((constructor))
+static void crc32_init(void) {
+  for (int i = 0; i < 0x100; ++i) {
+    crc32_tables8[0][i] = crc32_table[i];
+    for (int k = 1; k < 8; ++k) {
+      uint32_t c = crc32_tables8[k-1][i];
+      crc32_tables8[k][i] = crc32_table[c >> 24] ^ c << 8;
+    }
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  crc32_fold128[0] = crc32_xpow(128);
+  crc32_fold128[1] = crc32_xpow(192);
+  crc32_fold512[0] = crc32_xpow(512);
+  crc32_fold512[1] = crc32_xpow(576);
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"))
+    crc32_impl = crc32_pclmul;
+#endif
+}
+
+static void crc32(const void *data, size_t n_bytes, uint32_t* crc) {
+  crc32_impl(data, n_bytes, crc);
+}
+
 #if 0
 int main(int ac, char** av) {
   FILE *fp;
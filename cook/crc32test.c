@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/* crc32test checks the fast CRC implementations in crc32.h against the
+ * byte-at-a-time table, for random data, lengths, alignments and starting
+ * CRCs, and the table itself against the polynomial, a bit at a time. Run by
+ * make test. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crc32.h"
+
+#define BUF_SZ (1 << 16)
+#define TRIALS 100000
+
+// Ogg's CRC, a bit at a time
+static void crc32Bitwise(const uint8_t *data, size_t len, uint32_t *crc)
+{
+    uint32_t c = *crc;
+    size_t i;
+    int b;
+    for (i = 0; i < len; i++) {
+        c ^= (uint32_t) data[i] << 24;
+        for (b = 0; b < 8; b++)
+            c = (c << 1) ^ ((c & 0x80000000U) ? 0x04c11db7U : 0);
+    }
+    *crc = c;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t buf[BUF_SZ + 64];
+    unsigned seed = (argc > 1) ? strtoul(argv[1], NULL, 0) : (unsigned) time(NULL);
+    int pclmul = 0, failed = 0, t;
+    size_t i;
+
+#if defined(__x86_64__) || defined(__i386__)
+    pclmul = (crc32_impl == crc32_pclmul);
+#endif
+
+    srand(seed);
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = rand();
+
+    for (t = 0; t < TRIALS; t++) {
+        // Every short length, including each side of every cutoff, then random ones
+        size_t off = rand() % 64;
+        size_t len = (t < 1024) ? (size_t) t : (size_t) rand() % BUF_SZ;
+        uint32_t init = (t & 1) ? (uint32_t) rand() << 1 ^ rand() : 0;
+        uint32_t ref = init, got;
+
+        crc32_bytewise(buf + off, len, &ref);
+
+        if (len <= 4096) {
+            got = init;
+            crc32Bitwise(buf + off, len, &got);
+            if (got != ref) {
+                fprintf(stderr, "table: len %zu off %zu init %08x: got %08x, expected %08x\n",
+                        len, off, init, got, ref);
+                failed = 1;
+            }
+        }
+
+        got = init;
+        crc32_slice8(buf + off, len, &got);
+        if (got != ref) {
+            fprintf(stderr, "slice8: len %zu off %zu init %08x: got %08x, expected %08x\n",
+                    len, off, init, got, ref);
+            failed = 1;
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        if (pclmul) {
+            got = init;
+            crc32_pclmul(buf + off, len, &got);
+            if (got != ref) {
+                fprintf(stderr, "pclmul: len %zu off %zu init %08x: got %08x, expected %08x\n",
+                        len, off, init, got, ref);
+                failed = 1;
+            }
+        }
+#endif
+
+        got = init;
+        crc32(buf + off, len, &got);
+        if (got != ref) {
+            fprintf(stderr, "crc32: len %zu off %zu init %08x: got %08x, expected %08x\n",
+                    len, off, init, got, ref);
+            failed = 1;
+        }
+    }
+
+    printf("crc32test: %s (seed %u, %d trials%s)\n", failed ? "FAILED" : "OK", seed, TRIALS,
+           pclmul ? "" : ", no PCLMUL on this CPU");
+    return failed;
+}
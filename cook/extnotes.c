@@ -21,38 +21,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-/* NOTE: We don't use libogg here because the behavior of this program is so
- * trivial, the added memory bandwidth of using it is just a waste of energy */
-
-/* NOTE: This program assumes little-endian for speed, it WILL NOT WORK on a
- * big-endian system */
-
-struct OggPreHeader {
-    unsigned char capturePattern[4];
-    unsigned char version;
-} __attribute__((packed));
-
-struct OggHeader {
-    unsigned char type;
-    uint64_t granulePos;
-    uint32_t streamNo;
-    uint32_t sequenceNo;
-    uint32_t crc;
-} __attribute__((packed));
-
-ssize_t readAll(int fd, void *vbuf, size_t count)
-{
-    unsigned char *buf = (unsigned char *) vbuf;
-    ssize_t rd = 0, ret;
-    while (rd < count) {
-        ret = read(fd, buf + rd, count - rd);
-        if (ret <= 0) return ret;
-        rd += ret;
-    }
-    return rd;
-}
+#include "oggpage.h"
 
-void printNote(unsigned char *buf, uint32_t packetSize)
+void printNote(const unsigned char *buf, uint32_t packetSize)
 {
     int i;
     for (i = 4; i < packetSize; i++) {
@@ -80,13 +51,13 @@ int main(int argc, char **argv)
 {
     uint32_t noteStreamNo = (uint32_t) -1;
     uint32_t packetSize;
-    unsigned char segmentCount, segmentVal;
-    unsigned char *buf = NULL;
-    uint32_t bufSz = 0;
-    struct OggPreHeader preHeader;
+    struct OggReader reader;
+    struct OggPage page;
+    const unsigned char *buf;
     unsigned char outputAudacity = 0, outputJSON = 0, outputHeader = 0;
     int ai;
 
+    oggProgressArgs(&argc, argv, "extnotes");
     for (ai = 1; ai < argc; ai++) {
         char *arg = argv[ai];
         if (!strcmp(arg, "-f") || !strcmp(arg, "--format")) {
@@ -95,63 +66,46 @@ int main(int argc, char **argv)
                 outputAudacity = 1;
             if (arg && !strcmp(arg, "json"))
                 outputJSON = 1;
+        } else if (arg[0] != '-' || !arg[1]) {
+            // Input files from here on
+            break;
         } else {
-            fprintf(stderr, "Use: extnotes [--format audacity|-f audacity|--format json|-f json]\n");
+            fprintf(stderr, "Use: extnotes [--format audacity|-f audacity|--format json|-f json] [--progress-fd <fd>] [input files]\n");
             exit(1);
         }
     }
 
+    if (!oggReaderOpen(&reader, argc - ai, argv + ai)) {
+        perror("open");
+        exit(1);
+    }
+    oggProgressAddReader(&reader);
+
     if (outputJSON)
         printf("[");
 
-    while (readAll(0, &preHeader, sizeof(preHeader)) == sizeof(preHeader)) {
-        struct OggHeader oggHeader;
+    while (oggReadPage(&reader, &page)) {
+        const struct OggHeader *oggHeader = page.header;
         double time;
-        if (memcmp(preHeader.capturePattern, "OggS", 4))
-            break;
-
-        // It's an ogg header, get the header data
-        if (readAll(0, &oggHeader, sizeof(oggHeader)) != sizeof(oggHeader))
-            break;
-
-        // Get the data size
-        packetSize = 0;
-        if (readAll(0, &segmentCount, 1) != 1)
-            break;
-        for (; segmentCount; segmentCount--) {
-            if (readAll(0, &segmentVal, 1) != 1)
-                break;
-            packetSize += (uint32_t) segmentVal;
-        }
-
-        // Get the data
-        if (packetSize > bufSz) {
-            unsigned char *temp = realloc(buf, packetSize); // Use a temporary pointer
-            if (!temp) { // Check if memory allocation failed
-                free(buf); // Free the existing buffer to avoid a memory leak
-                break;
-            }
-            buf = temp; // Only assign buf if realloc was successful
-            bufSz = packetSize;
-        }
-        if (readAll(0, buf, packetSize) != packetSize)
-            break;
+        buf = page.data;
+        packetSize = page.size;
 
         // Check for headers
-        if (oggHeader.granulePos == 0 && packetSize == 10 && !memcmp(buf, "STREAMNOTE", 10))
-            noteStreamNo = oggHeader.streamNo;
-        else if (noteStreamNo == (uint32_t) -1 && oggHeader.granulePos > 0)
+        if (oggHeader->granulePos == 0 && packetSize == 10 && !memcmp(buf, "STREAMNOTE", 10))
+            noteStreamNo = oggHeader->streamNo;
+        else if (noteStreamNo == (uint32_t) -1 && oggHeader->granulePos > 0)
             break;
 
         // Do we care?
-        if (oggHeader.streamNo != noteStreamNo)
+        if (oggHeader->streamNo != noteStreamNo)
             continue;
 
         // Is this actually a note?
         if (packetSize < 4 || memcmp(buf, "NOTE", 4))
             continue;
+        oggProgress.packets++;
 
-        time = oggHeader.granulePos / 48000.0;
+        time = oggHeader->granulePos / 48000.0;
 
         // Now output this line
         if (outputAudacity) {
@@ -198,5 +152,6 @@ int main(int argc, char **argv)
     if (outputJSON)
         printf("]");
 
+    oggProgressDone();
     return 0;
 }
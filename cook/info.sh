@@ -5,4 +5,4 @@ export PATH
 SCRIPTBASE=`dirname "$0"`
 SCRIPTBASE=`realpath "$SCRIPTBASE/.."`
 cd "$SCRIPTBASE/rec"
-exec "$SCRIPTBASE/cook/recinfo.js" "$@"
+exec "$SCRIPTBASE/cook/cookplan" info "$@"
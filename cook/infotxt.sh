@@ -10,6 +10,6 @@ timeout() {
     /usr/bin/timeout -k 5 "$@"
 }
 cd "$SCRIPTBASE/rec"
-"$SCRIPTBASE/cook/recinfo.js" "$ID" text;
-timeout $DEF_TIMEOUT cat $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-    timeout $DEF_TIMEOUT "$SCRIPTBASE/cook/extnotes"
+"$SCRIPTBASE/cook/cookplan" info "$ID" text;
+timeout $DEF_TIMEOUT "$SCRIPTBASE/cook/extnotes" \
+    $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data
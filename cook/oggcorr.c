@@ -0,0 +1,852 @@
+/*
+ * Copyright (c) 2017-2021 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "oggcorr.h"
+#include "oggpage.h"
+
+#define FLAG_BEGIN      1
+#define FLAG_END        2
+#define FLAG_SILENT     4
+#define FLAG_DROP       8
+
+// The encoding for a packet with only zeroes
+static const unsigned char zeroPacket[] = { 0xF8, 0xFF, 0xFE };
+static const uint32_t packetTime = 960;
+
+// The encoding for a FLAC packet with only zeroes, 48k
+static const unsigned char zeroPacketFLAC48k[] = { 0xFF, 0xF8, 0x7A, 0x0C, 0x00, 0x03,
+    0xBF, 0x94, 0x00, 0x00, 0x00, 0x00, 0xB1, 0xCA };
+
+// The encoding for a FLAC packet with only zeroes, 44.1k
+static const unsigned char zeroPacketFLAC44k[] = { 0xFF, 0xF8, 0x79, 0x0C, 0x00, 0x03,
+    0x71, 0x56, 0x00, 0x00, 0x00, 0x00, 0x63, 0xC5 };
+
+// Read an Ogg packet
+static int readOgg(struct OggReader *reader,
+                   struct OggHeader *oggHeader,
+                   const unsigned char **buf,
+                   uint32_t *packetSize)
+{
+    struct OggPage page;
+
+    if (!oggReadPage(reader, &page))
+        return 0;
+
+    *oggHeader = *page.header;
+    *buf = page.data;
+    *packetSize = page.size;
+    return 1;
+}
+
+// Hand a page of output to our caller
+static void emitPage(struct OggCorrectTrack *track, int header, struct OggHeader *oggHeader,
+                     const unsigned char *data, uint32_t size)
+{
+    struct OggCorrector *corrector = track->corrector;
+    corrector->page(corrector->arg, track, header, oggHeader, data, size);
+}
+
+// Data we've handed out is about to move
+static void flushTrack(struct OggCorrectTrack *track)
+{
+    struct OggCorrector *corrector = track->corrector;
+    if (corrector->flush)
+        corrector->flush(corrector->arg, track);
+}
+
+// Add a packet to the table, returning its index
+static size_t pushPacket(struct PacketTable *packets)
+{
+    size_t i;
+
+    if (packets->count >= packets->size) {
+        size_t size = packets->size ? packets->size * 2 : 4096;
+#define GROW(field) do { \
+    void *grown = realloc(packets->field, size * sizeof(*packets->field)); \
+    if (grown == NULL) { \
+        perror("realloc"); \
+        exit(1); \
+    } \
+    packets->field = grown; \
+} while (0)
+        GROW(flags);
+        GROW(framesInPacket);
+        GROW(frameSize);
+        GROW(preSkip);
+        GROW(inputGranulePos);
+        GROW(outputGranulePos);
+        if (packets->keepPages) {
+            GROW(header);
+            GROW(dataOffset);
+            GROW(dataSize);
+        }
+#undef GROW
+        packets->size = size;
+    }
+
+    i = packets->count++;
+    packets->flags[i] = 0;
+    packets->preSkip[i] = 0;
+    packets->outputGranulePos[i] = 0;
+    return i;
+}
+
+static void preSkip(struct PacketTable *packets, size_t packet, double *granulePos)
+{
+    if (packet < packets->count && packets->inputGranulePos[packet] > *granulePos) {
+        packets->preSkip[packet] = (packets->inputGranulePos[packet] - *granulePos) / packetTime;
+        *granulePos += packets->preSkip[packet] * packetTime;
+    }
+}
+
+static void writeZeroPacket(struct OggCorrectTrack *track, struct OggHeader *header)
+{
+    switch (track->flacRate) {
+        case 0: // Opus
+            emitPage(track, 0, header, zeroPacket, sizeof(zeroPacket));
+            break;
+        case 44100:
+            emitPage(track, 0, header, zeroPacketFLAC44k, sizeof(zeroPacketFLAC44k));
+            break;
+        default:
+            emitPage(track, 0, header, zeroPacketFLAC48k, sizeof(zeroPacketFLAC48k));
+    }
+}
+
+// Is this a header we care about? Sets VAD and FLAC info if so.
+static int scanHeader(struct OggCorrectTrack *track, const unsigned char *buf, uint32_t packetSize)
+{
+    uint32_t skip = 0;
+
+    if (packetSize > 8 && !memcmp(buf, "ECVADD", 6)) {
+        // It's our VAD header. Get our VAD info and skip
+        skip = 8 + *((const unsigned short *) (buf + 6));
+        if (packetSize > 10)
+            track->vadLevel = buf[10];
+    }
+
+    if (packetSize < (skip+5) ||
+        (memcmp(buf + skip, "Opus", 4) &&
+         memcmp(buf + skip, "\x7f""FLAC", 5) &&
+         memcmp(buf + skip, "\x04\0\0\x41", 4))) {
+        // This isn't an expected header!
+        return 0;
+    }
+
+    // Check if this is a FLAC header
+    if (packetSize > skip + 29 && !memcmp(buf + skip, "\x7f""FLAC", 5)) {
+        // Get our sample rate
+        track->flacRate = ((uint32_t) buf[skip+27] << 12) + ((uint32_t) buf[skip+28] << 4) + ((uint32_t) buf[skip+29] >> 4);
+    }
+
+    return 1;
+}
+
+// Add this data packet to the track's table
+static void scanPacket(struct OggCorrectTrack *track, uint64_t granulePos,
+                const unsigned char *buf, uint32_t packetSize)
+{
+    struct PacketTable *packets = &track->packets;
+    size_t packet;
+    int flags = 0, framesInPacket, frameSize;
+    uint32_t skip = track->vadLevel ? 1 : 0;
+
+    // Figure out how many frames are in this packet
+    frameSize = 960;
+    if (!track->flacRate) {
+        // Update frame in packet
+        framesInPacket = buf[skip] & 0x3;
+        switch (framesInPacket) {
+            case 0:
+                framesInPacket = 1;
+                break;
+
+            case 1:
+            case 2:
+                framesInPacket = 2;
+                break;
+
+            case 3: // Signaled
+                framesInPacket = buf[skip+1] & 0x3F;
+                break;
+
+            default:
+                framesInPacket = 1;
+        }
+
+        // Plot out each frame time and set it
+        // https://datatracker.ietf.org/doc/html/rfc6716#section-3.1
+        switch (buf[skip] >> 3) {
+            case 0:
+            case 4:
+            case 8:
+            case 12:
+            case 14:
+            case 18:
+            case 22:
+            case 26:
+            case 30:
+                frameSize = 480; // 10ms
+                break;
+            case 2:
+            case 6:
+            case 10:
+                frameSize = 1920; // 40ms
+                break;
+            case 3:
+            case 7:
+            case 11:
+                frameSize = 2880; // 60ms
+                break;
+            case 17:
+            case 21:
+            case 25:
+            case 29:
+                frameSize = 240; // 5ms
+                break;
+            case 16:
+            case 20:
+            case 24:
+            case 28:
+                frameSize = 120; // 2.5ms
+                break;
+            default:
+                frameSize = 960; // 20ms
+                break;
+        }
+    } else {
+        framesInPacket = 1;
+        frameSize = 960;
+    }
+
+    // Check if it's silent
+    if (track->vadLevel) {
+        if (buf[0] < track->vadLevel) {
+            // Silent
+            flags |= FLAG_SILENT;
+        }
+    } else {
+        // Silly detection
+        if (packetSize < (track->flacRate?16:8))
+            flags |= FLAG_SILENT;
+    }
+
+    packet = pushPacket(packets);
+    packets->flags[packet] = flags;
+    packets->framesInPacket[packet] = framesInPacket;
+    packets->frameSize[packet] = frameSize;
+    packets->inputGranulePos[packet] = granulePos;
+}
+
+/* Decide what to keep, drop and fill for one block, from begin to end
+ * inclusive, given the granule position we've reached before it. If continued,
+ * this is really the rest of a block we had to cut off. */
+static void planBlock(struct PacketTable *packets, size_t begin, size_t end, int continued,
+               double *granulePosP)
+{
+    unsigned char *flags = packets->flags;
+    unsigned char *framesInPacket = packets->framesInPacket;
+    uint16_t *frameSize = packets->frameSize;
+    int32_t *preSkips = packets->preSkip;
+    uint64_t *inputGranulePos = packets->inputGranulePos;
+    uint64_t *outputGranulePos = packets->outputGranulePos;
+    double granulePos;
+    size_t mid;
+    int ct = 0;
+
+    // Adjust for any skip before the block
+    if (!continued)
+        preSkip(packets, begin, granulePosP);
+    granulePos = *granulePosP;
+
+    for (mid = begin; mid < end; mid++)
+        ct += framesInPacket[mid];
+
+    // Check the difference between the expected range and the actual range
+    double expected = granulePos + ct * packetTime;
+    double actual = inputGranulePos[end] + framesInPacket[end] * frameSize[end];
+    if (actual < expected && (flags[begin] & FLAG_SILENT)) {
+        // Cut out silence from the beginning
+        while (actual < expected) {
+            if (preSkips[begin]) {
+                preSkips[begin]--;
+                expected -= frameSize[begin];
+                if (granulePos > frameSize[begin])
+                    granulePos -= frameSize[begin];
+                else
+                    granulePos = 0;
+            } else if (begin != end) {
+                flags[begin] |= FLAG_DROP;
+                expected -= framesInPacket[begin] * frameSize[begin];
+                begin++;
+            } else break;
+        }
+    }
+
+    // Set the output granule positions
+    for (mid = begin; mid <= end; mid++) {
+        if (granulePos + packetTime * 25 <
+            inputGranulePos[mid]) {
+            // Too little data, add a gap
+            int64_t diff = inputGranulePos[mid] - granulePos;
+            preSkips[mid] = diff / packetTime;
+            granulePos += preSkips[mid] * packetTime;
+            outputGranulePos[mid] = granulePos;
+            granulePos += framesInPacket[mid] * packetTime;
+
+        } else if (granulePos >
+            inputGranulePos[mid] + frameSize[mid] * 25) {
+            // Too much data, drop a packet
+            flags[mid] |= FLAG_DROP;
+
+        } else {
+            // Just right!
+            outputGranulePos[mid] = granulePos;
+            granulePos += framesInPacket[mid] * frameSize[mid];
+        }
+    }
+
+    *granulePosP = granulePos;
+}
+
+// Decide what to keep, drop and fill for the whole track
+static void planTrack(struct OggCorrectTrack *track)
+{
+    struct PacketTable *packets = &track->packets;
+    unsigned char *flags = packets->flags;
+    uint64_t *inputGranulePos = packets->inputGranulePos;
+    uint64_t *outputGranulePos = packets->outputGranulePos;
+    size_t count = packets->count, cur;
+
+    // Working granule position
+    double granulePos;
+
+    // Now, find ranges of audio that ought to be continuous
+    for (cur = 0; cur < count; cur++) {
+        flags[cur] |= FLAG_BEGIN;
+
+        // Look for a gap or silence to end this block
+        for (; cur + 1 < count; cur++) {
+            if (flags[cur+1] & FLAG_SILENT) {
+                // Gap of silence
+                break;
+            } else if (inputGranulePos[cur+1] > inputGranulePos[cur] + packetTime * 25) {
+                // Significant gap in timestamps
+                break;
+            }
+        }
+        flags[cur] |= FLAG_END;
+
+        // If this is silence, make a silent block
+        if (cur + 1 < count && flags[cur+1] & FLAG_SILENT) {
+            cur++;
+            flags[cur] |= FLAG_BEGIN;
+            for (; cur + 1 < count; cur++) {
+                if (!(flags[cur+1] & FLAG_SILENT))
+                    break;
+            }
+            flags[cur] |= FLAG_END;
+        }
+    }
+
+    // Adjust timestamps for the blocks
+    granulePos = 0;
+    for (cur = 0; cur < count; cur++) {
+        size_t begin = cur;
+
+        // We should be at the beginning of a block. Find the end
+        while (cur < count && !(flags[cur] & FLAG_END))
+            cur++;
+        if (cur >= count)
+            break;
+
+        planBlock(packets, begin, cur, 0, &granulePos);
+    }
+
+    // If we're FLAC 44100kHz, adjust the granule positions for that
+    if (track->flacRate == 44100) {
+        for (cur = 0; cur < count; cur++)
+            outputGranulePos[cur] = outputGranulePos[cur] * 147 / 160;
+    }
+
+    track->cur = 0;
+}
+
+// Pass through a header page
+static void writeHeader(struct OggCorrectTrack *track, struct OggHeader *oggHeader,
+                 const unsigned char *buf, uint32_t packetSize)
+{
+    uint32_t skip = 0;
+    if (packetSize > 8 && !memcmp(buf, "ECVADD", 6)) {
+        // It's our VAD header, so skip that
+        skip = 8 + *((const unsigned short *) (buf + 6));
+    }
+
+    // Pass through the normal header
+    oggHeader->sequenceNo = track->lastSequenceNo++;
+    emitPage(track, 1, oggHeader, buf + skip, packetSize - skip);
+}
+
+// Write out this packet, and any gap before it, with corrected timestamps
+static void writePacket(struct OggCorrectTrack *track, size_t cur, struct OggHeader *oggHeader,
+                 const unsigned char *buf, uint32_t packetSize)
+{
+    struct PacketTable *packets = &track->packets;
+    uint32_t skip = track->vadLevel ? 1 : 0;
+
+    // Add any gaps
+    if (packets->preSkip[cur]) {
+        struct OggHeader gapHeader = {0};
+        uint32_t time = (track->flacRate == 44100) ? (packetTime * 147 / 160) : packetTime;
+        gapHeader.type = 0;
+        gapHeader.granulePos = packets->outputGranulePos[cur] - time * packets->preSkip[cur];
+        gapHeader.streamNo = track->streamNo;
+
+        for (int i = 0; i < packets->preSkip[cur]; i++) {
+            gapHeader.sequenceNo = track->lastSequenceNo++;
+            writeZeroPacket(track, &gapHeader);
+            gapHeader.granulePos += time;
+        }
+        oggProgress.gaps += packets->preSkip[cur];
+    }
+
+    // Then insert the current packet
+    if (!(packets->flags[cur] & FLAG_DROP)) {
+        oggHeader->granulePos = packets->outputGranulePos[cur];
+        oggHeader->sequenceNo = track->lastSequenceNo++;
+        if (track->corrector->gateSilent && (packets->flags[cur] & FLAG_SILENT) &&
+            packets->framesInPacket[cur] * packets->frameSize[cur] == packetTime)
+            writeZeroPacket(track, oggHeader);
+        else
+            emitPage(track, 0, oggHeader, buf + skip, packetSize - skip);
+        oggProgress.packets++;
+    } else {
+        oggProgress.drops++;
+    }
+}
+
+// Pass through a data page with its corrected timestamp
+static void writeData(struct OggCorrectTrack *track, struct OggHeader *oggHeader,
+               const unsigned char *buf, uint32_t packetSize)
+{
+    size_t cur = track->cur;
+
+    if (cur >= track->packets.count)
+        return;
+
+    writePacket(track, cur, oggHeader, buf, packetSize);
+
+    if (cur + 1 < track->packets.count)
+        track->cur = cur + 1;
+}
+
+// Streaming mode: keep a copy of the page for the packet just scanned
+static void keepPacket(struct OggCorrectTrack *track, const struct OggHeader *oggHeader,
+                const unsigned char *buf, uint32_t packetSize)
+{
+    struct PacketTable *packets = &track->packets;
+    size_t packet = packets->count - 1;
+
+    if (packets->dataUsed + packetSize > packets->dataSz) {
+        size_t size = packets->dataSz ? packets->dataSz * 2 : 65536;
+        unsigned char *grown;
+        while (size < packets->dataUsed + packetSize)
+            size *= 2;
+
+        // Pages we've handed out may refer to the old buffer
+        flushTrack(track);
+        grown = realloc(packets->data, size);
+        if (grown == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        packets->data = grown;
+        packets->dataSz = size;
+    }
+
+    packets->header[packet] = *oggHeader;
+    packets->dataOffset[packet] = packets->dataUsed;
+    packets->dataSize[packet] = packetSize;
+    memcpy(packets->data + packets->dataUsed, buf, packetSize);
+    packets->dataUsed += packetSize;
+}
+
+/* Streaming mode: forget the packets we've written. To keep this cheap, we
+ * only do it once they're at least half the table. */
+static void dropWritten(struct OggCorrectTrack *track)
+{
+    struct PacketTable *packets = &track->packets;
+    size_t drop = track->cur, left = packets->count - drop, base, i;
+
+    if (drop < 1024 || drop < left)
+        return;
+
+    // Pages we've handed out may refer to the data we're about to move
+    flushTrack(track);
+
+#define SHIFT(field) memmove(packets->field, packets->field + drop, left * sizeof(*packets->field))
+    SHIFT(flags);
+    SHIFT(framesInPacket);
+    SHIFT(frameSize);
+    SHIFT(preSkip);
+    SHIFT(inputGranulePos);
+    SHIFT(outputGranulePos);
+    SHIFT(header);
+    SHIFT(dataOffset);
+    SHIFT(dataSize);
+#undef SHIFT
+
+    base = left ? packets->dataOffset[0] : packets->dataUsed;
+    memmove(packets->data, packets->data + base, packets->dataUsed - base);
+    packets->dataUsed -= base;
+    for (i = 0; i < left; i++)
+        packets->dataOffset[i] -= base;
+
+    packets->count = left;
+    track->cur = 0;
+}
+
+/* Streaming mode: plan and write out every block we've seen the end of. This
+ * finds blocks just as planTrack does, which only needs to look one packet
+ * ahead, and plans each with planBlock, so the output is the same as
+ * two-pass mode so long as every block fits in the lookahead window. A block
+ * that doesn't is cut off at the window, and the rest of it is planned as a
+ * continuation. For blocks of sound, that makes no difference. For silent
+ * blocks, silence that two-pass mode would cut from the start of the whole
+ * block to make up for drift is instead cut from the start of each piece, as
+ * each piece must line up with the input by its own end.
+ * With final set, nothing more is coming, so whatever's left ends a block. */
+static void streamBlocks(struct OggCorrectTrack *track, int final)
+{
+    struct PacketTable *packets = &track->packets;
+    size_t begin, end, mid;
+
+    while ((begin = track->cur) < packets->count) {
+        unsigned char *flags = packets->flags;
+        uint64_t *inputGranulePos = packets->inputGranulePos;
+        size_t count = packets->count;
+
+        // The first block is always treated as sound, as in planTrack
+        int silent = track->started && (flags[begin] & FLAG_SILENT);
+        int continued = 0, cutOff;
+
+        if (track->cutOff) {
+            // Would planTrack have ended the last block where we cut it off?
+            if (track->cutSilent)
+                continued = silent;
+            else
+                continued = !silent &&
+                    inputGranulePos[begin] <= track->cutGranulePos + packetTime * 25;
+        }
+
+        // Look for the end of this block
+        for (end = begin; end + 1 < count; end++) {
+            if (silent) {
+                if (!(flags[end+1] & FLAG_SILENT))
+                    break;
+            } else if (flags[end+1] & FLAG_SILENT) {
+                break;
+            } else if (inputGranulePos[end+1] > inputGranulePos[end] + packetTime * 25) {
+                break;
+            }
+        }
+        cutOff = (end + 1 >= count && !final);
+        if (cutOff && inputGranulePos[end] < inputGranulePos[begin] + track->corrector->streamWindow) {
+            // We can't see the end of this block yet, so wait for more
+            break;
+        }
+        flags[begin] |= FLAG_BEGIN;
+        flags[end] |= FLAG_END;
+
+        planBlock(packets, begin, end, continued, &track->granulePos);
+        track->started = 1;
+        track->cutOff = cutOff;
+        track->cutSilent = silent;
+        track->cutGranulePos = inputGranulePos[end];
+
+        for (mid = begin; mid <= end; mid++) {
+            if (track->flacRate == 44100)
+                packets->outputGranulePos[mid] = packets->outputGranulePos[mid] * 147 / 160;
+            writePacket(track, mid, &packets->header[mid],
+                packets->data + packets->dataOffset[mid], packets->dataSize[mid]);
+        }
+        track->cur = end + 1;
+    }
+
+    dropWritten(track);
+}
+
+static void finishTrack(struct OggCorrectTrack *track)
+{
+    if (track->lastSequenceNo <= 2) {
+        // This track had no actual audio. To avoid breakage, throw some on.
+        struct OggHeader oggHeader = {0};
+        oggHeader.streamNo = track->streamNo;
+        oggHeader.sequenceNo = track->lastSequenceNo++;
+        writeZeroPacket(track, &oggHeader);
+    }
+}
+
+#define TRACK_MAP_SZ 65536
+
+int oggCorrectorInit(struct OggCorrector *corrector, double streamWindow,
+                     void (*start)(void *, struct OggCorrectTrack *),
+                     void (*page)(void *, struct OggCorrectTrack *, int,
+                                  struct OggHeader *, const unsigned char *, uint32_t),
+                     void *arg)
+{
+    memset(corrector, 0, sizeof(*corrector));
+    corrector->streamWindow = streamWindow * 48000;
+    corrector->start = start;
+    corrector->page = page;
+    corrector->arg = arg;
+    corrector->trackMap = calloc(TRACK_MAP_SZ, sizeof(int));
+    return corrector->trackMap != NULL;
+}
+
+void oggCorrectorFree(struct OggCorrector *corrector)
+{
+    int ti;
+    for (ti = 0; ti < corrector->trackCt; ti++) {
+        struct PacketTable *packets = &corrector->tracks[ti].packets;
+        free(packets->flags);
+        free(packets->framesInPacket);
+        free(packets->frameSize);
+        free(packets->preSkip);
+        free(packets->inputGranulePos);
+        free(packets->outputGranulePos);
+        free(packets->header);
+        free(packets->dataOffset);
+        free(packets->dataSize);
+        free(packets->data);
+    }
+    free(corrector->tracks);
+    free(corrector->trackMap);
+    memset(corrector, 0, sizeof(*corrector));
+}
+
+struct OggCorrectTrack *oggCorrectAddTrack(struct OggCorrector *corrector, uint32_t streamNo)
+{
+    struct OggCorrectTrack *track;
+
+    if (corrector->trackCt >= corrector->trackSz) {
+        corrector->trackSz = corrector->trackSz ? corrector->trackSz * 2 : 16;
+        corrector->tracks = realloc(corrector->tracks,
+            corrector->trackSz * sizeof(struct OggCorrectTrack));
+        if (corrector->tracks == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    track = &corrector->tracks[corrector->trackCt];
+    memset(track, 0, sizeof(*track));
+    track->corrector = corrector;
+    track->streamNo = streamNo;
+    track->packets.keepPages = !!corrector->streamWindow;
+    if (streamNo < TRACK_MAP_SZ)
+        corrector->trackMap[streamNo] = corrector->trackCt + 1;
+    corrector->trackCt++;
+    return track;
+}
+
+struct OggCorrectTrack *oggCorrectFindTrack(struct OggCorrector *corrector, uint32_t streamNo)
+{
+    int i;
+    if (streamNo < TRACK_MAP_SZ) {
+        return corrector->trackMap[streamNo] ?
+            &corrector->tracks[corrector->trackMap[streamNo] - 1] : NULL;
+    }
+    for (i = 0; i < corrector->trackCt; i++) {
+        if (corrector->tracks[i].streamNo == streamNo)
+            return &corrector->tracks[i];
+    }
+    return NULL;
+}
+
+static void startTrack(struct OggCorrectTrack *track)
+{
+    struct OggCorrector *corrector = track->corrector;
+    if (track->outStarted)
+        return;
+    track->outStarted = 1;
+    if (corrector->start)
+        corrector->start(corrector->arg, track);
+}
+
+void oggCorrect(struct OggCorrector *corrector, struct OggReader *reader)
+{
+    int ti;
+
+    // Meta track info (used for pauses)
+    int foundMeta = 0;
+    uint32_t metaStreamNo = 0;
+
+    // What should we be subtracting from our granule position?
+    uint64_t granuleOffset = 0;
+
+    // When did we last pause?
+    uint64_t pauseTime = 0;
+
+    // Size of our packet
+    uint32_t packetSize = 0;
+
+    // The current packet
+    const unsigned char *buf = NULL;
+    int more = 1;
+
+    // Header
+    struct OggHeader oggHeader = {0};
+
+    if (corrector->streamWindow) {
+        // We write as we go, so get our outputs ready now
+        for (ti = 0; ti < corrector->trackCt; ti++)
+            startTrack(&corrector->tracks[ti]);
+    }
+
+    // First look for the header info
+    while (readOgg(reader, &oggHeader, &buf, &packetSize)) {
+        struct OggCorrectTrack *track;
+
+        if (oggHeader.granulePos != 0) {
+            // Not a header
+            granuleOffset = oggHeader.granulePos;
+            break;
+        }
+
+        // Look for a meta track
+        if (!foundMeta && packetSize >= 8 && !memcmp(buf, "ECMETA", 6)) {
+            foundMeta = 1;
+            metaStreamNo = oggHeader.streamNo;
+        }
+
+        track = oggCorrectFindTrack(corrector, oggHeader.streamNo);
+        if (!track && corrector->allTracks) {
+            // Any stream with an audio header is a track to keep
+            struct OggCorrectTrack newTrack = {0};
+            if (!scanHeader(&newTrack, buf, packetSize))
+                continue;
+            track = oggCorrectAddTrack(corrector, oggHeader.streamNo);
+        }
+        if (!track)
+            continue;
+
+        scanHeader(track, buf, packetSize);
+
+        if (corrector->streamWindow) {
+            startTrack(track);
+            writeHeader(track, &oggHeader, buf, packetSize);
+        }
+    }
+
+    // Now get the actual packet info
+    do {
+        struct OggCorrectTrack *track;
+
+        if (oggHeader.granulePos == 0 && packetSize > 1) {
+            // We've come back to the header, so break out
+            break;
+        }
+
+        // Check for pauses and adjust
+        if (foundMeta && oggHeader.streamNo == metaStreamNo) {
+            if (!strncmp((char *) buf, "{\"c\":\"pause\"}", packetSize)) {
+                // Start of pause
+                pauseTime = oggHeader.granulePos;
+            } else if (!strncmp((char *) buf, "{\"c\":\"resume\"}", packetSize)) {
+                // End of pause
+                granuleOffset += oggHeader.granulePos - pauseTime;
+            }
+        }
+
+        if (packetSize <= 1)
+            continue;
+        track = oggCorrectFindTrack(corrector, oggHeader.streamNo);
+        if (!track)
+            continue;
+
+        // Add it to the list
+        scanPacket(track,
+            (oggHeader.granulePos > granuleOffset) ? oggHeader.granulePos - granuleOffset : 0,
+            buf, packetSize);
+
+        if (corrector->streamWindow) {
+            keepPacket(track, &oggHeader, buf, packetSize);
+            streamBlocks(track, 0);
+        }
+
+    } while ((more = readOgg(reader, &oggHeader, &buf, &packetSize)));
+
+    if (corrector->streamWindow) {
+        // Write out whatever's left, and we're done with the input
+        for (ti = 0; ti < corrector->trackCt; ti++)
+            streamBlocks(&corrector->tracks[ti], 1);
+        goto finish;
+    }
+
+    for (ti = 0; ti < corrector->trackCt; ti++)
+        planTrack(&corrector->tracks[ti]);
+
+    /* If we were handed the input only once, we ran out instead of coming back
+     * around to the header, so go back to the start ourselves. A pipe can't
+     * do that, and needs the whole input sent twice. */
+    if (!more && oggReaderSeek(reader, 0, 1))
+        readOgg(reader, &oggHeader, &buf, &packetSize);
+
+    for (ti = 0; ti < corrector->trackCt; ti++)
+        startTrack(&corrector->tracks[ti]);
+
+    // Now read and pass thru the header
+    do {
+        struct OggCorrectTrack *track;
+
+        if (oggHeader.granulePos != 0) {
+            // Passed the header
+            break;
+        }
+
+        track = oggCorrectFindTrack(corrector, oggHeader.streamNo);
+        if (!track)
+            continue;
+
+        writeHeader(track, &oggHeader, buf, packetSize);
+
+    } while (readOgg(reader, &oggHeader, &buf, &packetSize));
+
+    // And finally, pass thru the data with corrected timestamps
+    do {
+        struct OggCorrectTrack *track;
+
+        if (packetSize <= 1)
+            continue;
+        track = oggCorrectFindTrack(corrector, oggHeader.streamNo);
+        if (!track)
+            continue;
+
+        writeData(track, &oggHeader, buf, packetSize);
+
+    } while (readOgg(reader, &oggHeader, &buf, &packetSize));
+
+finish:
+    for (ti = 0; ti < corrector->trackCt; ti++)
+        finishTrack(&corrector->tracks[ti]);
+}
+
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OGGCORR_H
+#define OGGCORR_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "oggpage.h"
+
+/* Timestamp correction for recorded tracks, as done by oggcorrect: gaps are
+ * filled with silence, and excess silence and overlapping data are dropped,
+ * so that each track plays back in step with the others. The corrected pages
+ * are handed to a callback rather than written, so that they can be written
+ * out (as by oggcorrect) or decoded (as by cookengine). */
+
+/* Everything we know about a track's packets, in separate arrays, so that the
+ * passes over them only touch the fields they need. Indexed by packet number
+ * within the track. */
+struct PacketTable {
+    size_t count, size;
+    unsigned char *flags;
+    unsigned char *framesInPacket; // Number of audio frames in this packet
+    uint16_t *frameSize; // Size of frame
+    int32_t *preSkip; // Number of frames to insert before this
+    uint64_t *inputGranulePos;
+    uint64_t *outputGranulePos;
+
+    /* In streaming mode, we can't go back to the input for the pages, so we
+     * keep them ourselves: each page's header, and its data in one buffer */
+    int keepPages;
+    struct OggHeader *header;
+    size_t *dataOffset;
+    uint32_t *dataSize;
+    unsigned char *data;
+    size_t dataUsed, dataSz;
+};
+
+struct OggCorrector;
+
+// Everything we know about one track we're correcting
+struct OggCorrectTrack {
+    struct OggCorrector *corrector;
+    uint32_t streamNo;
+
+    // Whatever the caller keeps for this track's output, and is it started?
+    void *out;
+    int outStarted;
+
+    // VAD info if applicable
+    unsigned char vadLevel;
+
+    // Sample rate if we're doing FLAC
+    uint32_t flacRate;
+
+    // Our packets, and the one we're writing
+    struct PacketTable packets;
+    size_t cur;
+
+    /* In streaming mode, our working granule position, have we started, and
+     * was the last block cut off (and if so, what was it)? */
+    double granulePos;
+    int started, cutOff, cutSilent;
+    uint64_t cutGranulePos;
+
+    // What was the sequence number of the last packet we wrote?
+    uint32_t lastSequenceNo;
+};
+
+struct OggCorrector {
+    /* In streaming mode, how far we may look ahead for the end of a block, in
+     * granules. 0 for two-pass mode. */
+    uint64_t streamWindow;
+
+    // Keep any stream with an audio header, not just the tracks added
+    int allTracks;
+
+    /* Write packets that we judge silent (by VAD, or their size) as true
+     * silence, so that whatever reads them can tell they're silent */
+    int gateSilent;
+
+    // Called before a track's first page is output
+    void (*start)(void *arg, struct OggCorrectTrack *track);
+
+    /* Called with each page of output, header set for header pages. The data
+     * may be from the reader's buffer or our own, so it only stays put until
+     * the reader's next refill, or the next call to flush for this track. */
+    void (*page)(void *arg, struct OggCorrectTrack *track, int header,
+                 struct OggHeader *oggHeader, const unsigned char *data,
+                 uint32_t size);
+
+    // Optional, called when data passed to page is about to move
+    void (*flush)(void *arg, struct OggCorrectTrack *track);
+
+    void *arg;
+
+    // All the tracks we're correcting, and a map to find them by stream number
+    struct OggCorrectTrack *tracks;
+    int trackCt, trackSz;
+    int *trackMap;
+};
+
+/* Set up a corrector. streamWindow is in seconds, or 0 for two-pass mode.
+ * Returns 0 on failure. */
+int oggCorrectorInit(struct OggCorrector *corrector, double streamWindow,
+                     void (*start)(void *, struct OggCorrectTrack *),
+                     void (*page)(void *, struct OggCorrectTrack *, int,
+                                  struct OggHeader *, const unsigned char *, uint32_t),
+                     void *arg);
+
+void oggCorrectorFree(struct OggCorrector *corrector);
+
+/* Add a track to correct. The pointer is only good until the next track is
+ * added. */
+struct OggCorrectTrack *oggCorrectAddTrack(struct OggCorrector *corrector, uint32_t streamNo);
+
+struct OggCorrectTrack *oggCorrectFindTrack(struct OggCorrector *corrector, uint32_t streamNo);
+
+/* Correct everything from this reader. In two-pass mode, the reader must
+ * either be seekable or give the whole input twice. */
+void oggCorrect(struct OggCorrector *corrector, struct OggReader *reader);
+
+#endif
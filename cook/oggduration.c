@@ -14,97 +14,346 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-/* NOTE: We don't use libogg here because the behavior of this program is so
- * trivial, the added memory bandwidth of using it is just a waste of energy */
+#include "crc32.h"
+#include "oggidx.h"
+#include "oggpage.h"
 
-/* NOTE: This program assumes little-endian for speed, it WILL NOT WORK on a
- * big-endian system */
+#define HEADER_SZ (sizeof(struct OggPreHeader) + sizeof(struct OggHeader))
 
-struct OggPreHeader {
-    unsigned char capturePattern[4];
-    unsigned char version;
-} __attribute__((packed));
+/* Packets from different users can reach the data file a little out of order,
+ * so when scanning from the end, keep going until we're this far (in granules)
+ * behind the latest time we've seen */
+#define TAIL_MARGIN (48000 * 10)
 
-struct OggHeader {
-    unsigned char type;
-    uint64_t granulePos;
+/* If the page at this offset is complete and its CRC checks out, return its
+ * length, else 0 */
+static uint32_t validPage(const unsigned char *map, uint64_t size, uint64_t off)
+{
+    static const unsigned char zeroCrc[4] = {0};
+    const unsigned char *base = map + off;
+    const struct OggHeader *header;
+    unsigned char segmentCount;
+    uint32_t len, i, crc;
+
+    if (size - off < HEADER_SZ + 1 || memcmp(base, "OggS", 4))
+        return 0;
+    segmentCount = base[HEADER_SZ];
+    len = HEADER_SZ + 1 + segmentCount;
+    if (size - off < len)
+        return 0;
+    for (i = 0; i < segmentCount; i++)
+        len += base[HEADER_SZ + 1 + i];
+    if (size - off < len)
+        return 0;
+
+    header = (const struct OggHeader *) (base + sizeof(struct OggPreHeader));
+    crc = 0;
+    crc32(base, HEADER_SZ - 4, &crc);
+    crc32(zeroCrc, 4, &crc);
+    crc32(base + HEADER_SZ, len - HEADER_SZ, &crc);
+    if (crc != header->crc)
+        return 0;
+    return len;
+}
+
+/* Find the duration by reading backwards from the end of a regular file,
+ * which is all we need to do for a well-formed recording. Returns 0 if the
+ * file isn't one we can do this with, or doesn't look well-formed, in which
+ * case the caller should scan the whole thing. */
+static int tailScan(const char *path, int32_t streamNo, uint64_t *granulePos)
+{
+    struct stat sbuf;
+    const unsigned char *map;
+    uint64_t size, end, off, best = 0;
+    int fd, found = 0, ret = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &sbuf) != 0 || !S_ISREG(sbuf.st_mode) || sbuf.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    size = sbuf.st_size;
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+    madvise((void *) map, size, MADV_RANDOM);
+
+    /* Find the last complete page. Anything after it has to be a page that's
+     * still being written. */
+    end = size;
+    for (off = size; off-- > 0;) {
+        uint32_t len;
+        if (size - off > 2 * OGG_MAX_PAGE_SIZE)
+            goto out;
+        len = validPage(map, size, off);
+        if (!len)
+            continue;
+        if (off + len == size ||
+            (size - off - len >= 4 && !memcmp(map + off + len, "OggS", 4)) ||
+            (size - off - len < 4 && !memcmp(map + off + len, "OggS", size - off - len))) {
+            end = off + len;
+            break;
+        }
+    }
+    if (end == size && off == (uint64_t) -1)
+        goto out;
+
+    /* Now work backwards page by page. Each page has to end exactly where the
+     * one after it starts, or something's corrupt. */
+    while (end > 0) {
+        const struct OggHeader *header;
+        uint32_t len = 0;
+
+        for (off = end; off-- > 0;) {
+            if (end - off > OGG_MAX_PAGE_SIZE)
+                goto out;
+            len = validPage(map, size, off);
+            if (len && off + len == end)
+                break;
+        }
+        if (off == (uint64_t) -1)
+            goto out;
+
+        header = (const struct OggHeader *) (map + off + sizeof(struct OggPreHeader));
+        end = off;
+
+        // Zero-size pages are timestamp references, so don't count
+        if (len == HEADER_SZ + 1 + map[off + HEADER_SZ])
+            continue;
+        if (streamNo >= 0 && header->streamNo != streamNo)
+            continue;
+
+        if (!found || header->granulePos > best) {
+            best = header->granulePos;
+            found = 1;
+        } else if (header->granulePos + TAIL_MARGIN <= best) {
+            // Well behind, so nothing earlier should be later than this
+            break;
+        }
+    }
+
+    *granulePos = best;
+    ret = 1;
+
+out:
+    munmap((void *) map, size);
+    return ret;
+}
+
+// Every stream's duration, for --all
+struct StreamDuration {
     uint32_t streamNo;
-    uint32_t sequenceNo;
-    uint32_t crc;
-} __attribute__((packed));
+    uint64_t granulePos;
+    uint64_t bytes;
+};
+
+#define STREAM_MAP_SZ 65536
+static struct StreamDuration *streams = NULL;
+static int streamCt = 0, streamSz = 0;
+static int streamMap[STREAM_MAP_SZ];
+
+static struct StreamDuration *getStream(uint32_t streamNo)
+{
+    struct StreamDuration *stream;
+    int i;
+
+    if (streamNo < STREAM_MAP_SZ) {
+        if (streamMap[streamNo])
+            return &streams[streamMap[streamNo] - 1];
+    } else {
+        for (i = 0; i < streamCt; i++) {
+            if (streams[i].streamNo == streamNo)
+                return &streams[i];
+        }
+    }
+
+    if (streamCt >= streamSz) {
+        streamSz = streamSz ? streamSz * 2 : 64;
+        streams = realloc(streams, streamSz * sizeof(*streams));
+        if (!streams) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    stream = &streams[streamCt++];
+    stream->streamNo = streamNo;
+    stream->granulePos = 0;
+    stream->bytes = 0;
+    if (streamNo < STREAM_MAP_SZ)
+        streamMap[streamNo] = streamCt;
+    return stream;
+}
 
-ssize_t readAll(int fd, void *vbuf, size_t count)
+static int cmpStreams(const void *l, const void *r)
 {
-    unsigned char *buf = (unsigned char *) vbuf;
-    ssize_t rd = 0, ret;
-    while (rd < count) {
-        ret = read(fd, buf + rd, count - rd);
-        if (ret <= 0) return ret;
-        rd += ret;
+    uint32_t ls = ((const struct StreamDuration *) l)->streamNo;
+    uint32_t rs = ((const struct StreamDuration *) r)->streamNo;
+    return (ls > rs) - (ls < rs);
+}
+
+/* Print a line per stream and then the overall maximum, as
+ * stream<tab>granule position<tab>duration<tab>bytes, with * as the stream for
+ * the maximum (and the total bytes). The bytes are of packet data, as a
+ * measure of how much work the stream is. This takes one pass at most. */
+static void printAll(int files, char **paths)
+{
+    struct OggIndex index;
+    struct OggReader reader;
+    struct OggPage page;
+    uint64_t maxGranulePos = 0, totalBytes = 0;
+    int i;
+
+    if (files == 1 && strcmp(paths[0], "-") && oggIndexOpen(&index, paths[0])) {
+        uint32_t si;
+        for (si = 0; si < index.header.streamCt; si++) {
+            struct StreamDuration *stream = getStream(index.streams[si].streamNo);
+            stream->granulePos = index.streams[si].maxGranule;
+            stream->bytes = index.streams[si].bytes;
+        }
+        oggIndexFree(&index);
+
+    } else {
+        if (!oggReaderOpen(&reader, files, paths)) {
+            perror("open");
+            exit(1);
+        }
+        oggProgressAddReader(&reader);
+
+        while (oggReadPage(&reader, &page)) {
+            struct StreamDuration *stream = getStream(page.header->streamNo);
+
+            // Timestamp references don't count
+            if (page.size == 0)
+                continue;
+            stream->bytes += page.size;
+            oggProgress.packets++;
+
+            if (page.header->granulePos > stream->granulePos)
+                stream->granulePos = page.header->granulePos;
+        }
+
+    }
+
+    qsort(streams, streamCt, sizeof(*streams), cmpStreams);
+    for (i = 0; i < streamCt; i++) {
+        printf("%u\t%llu\t%f\t%llu\n", streams[i].streamNo,
+               (unsigned long long) streams[i].granulePos,
+               ((double) streams[i].granulePos)/48000.0+2,
+               (unsigned long long) streams[i].bytes);
+        if (streams[i].granulePos > maxGranulePos)
+            maxGranulePos = streams[i].granulePos;
+        totalBytes += streams[i].bytes;
     }
-    return rd;
+    printf("*\t%llu\t%f\t%llu\n", (unsigned long long) maxGranulePos,
+           ((double) maxGranulePos)/48000.0+2, (unsigned long long) totalBytes);
+    oggProgress.granulePos = maxGranulePos;
+}
+
+// Print the duration, and report that we're done
+static void printDuration(uint64_t lastGranulePos)
+{
+    printf("%f\n", ((double) lastGranulePos)/48000.0+2);
+    oggProgress.granulePos = lastGranulePos;
+    oggProgressDone();
+}
+
+static void usage()
+{
+    fprintf(stderr, "Use: oggduration [--progress-fd <fd>] [--all|--stream <stream no>] [--] [input files]\n"
+                    "Prints the duration of the input, in seconds, or of only the given\n"
+                    "stream. With --all, prints every stream's, and the overall, as\n"
+                    "stream<tab>granule position<tab>duration<tab>bytes.\n"
+                    "With no input files, the input is read from stdin.\n");
+    exit(1);
 }
 
 int main(int argc, char **argv)
 {
     int32_t streamNo = -1;
     uint64_t lastGranulePos = 0;
-    uint32_t packetSize;
-    unsigned char segmentCount, segmentVal;
-    unsigned char buf[1024];
-    const uint32_t bufSz = 1024;
-    struct OggPreHeader preHeader;
-
-    if (argc >= 2)
-        streamNo = atoi(argv[1]);
-
-    while (readAll(0, &preHeader, sizeof(preHeader)) == sizeof(preHeader)) {
-        struct OggHeader oggHeader;
-        if (memcmp(preHeader.capturePattern, "OggS", 4))
-            break;
+    struct OggReader reader;
+    struct OggPage page;
+    struct OggIndex index;
+    int all = 0, ai, files;
+    char **paths;
 
-        // It's an ogg header, get the header data
-        if (readAll(0, &oggHeader, sizeof(oggHeader)) != sizeof(oggHeader))
+    oggProgressArgs(&argc, argv, "oggduration");
+    for (ai = 1; ai < argc && argv[ai][0] == '-' && argv[ai][1]; ai++) {
+        if (!strcmp(argv[ai], "--")) {
+            ai++;
             break;
+        } else if (!strcmp(argv[ai], "--all")) {
+            all = 1;
+        } else if (!strcmp(argv[ai], "--stream") && ai + 1 < argc) {
+            streamNo = atoi(argv[++ai]);
+        } else {
+            usage();
+        }
+    }
+    files = argc - ai;
+    paths = argv + ai;
 
-        // Get the data size
-        packetSize = 0;
-        if (readAll(0, &segmentCount, 1) != 1)
-            break;
-        for (; segmentCount; segmentCount--) {
-            if (readAll(0, &segmentVal, 1) != 1)
-                break;
-            packetSize += (uint32_t) segmentVal;
+    if (all) {
+        printAll(files, paths);
+        oggProgressDone();
+        return 0;
+    }
+
+    // With an up-to-date index, we don't need to read the data at all
+    if (files == 1 && strcmp(paths[0], "-") && oggIndexOpen(&index, paths[0])) {
+        uint32_t i;
+        for (i = 0; i < index.header.streamCt; i++) {
+            if (streamNo >= 0 && index.streams[i].streamNo != streamNo)
+                continue;
+            if (index.streams[i].maxGranule > lastGranulePos)
+                lastGranulePos = index.streams[i].maxGranule;
         }
+        printDuration(lastGranulePos);
+        return 0;
+    }
+
+    // Otherwise, the end of the data should tell us
+    if (files == 1 && strcmp(paths[0], "-") && tailScan(paths[0], streamNo, &lastGranulePos)) {
+        printDuration(lastGranulePos);
+        return 0;
+    }
+
+    // And if all else fails, read the whole thing
+    if (!oggReaderOpen(&reader, files, paths)) {
+        perror("open");
+        exit(1);
+    }
+    oggProgressAddReader(&reader);
+
+    while (oggReadPage(&reader, &page)) {
+        const struct OggHeader *oggHeader = page.header;
 
         // If it's zero-size, skip it entirely (timestamp reference)
-        if (packetSize == 0)
+        if (page.size == 0)
             continue;
 
-        // Skip the data
-        while (packetSize > bufSz) {
-            if (readAll(0, buf, bufSz) != bufSz)
-                break;
-            packetSize -= bufSz;
-        }
-        if (readAll(0, buf, packetSize) != packetSize)
-            break;
-
-        if (streamNo >= 0 && oggHeader.streamNo != streamNo)
+        if (streamNo >= 0 && oggHeader->streamNo != streamNo)
             continue;
 
-        if (oggHeader.granulePos > lastGranulePos)
-            lastGranulePos = oggHeader.granulePos;
+        if (oggHeader->granulePos > lastGranulePos)
+            lastGranulePos = oggHeader->granulePos;
+        oggProgress.packets++;
     }
 
-    printf("%f\n", ((double) lastGranulePos)/48000.0+2);
+    printDuration(lastGranulePos);
 
     return 0;
 }
@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "oggidx.h"
+
+// Stream numbers below this are found with a direct map while indexing
+#define STREAM_MAP_SZ 65536
+
+char *oggIndexPath(const char *dataPath)
+{
+    size_t len = strlen(dataPath);
+    char *ret = malloc(len + 7);
+    if (!ret)
+        return NULL;
+    strcpy(ret, dataPath);
+    if (len > 5 && !strcmp(ret + len - 5, ".data"))
+        len -= 5;
+    strcpy(ret + len, ".index");
+    return ret;
+}
+
+void oggIndexInit(struct OggIndex *index)
+{
+    memset(index, 0, sizeof(*index));
+    memcpy(index->header.magic, OGG_INDEX_MAGIC, sizeof(index->header.magic));
+    index->header.version = OGG_INDEX_VERSION;
+}
+
+void oggIndexFree(struct OggIndex *index)
+{
+    free(index->streams);
+    memset(index, 0, sizeof(*index));
+}
+
+// Read exactly this much, or fail
+static int readFull(int fd, void *vbuf, size_t count)
+{
+    unsigned char *buf = (unsigned char *) vbuf;
+    ssize_t rd;
+    while (count) {
+        rd = read(fd, buf, count);
+        if (rd < 0 && errno == EINTR)
+            continue;
+        if (rd <= 0) {
+            if (rd == 0)
+                errno = EINVAL;
+            return 0;
+        }
+        buf += rd;
+        count -= rd;
+    }
+    return 1;
+}
+
+static int writeFull(int fd, const void *vbuf, size_t count)
+{
+    const unsigned char *buf = (const unsigned char *) vbuf;
+    ssize_t wt;
+    while (count) {
+        wt = write(fd, buf, count);
+        if (wt < 0 && errno == EINTR)
+            continue;
+        if (wt <= 0)
+            return 0;
+        buf += wt;
+        count -= wt;
+    }
+    return 1;
+}
+
+// Make room for this many streams
+static int allocStreams(struct OggIndex *index, uint32_t count)
+{
+    struct OggIndexStream *streams = realloc(index->streams, count * sizeof(*streams));
+    if (!streams)
+        return 0;
+    index->streams = streams;
+    return 1;
+}
+
+int oggIndexLoad(struct OggIndex *index, const char *path)
+{
+    int fd;
+
+    memset(index, 0, sizeof(*index));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    if (!readFull(fd, &index->header, sizeof(index->header)))
+        goto fail;
+    if (memcmp(index->header.magic, OGG_INDEX_MAGIC, sizeof(index->header.magic)) ||
+        index->header.version != OGG_INDEX_VERSION ||
+        index->header.streamCt > STREAM_MAP_SZ) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    if (index->header.streamCt) {
+        if (!allocStreams(index, index->header.streamCt))
+            goto fail;
+        if (!readFull(fd, index->streams,
+                      index->header.streamCt * sizeof(*index->streams)))
+            goto fail;
+    }
+
+    close(fd);
+    return 1;
+
+fail:
+    {
+        int err = errno;
+        close(fd);
+        free(index->streams);
+        memset(index, 0, sizeof(*index));
+        errno = err;
+    }
+    return 0;
+}
+
+int oggIndexFresh(const struct OggIndex *index, int dataFd)
+{
+    struct stat sbuf;
+    if (fstat(dataFd, &sbuf) != 0)
+        return 0;
+    return index->header.dataSize == (uint64_t) sbuf.st_size &&
+           index->header.dataMtime == sbuf.st_mtim.tv_sec &&
+           index->header.dataMtimeNsec == sbuf.st_mtim.tv_nsec;
+}
+
+int oggIndexOpen(struct OggIndex *index, const char *dataPath)
+{
+    char *path;
+    int fd, ret = 0;
+
+    path = oggIndexPath(dataPath);
+    if (!path)
+        return 0;
+    if (oggIndexLoad(index, path)) {
+        fd = open(dataPath, O_RDONLY);
+        if (fd >= 0) {
+            ret = oggIndexFresh(index, fd);
+            close(fd);
+        }
+        if (!ret)
+            oggIndexFree(index);
+    }
+    free(path);
+    return ret;
+}
+
+struct OggIndexStream *oggIndexStream(const struct OggIndex *index, uint32_t streamNo)
+{
+    uint32_t i;
+    for (i = 0; i < index->header.streamCt; i++) {
+        if (index->streams[i].streamNo == streamNo)
+            return &index->streams[i];
+    }
+    return NULL;
+}
+
+// Forget everything we've indexed
+static void resetIndex(struct OggIndex *index)
+{
+    oggIndexFree(index);
+    oggIndexInit(index);
+}
+
+int oggIndexUpdate(struct OggIndex *index, int dataFd)
+{
+    struct stat sbuf;
+    struct OggReader reader;
+    struct OggPage page;
+    uint32_t *streamMap = NULL;
+    uint32_t i;
+    int ret = 0;
+
+    if (fstat(dataFd, &sbuf) != 0)
+        return 0;
+
+    /* We can only carry on if the data has just been appended to, so make sure
+     * it hasn't shrunk and there's still a page where we left off */
+    if (index->header.scannedTo) {
+        int resume = ((uint64_t) sbuf.st_size >= index->header.dataSize &&
+                      (uint64_t) sbuf.st_size >= index->header.scannedTo);
+        if (resume && (uint64_t) sbuf.st_size > index->header.scannedTo) {
+            unsigned char capture[4];
+            resume = (pread(dataFd, capture, 4, index->header.scannedTo) == 4 &&
+                      !memcmp(capture, "OggS", 4));
+        }
+        if (!resume)
+            resetIndex(index);
+    }
+
+    streamMap = calloc(STREAM_MAP_SZ, sizeof(uint32_t));
+    if (!streamMap)
+        return 0;
+    for (i = 0; i < index->header.streamCt; i++) {
+        if (index->streams[i].streamNo < STREAM_MAP_SZ)
+            streamMap[index->streams[i].streamNo] = i + 1;
+    }
+
+    if (!oggReaderInit(&reader, dataFd))
+        goto out;
+    if (index->header.scannedTo &&
+        !oggReaderSeek(&reader, index->header.scannedTo, 1))
+        goto outReader;
+
+    while (oggReadPage(&reader, &page)) {
+        const struct OggHeader *oggHeader = page.header;
+        struct OggIndexStream *stream = NULL;
+        uint32_t si;
+
+        // Find the stream
+        if (oggHeader->streamNo < STREAM_MAP_SZ) {
+            si = streamMap[oggHeader->streamNo];
+            if (si)
+                stream = &index->streams[si - 1];
+        } else {
+            stream = oggIndexStream(index, oggHeader->streamNo);
+        }
+        if (!stream) {
+            // A new stream
+            si = index->header.streamCt;
+            if (si >= STREAM_MAP_SZ || !allocStreams(index, si + 1))
+                goto outReader;
+            stream = &index->streams[si];
+            memset(stream, 0, sizeof(*stream));
+            stream->streamNo = oggHeader->streamNo;
+            stream->firstGranule = oggHeader->granulePos;
+            stream->firstOffset = page.offset;
+            index->header.streamCt++;
+            if (oggHeader->streamNo < STREAM_MAP_SZ)
+                streamMap[oggHeader->streamNo] = si + 1;
+
+        }
+
+        stream->pageCt++;
+        for (i = 0; i < page.segmentCount; i++) {
+            if (page.segments[i] < 255)
+                stream->packetCt++;
+        }
+        stream->bytes += page.size;
+        stream->lastOffset = page.offset;
+
+        // Empty pages are just timestamp references, so don't count for time
+        if (page.size && oggHeader->granulePos > stream->maxGranule)
+            stream->maxGranule = oggHeader->granulePos;
+
+        index->header.scannedTo = page.offset + sizeof(struct OggPreHeader) +
+            (page.data - (const unsigned char *) oggHeader) + page.size;
+    }
+
+    index->header.dataSize = sbuf.st_size;
+    index->header.dataMtime = sbuf.st_mtim.tv_sec;
+    index->header.dataMtimeNsec = sbuf.st_mtim.tv_nsec;
+    ret = 1;
+
+outReader:
+    oggReaderFree(&reader);
+out:
+    free(streamMap);
+    return ret;
+}
+
+int oggIndexSave(const struct OggIndex *index, const char *path)
+{
+    char *tmpPath;
+    int fd, err;
+
+    tmpPath = malloc(strlen(path) + 32);
+    if (!tmpPath)
+        return 0;
+    sprintf(tmpPath, "%s.%d.tmp", path, (int) getpid());
+
+    fd = open(tmpPath, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd < 0)
+        goto fail;
+
+    if (!writeFull(fd, &index->header, sizeof(index->header)) ||
+        !writeFull(fd, index->streams,
+                   index->header.streamCt * sizeof(*index->streams)))
+        goto failFd;
+    if (close(fd) != 0) {
+        fd = -1;
+        goto failFd;
+    }
+
+    if (rename(tmpPath, path) != 0) {
+        fd = -1;
+        goto failFd;
+    }
+    free(tmpPath);
+    return 1;
+
+failFd:
+    err = errno;
+    if (fd >= 0)
+        close(fd);
+    unlink(tmpPath);
+    errno = err;
+fail:
+    err = errno;
+    free(tmpPath);
+    errno = err;
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OGGIDX_H
+#define OGGIDX_H 1
+
+#include <stdint.h>
+
+#include "oggpage.h"
+
+/* The index (.ogg.index) is a summary of a recording's .ogg.data, so that
+ * questions like its duration don't need a scan of the whole thing. On disk
+ * it's an OggIndexHeader, then streamCt OggIndexStreams, all little-endian
+ * like the pages themselves.
+ *
+ * There are no seek points by time: every reader of the data reads it from the
+ * start (the corrector needs every stream's pages, for the meta stream's pauses
+ * and the timing of the rest), so nothing would use them. A reader that starts
+ * partway thru a recording would need them added, under a new version.
+ */
+
+#define OGG_INDEX_MAGIC "CrgOggIx"
+#define OGG_INDEX_VERSION 2
+
+struct OggIndexHeader {
+    unsigned char magic[8];
+    uint32_t version;
+    uint32_t streamCt;
+
+    // The data file as it was when we indexed it, to check freshness
+    uint64_t dataSize;
+    int64_t dataMtime, dataMtimeNsec;
+
+    // Everything before this offset is indexed
+    uint64_t scannedTo;
+} __attribute__((packed));
+
+struct OggIndexStream {
+    uint32_t streamNo;
+    uint64_t pageCt, packetCt;
+    uint64_t bytes; // Total packet data, not including page headers
+    uint64_t firstGranule; // Of the first page
+    uint64_t maxGranule; // Of any page with data (as oggduration)
+    uint64_t firstOffset, lastOffset; // Of the first and last pages
+} __attribute__((packed));
+
+struct OggIndex {
+    struct OggIndexHeader header;
+    struct OggIndexStream *streams;
+};
+
+/* The index path for this data file: foo.ogg.data becomes foo.ogg.index.
+ * Returns a malloc'd string, or NULL on failure. */
+char *oggIndexPath(const char *dataPath);
+
+// Start an empty index
+void oggIndexInit(struct OggIndex *index);
+
+/* Load an index. Returns 1 on success, or 0 if it doesn't exist or isn't a
+ * valid index, with errno set. */
+int oggIndexLoad(struct OggIndex *index, const char *path);
+
+/* Returns 1 if the index covers the whole of this data file as it is now,
+ * judged by size and modification time. */
+int oggIndexFresh(const struct OggIndex *index, int dataFd);
+
+/* Load the index for this data file, only if it exists and is fresh. Returns 1
+ * if so. This is what readers should use. */
+int oggIndexOpen(struct OggIndex *index, const char *dataPath);
+
+/* Index anything in the data file past what's already indexed. If the data
+ * file doesn't look like it's just been appended to since the index was made,
+ * start over. Returns 0 on failure. */
+int oggIndexUpdate(struct OggIndex *index, int dataFd);
+
+// Save an index, atomically replacing what's there. Returns 0 on failure.
+int oggIndexSave(const struct OggIndex *index, const char *path);
+
+void oggIndexFree(struct OggIndex *index);
+
+// Find a stream in the index, or NULL if it has no pages
+struct OggIndexStream *oggIndexStream(const struct OggIndex *index, uint32_t streamNo);
+
+#endif
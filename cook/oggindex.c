@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "oggidx.h"
+
+int main(int argc, char **argv)
+{
+    const char *dataPath;
+    char *indexPath;
+    struct OggIndex index;
+    int dataFd;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Use: oggindex <data file> [index file]\n"
+                        "The index defaults to the data file with .data replaced by .index.\n"
+                        "An existing index is brought up to date, not rebuilt.\n");
+        exit(1);
+    }
+    dataPath = argv[1];
+    if (argc > 2) {
+        indexPath = strdup(argv[2]);
+    } else {
+        indexPath = oggIndexPath(dataPath);
+    }
+    if (!indexPath) {
+        perror("malloc");
+        exit(1);
+    }
+
+    dataFd = open(dataPath, O_RDONLY);
+    if (dataFd < 0) {
+        perror(dataPath);
+        exit(1);
+    }
+
+    // Start from the existing index if there is one
+    if (!oggIndexLoad(&index, indexPath))
+        oggIndexInit(&index);
+
+    if (!oggIndexUpdate(&index, dataFd)) {
+        perror(dataPath);
+        exit(1);
+    }
+
+    if (!oggIndexSave(&index, indexPath)) {
+        perror(indexPath);
+        exit(1);
+    }
+
+    return 0;
+}
@@ -22,79 +22,23 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-/* NOTE: We don't use libogg here because the behavior of this program is so
- * trivial, the added memory bandwidth of using it is just a waste of energy */
-
-/* NOTE: This program assumes little-endian for speed, it WILL NOT WORK on a
- * big-endian system */
-
-struct OggPreHeader {
-    unsigned char capturePattern[4];
-    unsigned char version;
-} __attribute__((packed));
-
-struct OggHeader {
-    unsigned char type;
-    uint64_t granulePos;
-    uint32_t streamNo;
-    uint32_t sequenceNo;
-    uint32_t crc;
-} __attribute__((packed));
-
-ssize_t readAll(int fd, void *vbuf, size_t count)
-{
-    unsigned char *buf = (unsigned char *) vbuf;
-    ssize_t rd = 0, ret;
-    while (rd < count) {
-        ret = read(fd, buf + rd, count - rd);
-        if (ret <= 0) return ret;
-        rd += ret;
-    }
-    return rd;
-}
-
-void writeOgg(struct OggHeader *header, const unsigned char *data, uint32_t size)
-{
-    unsigned char sequencePart;
-    uint32_t sizeMod;
-
-    if (write(1, "OggS\0", 5) != 5 ||
-        write(1, header, sizeof(*header)) != sizeof(*header))
-        exit(1);
-
-    // Write out the sequence info
-    sequencePart = (size+255)/255;
-    if (write(1, &sequencePart, 1) != 1) exit(1);
-    sequencePart = 255;
-    sizeMod = size;
-    while (sizeMod >= 255) {
-        if (write(1, &sequencePart, 1) != 1) exit(1);
-        sizeMod -= 255;
-    }
-    sequencePart = sizeMod;
-    if (write(1, &sequencePart, 1) != 1) exit(1);
-
-    // Then write the data
-    if (write(1, data, size) != size) exit(1);
-}
+#include "oggpage.h"
+#include "oggwrite.h"
 
 int main(int argc, char **argv)
 {
-    uint32_t packetSize;
     uint64_t pos;
-    unsigned char segmentCount, segmentVal;
-    unsigned char *buf = NULL;
-    uint32_t bufSz = 0;
-    struct OggPreHeader preHeader;
 
     int files, fi;
-    int *infiles;
-    struct OggHeader *headers;
+    struct OggReader *readers;
+    struct OggPage *pages;
+    struct OggWriter writer;
     int *alive;
     int *used;
 
+    oggProgressArgs(&argc, argv, "oggmultiplexer");
     if (argc < 2) {
-        fprintf(stderr, "Use: oggmultiplexer <tracks>\n");
+        fprintf(stderr, "Use: oggmultiplexer [--progress-fd <fd>] <tracks>\n");
         exit(1);
     }
     files = argc - 1;
@@ -107,19 +51,25 @@ int main(int argc, char **argv)
         return 1; \
     } \
 } while(0)
-    ALLOC(infiles, sizeof(FILE*)*files);
-    ALLOC(headers, sizeof(struct OggHeader)*files);
+    ALLOC(readers, sizeof(struct OggReader)*files);
+    ALLOC(pages, sizeof(struct OggPage)*files);
     ALLOC(alive, sizeof(int)*files);
     ALLOC(used, sizeof(int)*files);
 #undef ALLOC
 
+    if (!oggWriterInit(&writer, 1, 0)) {
+        perror("malloc");
+        return 1;
+    }
+
     // Open all the input files
     for (fi = 0; fi < files; fi++) {
-        infiles[fi] = open(argv[fi+1], O_RDONLY);
-        if (infiles[fi] == -1) {
+        if (!oggReaderOpen(&readers[fi], 1, &argv[fi+1])) {
             perror(argv[fi+1]);
             exit(1);
         }
+        oggWriterAttach(&writer, &readers[fi]);
+        oggProgressAddReader(&readers[fi]);
         alive[fi] = 1;
         used[fi] = 1;
     }
@@ -128,17 +78,7 @@ int main(int argc, char **argv)
         for (fi = 0; fi < files; fi++) {
             if (!used[fi] || !alive[fi])
                 continue;
-            if (readAll(infiles[fi], &preHeader, sizeof(preHeader)) != sizeof(preHeader)) {
-                alive[fi] = 0;
-                continue;
-            }
-            if (memcmp(preHeader.capturePattern, "OggS", 4)) {
-                alive[fi] = 0;
-                continue;
-            }
-
-            // OK, it's a valid ogg packet. Try to read the header.
-            if (readAll(infiles[fi], &headers[fi], sizeof(struct OggHeader)) != sizeof(struct OggHeader)) {
+            if (!oggReadPage(&readers[fi], &pages[fi])) {
                 alive[fi] = 0;
                 continue;
             }
@@ -148,49 +88,26 @@ int main(int argc, char **argv)
         // Now figure out the current timestamp
         pos = -1;
         for (fi = 0; fi < files; fi++) {
-            if (!used[fi] && headers[fi].granulePos < pos)
-                pos = headers[fi].granulePos;
+            if (!used[fi] && pages[fi].header->granulePos < pos)
+                pos = pages[fi].header->granulePos;
         }
         if (pos == -1)
             break;
 
         // And output each packet at that timestamp
         for (fi = 0; fi < files; fi++) {
-            if (used[fi] || headers[fi].granulePos > pos)
+            if (used[fi] || pages[fi].header->granulePos > pos)
                 continue;
-
-            // Get the data size
-            packetSize = 0;
-            if (readAll(infiles[fi], &segmentCount, 1) != 1)
-                goto bad;
-            for (; segmentCount; segmentCount--) {
-                if (readAll(infiles[fi], &segmentVal, 1) != 1)
-                    goto bad;
-                packetSize += (uint32_t) segmentVal;
-            }
-
-            // Get the data
-            if (packetSize > bufSz) {
-                buf = realloc(buf, packetSize);
-                if (!buf)
-                    break;
-                bufSz = packetSize;
-            }
-            if (readAll(infiles[fi], buf, packetSize) != packetSize)
-                goto bad;
-
-            // And output it
-            writeOgg(&headers[fi], buf, packetSize);
-            used[fi] = 1;
-            continue;
-
-bad:
-            alive[fi] = 0;
+            if (!oggWriteRawPage(&writer, pages[fi].header, pages[fi].data, pages[fi].size))
+                exit(1);
+            oggProgress.packets++;
             used[fi] = 1;
         }
-        if (!buf)
-            break;
     }
 
+    if (!oggWriterFree(&writer))
+        exit(1);
+
+    oggProgressDone();
     return 0;
 }
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* oggopus does for Opus tracks what cook.sh otherwise does with
+ * oggcorrect | ffmpeg | wavduration | opusenc: it corrects a track and writes
+ * it as a standalone Ogg Opus file of exactly the given duration. The packets
+ * are the recording's own, so nothing is decoded or encoded; they're only
+ * packed into pages with granule positions counted from the packets
+ * themselves, then padded with silence or trimmed (by the last page's granule
+ * position) to the duration. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "oggcorr.h"
+#include "oggpage.h"
+
+// Ogg page types
+#define PAGE_BOS 2
+#define PAGE_EOS 4
+
+// How much a page may hold before we start another: at most a second
+#define PAGE_SAMPLES 48000
+
+#define OUT_BUF_SZ (64*1024)
+
+// The encoding for a packet with only zeroes (20ms)
+static const unsigned char zeroPacket[] = { 0xF8, 0xFF, 0xFE };
+
+struct Remux {
+    uint32_t streamNo, sequenceNo;
+
+    // Samples (at 48kHz) to skip from the start, and to write in all after that
+    uint32_t preSkip;
+    double duration;
+    uint64_t end;
+
+    // Samples in the packets written so far (the granule position)
+    uint64_t granulePos;
+    uint64_t packets;
+    int head, tags;
+
+    // The page we're filling
+    unsigned char lacing[255];
+    int lacingCt;
+    unsigned char data[255*255];
+    uint32_t dataSize;
+    uint32_t pageSamples;
+
+    // Pages ready to write
+    unsigned char out[OUT_BUF_SZ];
+    size_t outUsed;
+};
+
+ssize_t writeAll(int fd, const void *vbuf, size_t count)
+{
+    const unsigned char *buf = (const unsigned char *) vbuf;
+    ssize_t wr = 0, ret;
+    while (wr < count) {
+        ret = write(fd, buf + wr, count - wr);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR)
+                continue;
+            return ret;
+        }
+        wr += ret;
+    }
+    return wr;
+}
+
+void flushOut(struct Remux *remux)
+{
+    if (writeAll(1, remux->out, remux->outUsed) != remux->outUsed) {
+        perror("write");
+        exit(1);
+    }
+    remux->outUsed = 0;
+}
+
+// Write out the page we've filled, with this type and granule position
+void writePage(struct Remux *remux, unsigned char type, uint64_t granulePos)
+{
+    struct OggHeader header;
+    unsigned char *page;
+    size_t size = sizeof(struct OggPreHeader) + sizeof(header) + 1 + remux->lacingCt + remux->dataSize;
+    uint32_t crc = 0;
+
+    if (remux->outUsed + size > sizeof(remux->out))
+        flushOut(remux);
+    page = remux->out + remux->outUsed;
+
+    header.type = type;
+    header.granulePos = granulePos;
+    header.streamNo = remux->streamNo;
+    header.sequenceNo = remux->sequenceNo++;
+    header.crc = 0;
+    memcpy(page, "OggS\0", 5);
+    memcpy(page + 5, &header, sizeof(header));
+    page[5 + sizeof(header)] = remux->lacingCt;
+    memcpy(page + 6 + sizeof(header), remux->lacing, remux->lacingCt);
+    memcpy(page + 6 + sizeof(header) + remux->lacingCt, remux->data, remux->dataSize);
+    crc32(page, size, &crc);
+    memcpy(page + 5 + offsetof(struct OggHeader, crc), &crc, sizeof(crc));
+    remux->outUsed += size;
+
+    remux->lacingCt = 0;
+    remux->dataSize = 0;
+    remux->pageSamples = 0;
+}
+
+// Add a packet to the page we're filling
+void addPacket(struct Remux *remux, const unsigned char *buf, uint32_t size)
+{
+    uint32_t sizeMod = size;
+    while (sizeMod >= 255) {
+        remux->lacing[remux->lacingCt++] = 255;
+        sizeMod -= 255;
+    }
+    remux->lacing[remux->lacingCt++] = sizeMod;
+    memcpy(remux->data + remux->dataSize, buf, size);
+    remux->dataSize += size;
+}
+
+// How many samples (at 48kHz) this packet decodes to, by its TOC byte
+uint32_t packetSamples(const unsigned char *buf, uint32_t size)
+{
+    static const uint32_t silkSizes[] = {480, 960, 1920, 2880};
+    static const uint32_t celtSizes[] = {120, 240, 480, 960};
+    unsigned char config = buf[0] >> 3;
+    uint32_t frameSize, frames;
+
+    // https://datatracker.ietf.org/doc/html/rfc6716#section-3.1
+    if (config < 12)
+        frameSize = silkSizes[config & 3];
+    else if (config < 16)
+        frameSize = (config & 1) ? 960 : 480;
+    else
+        frameSize = celtSizes[config & 3];
+
+    switch (buf[0] & 3) {
+        case 0:
+            frames = 1;
+            break;
+        case 3:
+            frames = (size > 1) ? (buf[1] & 0x3F) : 0;
+            break;
+        default:
+            frames = 2;
+    }
+    return frameSize * frames;
+}
+
+// Make sure the headers are done before any data
+void startData(struct Remux *remux)
+{
+    if (!remux->head) {
+        fprintf(stderr, "oggopus: Track %u isn't Opus\n", remux->streamNo);
+        exit(1);
+    }
+    if (!remux->tags) {
+        // No comment header, so make an empty one
+        static const unsigned char emptyTags[] = "OpusTags\5\0\0\0Craig\0\0\0\0";
+        addPacket(remux, emptyTags, sizeof(emptyTags) - 1);
+        writePage(remux, 0, 0);
+        remux->tags = 1;
+    }
+}
+
+// Write a data packet, as long as we're not already past the end
+void writeData(struct Remux *remux, const unsigned char *buf, uint32_t size)
+{
+    uint32_t samples;
+
+    startData(remux);
+    if (!size || remux->granulePos >= remux->end) {
+        // Anything more would be cut off anyway
+        return;
+    }
+
+    // Pages hold whole packets, and go up to a second
+    samples = packetSamples(buf, size);
+    if (remux->lacingCt + size / 255 + 1 > 255 || remux->dataSize + size > sizeof(remux->data) ||
+        remux->pageSamples >= PAGE_SAMPLES)
+        writePage(remux, 0, remux->granulePos);
+    addPacket(remux, buf, size);
+    remux->pageSamples += samples;
+    remux->granulePos += samples;
+    remux->packets++;
+}
+
+// The headers each get a page of their own
+void writeHeader(struct Remux *remux, const unsigned char *buf, uint32_t size)
+{
+    if (!remux->head && size >= 19 && !memcmp(buf, "OpusHead", 8) && (buf[8] & 0xF0) == 0) {
+        remux->preSkip = buf[10] | (buf[11] << 8);
+        remux->end = remux->preSkip + (uint64_t) (remux->duration * 48000);
+        addPacket(remux, buf, size);
+        writePage(remux, PAGE_BOS, 0);
+        remux->head = 1;
+
+    } else if (remux->head && !remux->tags && size >= 16 && !memcmp(buf, "OpusTags", 8)) {
+        addPacket(remux, buf, size);
+        writePage(remux, 0, 0);
+        remux->tags = 1;
+
+    }
+}
+
+void corrected(void *arg, struct OggCorrectTrack *track, int header,
+               struct OggHeader *oggHeader, const unsigned char *data, uint32_t size)
+{
+    if (header)
+        writeHeader(arg, data, size);
+    else
+        writeData(arg, data, size);
+}
+
+void usage()
+{
+    fprintf(stderr, "Use: oggopus [--progress-fd <fd>] <track no> <duration> [input files]\n"
+                    "Writes the track, which must be Opus, as Ogg Opus of exactly the given\n"
+                    "duration, in seconds, without decoding it.\n"
+                    "With no input files, the input on stdin must be given twice.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static struct Remux remux;
+    struct OggCorrector corrector;
+    struct OggReader reader;
+
+    oggProgressArgs(&argc, argv, "oggopus");
+    if (argc < 3)
+        usage();
+    remux.duration = atof(argv[2]);
+    if (remux.duration < 0)
+        usage();
+
+    if (!oggCorrectorInit(&corrector, 0, NULL, corrected, &remux)) {
+        perror("malloc");
+        exit(1);
+    }
+    remux.streamNo = atoi(argv[1]);
+    oggCorrectAddTrack(&corrector, remux.streamNo);
+
+    if (!oggReaderOpen(&reader, argc - 3, argv + 3)) {
+        perror("open");
+        exit(1);
+    }
+    oggProgressAddReader(&reader);
+    oggProgress.passes = 2;
+
+    oggCorrect(&corrector, &reader);
+
+    /* Fill out the rest of the duration with silence, then trim any excess
+     * with the last page's granule position */
+    while (remux.granulePos < remux.end)
+        writeData(&remux, zeroPacket, sizeof(zeroPacket));
+    if (!remux.packets) {
+        // With nothing to play, there must still be a packet for the last page
+        startData(&remux);
+        addPacket(&remux, zeroPacket, sizeof(zeroPacket));
+    }
+    writePage(&remux, PAGE_EOS, remux.end);
+    flushOut(&remux);
+
+    oggProgressDone();
+    return 0;
+}
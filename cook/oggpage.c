@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "oggpage.h"
+
+/* How much we read at once. Big enough that a whole run of 20ms pages comes in
+ * with one syscall, and always at least one maximum-size page. */
+#define OGG_READER_BUFSZ (1024*1024)
+
+#define HEADER_SZ (sizeof(struct OggPreHeader) + sizeof(struct OggHeader))
+
+// Minimum time between progress reports, in ns
+#define OGG_PROGRESS_INTERVAL 250000000ull
+
+struct OggProgress oggProgress = {.fd = -1, .tool = "", .totalKnown = 1, .passes = 1};
+
+// Count this page into our progress
+static void progressPage(const struct OggPage *page, size_t len)
+{
+    oggProgress.bytes += len;
+    if (page->header->granulePos != (uint64_t) -1 &&
+        page->header->granulePos > oggProgress.granulePos)
+        oggProgress.granulePos = page->header->granulePos;
+    oggProgressTick();
+}
+
+// Map this source if we can. Failing that, it's read through the buffer.
+static void mapSource(struct OggSource *source)
+{
+    struct stat sbuf;
+    void *map;
+
+    source->map = NULL;
+    source->size = 0;
+    source->seekable = 0;
+    if (fstat(source->fd, &sbuf) != 0 || !S_ISREG(sbuf.st_mode))
+        return;
+    source->size = sbuf.st_size;
+    source->seekable = 1;
+
+    if (sbuf.st_size == 0) {
+        // Nothing to map, but nothing to read either
+        source->map = (const unsigned char *) "";
+        return;
+    }
+
+    map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_SHARED, source->fd, 0);
+    if (map == MAP_FAILED)
+        return;
+    madvise(map, sbuf.st_size, MADV_SEQUENTIAL);
+    source->map = map;
+}
+
+static int initSources(struct OggReader *reader, int count)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->sources = calloc(count, sizeof(struct OggSource));
+    if (!reader->sources)
+        return 0;
+    reader->sourceCt = count;
+    return 1;
+}
+
+int oggReaderInit(struct OggReader *reader, int fd)
+{
+    if (!initSources(reader, 1))
+        return 0;
+    reader->sources[0].fd = fd;
+    mapSource(&reader->sources[0]);
+    return 1;
+}
+
+int oggReaderOpen(struct OggReader *reader, int files, char *const *paths)
+{
+    int i;
+
+    if (files == 0)
+        return oggReaderInit(reader, 0);
+
+    if (!initSources(reader, files))
+        return 0;
+    for (i = 0; i < files; i++) {
+        struct OggSource *source = &reader->sources[i];
+        if (!strcmp(paths[i], "-")) {
+            source->fd = 0;
+        } else {
+            source->fd = open(paths[i], O_RDONLY);
+            if (source->fd < 0) {
+                int err = errno;
+                reader->sourceCt = i;
+                oggReaderFree(reader);
+                errno = err;
+                return 0;
+            }
+            source->ownFd = 1;
+        }
+        mapSource(source);
+    }
+
+    return 1;
+}
+
+void oggReaderFree(struct OggReader *reader)
+{
+    int i;
+    for (i = 0; i < reader->sourceCt; i++) {
+        struct OggSource *source = &reader->sources[i];
+        if (source->map && source->size)
+            munmap((void *) source->map, source->size);
+        if (source->ownFd)
+            close(source->fd);
+    }
+    free(reader->sources);
+    free(reader->buf);
+    memset(reader, 0, sizeof(*reader));
+}
+
+/* Parse the page at base, if there's a whole one in avail bytes. Returns 1 if
+ * so, 0 if it isn't a page at all, and -1 if we need at least *need bytes. */
+static int parsePage(const unsigned char *base, size_t avail,
+                     struct OggPage *page, size_t *need)
+{
+    unsigned char segmentCount;
+    uint32_t size = 0;
+    int i;
+
+    // Check the pre-header
+    if (avail < HEADER_SZ + 1) {
+        *need = HEADER_SZ + 1;
+        return -1;
+    }
+    if (memcmp(base, "OggS", 4))
+        return 0;
+
+    // Get the data size
+    segmentCount = base[HEADER_SZ];
+    if (avail < HEADER_SZ + 1 + segmentCount) {
+        *need = HEADER_SZ + 1 + segmentCount;
+        return -1;
+    }
+    for (i = 0; i < segmentCount; i++)
+        size += base[HEADER_SZ + 1 + i];
+
+    // Get the data
+    *need = HEADER_SZ + 1 + segmentCount + size;
+    if (avail < *need)
+        return -1;
+
+    page->header = (const struct OggHeader *) (base + sizeof(struct OggPreHeader));
+    page->segmentCount = segmentCount;
+    page->segments = base + HEADER_SZ + 1;
+    page->data = page->segments + segmentCount;
+    page->size = size;
+    return 1;
+}
+
+// Make sure at least this many bytes of an unmapped source are buffered
+static int ensure(struct OggReader *reader, int fd, size_t count)
+{
+    ssize_t rd;
+
+    if (reader->bufEnd - reader->bufStart >= count)
+        return 1;
+
+    if (reader->beforeRefill)
+        reader->beforeRefill(reader->beforeRefillArg);
+
+    if (!reader->buf) {
+        reader->bufSz = OGG_READER_BUFSZ;
+        reader->buf = malloc(reader->bufSz);
+        if (!reader->buf)
+            return 0;
+    }
+
+    // Move what's left to the front to make room
+    if (reader->bufStart) {
+        memmove(reader->buf, reader->buf + reader->bufStart,
+                reader->bufEnd - reader->bufStart);
+        reader->bufEnd -= reader->bufStart;
+        reader->bufStart = 0;
+    }
+
+    while (reader->bufEnd < count) {
+        if (reader->eof)
+            return 0;
+        rd = read(fd, reader->buf + reader->bufEnd,
+                  reader->bufSz - reader->bufEnd);
+        if (rd < 0 && errno == EINTR)
+            continue;
+        if (rd <= 0) {
+            reader->eof = 1;
+            return 0;
+        }
+        reader->bufEnd += rd;
+    }
+
+    return 1;
+}
+
+// Move on to the next source, remembering where it starts
+static void nextSource(struct OggReader *reader)
+{
+    struct OggSource *source = &reader->sources[reader->source];
+    uint64_t end;
+
+    if (source->map)
+        end = source->start + source->size;
+    else
+        end = source->start + reader->bufOffset + (reader->bufEnd - reader->bufStart);
+
+    reader->source++;
+    if (reader->source < reader->sourceCt)
+        reader->sources[reader->source].start = end;
+    reader->mapPos = 0;
+    reader->bufStart = reader->bufEnd = 0;
+    reader->bufOffset = 0;
+    reader->eof = 0;
+}
+
+int oggReadPage(struct OggReader *reader, struct OggPage *page)
+{
+    struct OggSource *source;
+    size_t need;
+    int ret;
+
+    while (reader->source < reader->sourceCt) {
+        source = &reader->sources[reader->source];
+
+        if (source->map) {
+            ret = parsePage(source->map + reader->mapPos,
+                            source->size - reader->mapPos, page, &need);
+            if (ret < 0) {
+                // Nothing (or only a partial page) left in this source
+                nextSource(reader);
+                continue;
+            } else if (ret == 0) {
+                return 0;
+            }
+            page->offset = source->start + reader->mapPos;
+            reader->mapPos += need;
+            if (oggProgress.fd >= 0)
+                progressPage(page, need);
+            return 1;
+        }
+
+        need = HEADER_SZ + 1;
+        while ((ret = parsePage(reader->buf + reader->bufStart,
+                                reader->bufEnd - reader->bufStart,
+                                page, &need)) < 0) {
+            if (!ensure(reader, source->fd, need))
+                break;
+        }
+        if (ret < 0) {
+            nextSource(reader);
+            continue;
+        } else if (ret == 0) {
+            return 0;
+        }
+        page->offset = source->start + reader->bufOffset;
+        reader->bufStart += need;
+        reader->bufOffset += need;
+        if (oggProgress.fd >= 0)
+            progressPage(page, need);
+        return 1;
+    }
+
+    return 0;
+}
+
+int oggReaderSeek(struct OggReader *reader, uint64_t offset, int sequential)
+{
+    struct OggSource *source;
+    int i, found = -1;
+
+    for (i = 0; i < reader->sourceCt; i++) {
+        source = &reader->sources[i];
+        if (!source->seekable)
+            return 0;
+        if (i)
+            source->start = reader->sources[i-1].start + reader->sources[i-1].size;
+        if (found < 0 && offset < source->start + source->size)
+            found = i;
+        if (source->map && source->size)
+            madvise((void *) source->map, source->size,
+                    sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    }
+
+    if (reader->beforeRefill)
+        reader->beforeRefill(reader->beforeRefillArg);
+    reader->mapPos = 0;
+    reader->bufStart = reader->bufEnd = 0;
+    reader->bufOffset = 0;
+    reader->eof = 0;
+
+    if (found < 0) {
+        // Seeking to the end
+        reader->source = reader->sourceCt;
+        return 1;
+    }
+
+    // Anything unmapped after this needs to be read from the start again
+    for (i = found + 1; i < reader->sourceCt; i++) {
+        source = &reader->sources[i];
+        if (!source->map && lseek(source->fd, 0, SEEK_SET) < 0)
+            return 0;
+    }
+
+    reader->source = found;
+    source = &reader->sources[found];
+    if (source->map) {
+        reader->mapPos = offset - source->start;
+    } else {
+        if (lseek(source->fd, offset - source->start, SEEK_SET) < 0)
+            return 0;
+        reader->bufOffset = offset - source->start;
+    }
+    return 1;
+}
+
+void oggProgressArgs(int *argc, char **argv, const char *tool)
+{
+    int ai;
+
+    oggProgress.tool = tool;
+    for (ai = 1; ai < *argc; ai++) {
+        if (!strcmp(argv[ai], "--"))
+            break;
+        if (!strcmp(argv[ai], "--progress-fd") && ai + 1 < *argc) {
+            oggProgress.fd = atoi(argv[ai+1]);
+            memmove(argv + ai, argv + ai + 2, (*argc - ai - 1) * sizeof(char *));
+            *argc -= 2;
+            break;
+        }
+    }
+}
+
+void oggProgressAddReader(const struct OggReader *reader)
+{
+    int si;
+    for (si = 0; si < reader->sourceCt; si++) {
+        if (reader->sources[si].seekable)
+            oggProgress.total += reader->sources[si].size;
+        else
+            oggProgress.totalKnown = 0;
+    }
+}
+
+static void progressReport(int done)
+{
+    char buf[512], total[32];
+    int len;
+
+    if (oggProgress.totalKnown)
+        snprintf(total, sizeof(total), "%llu",
+            (unsigned long long) (oggProgress.total * oggProgress.passes));
+    else
+        strcpy(total, "null");
+
+    len = snprintf(buf, sizeof(buf),
+        "{\"tool\":\"%s\",\"pid\":%d,\"bytes\":%llu,\"total\":%s,\"packets\":%llu,"
+        "\"gaps\":%llu,\"drops\":%llu,\"granule\":%llu%s}\n",
+        oggProgress.tool, (int) getpid(),
+        (unsigned long long) oggProgress.bytes, total,
+        (unsigned long long) oggProgress.packets,
+        (unsigned long long) oggProgress.gaps,
+        (unsigned long long) oggProgress.drops,
+        (unsigned long long) oggProgress.granulePos,
+        done ? ",\"done\":true" : "");
+
+    // Progress is only advisory, so if the fd has gone bad, stop trying
+    if (write(oggProgress.fd, buf, len) != len)
+        oggProgress.fd = -1;
+}
+
+void oggProgressTick(void)
+{
+    struct timespec ts;
+    uint64_t now;
+
+    if (oggProgress.fd < 0)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    if (oggProgress.last && now - oggProgress.last < OGG_PROGRESS_INTERVAL)
+        return;
+    oggProgress.last = now;
+    progressReport(0);
+}
+
+void oggProgressDone(void)
+{
+    if (oggProgress.fd < 0)
+        return;
+    progressReport(1);
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OGGPAGE_H
+#define OGGPAGE_H 1
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* NOTE: We don't use libogg here because the behavior of these programs is so
+ * trivial, the added memory bandwidth of using it is just a waste of energy */
+
+/* NOTE: This code assumes little-endian for speed. It WILL NOT WORK on a
+ * big-endian system. */
+
+struct OggPreHeader {
+    unsigned char capturePattern[4];
+    unsigned char version;
+} __attribute__((packed));
+
+struct OggHeader {
+    unsigned char type;
+    uint64_t granulePos;
+    uint32_t streamNo;
+    uint32_t sequenceNo;
+    uint32_t crc;
+} __attribute__((packed));
+
+/* The most a single page can take: pre-header, header, segment count, 255
+ * lacing values and 255 full segments */
+#define OGG_MAX_PAGE_SIZE (sizeof(struct OggPreHeader) + \
+    sizeof(struct OggHeader) + 1 + 255 + 255*255)
+
+/* A page as handed out by the reader. Everything points into the reader's own
+ * buffer or mapping, so it's only valid until the next oggReadPage or
+ * oggReaderSeek on the same reader. */
+struct OggPage {
+    const struct OggHeader *header;
+    const unsigned char *segments;
+    unsigned char segmentCount;
+    const unsigned char *data;
+    uint32_t size; // Sum of the lacing values
+    uint64_t offset; // Offset of the page from the start of the input
+};
+
+/* One input file. Regular files are mapped, anything else (pipes, mostly) is
+ * read through the reader's buffer. */
+struct OggSource {
+    int fd, ownFd;
+    const unsigned char *map; // NULL if not mapped
+    size_t size; // Size of the file, if it's a regular file
+    int seekable; // Set for regular files, mapped or not
+    uint64_t start; // Offset of this source in the whole input
+};
+
+struct OggReader {
+    struct OggSource *sources;
+    int sourceCt, source;
+
+    // Position in the current source, if it's mapped
+    size_t mapPos;
+
+    // Buffer for the current source, if it isn't
+    unsigned char *buf;
+    size_t bufSz, bufStart, bufEnd;
+    uint64_t bufOffset; // Offset of buf[bufStart] in the current source
+    int eof;
+
+    /* If set, called before the buffer is reused, which would change the data
+     * of pages we've already returned. Anyone holding onto that data (like an
+     * OggWriter) should be done with it by the time this returns. */
+    void (*beforeRefill)(void *arg);
+    void *beforeRefillArg;
+};
+
+// Set up a reader over this fd. Returns 0 on failure.
+int oggReaderInit(struct OggReader *reader, int fd);
+
+/* Set up a reader over these files in sequence, or stdin if there are none.
+ * "-" also means stdin. Returns 0 on failure, with errno set. */
+int oggReaderOpen(struct OggReader *reader, int files, char *const *paths);
+
+void oggReaderFree(struct OggReader *reader);
+
+/* Read the next page. Returns 1 on success, 0 at the end of the input or on
+ * anything that isn't a valid page. Pages never span two sources. */
+int oggReadPage(struct OggReader *reader, struct OggPage *page);
+
+/* Move to this offset of the whole input, as from a page's offset field. Only
+ * possible when every source is a regular file; returns 0 otherwise. Regular
+ * files that couldn't be mapped (e.g. under a ulimit) are read from the new
+ * position through the buffer. sequential
+ * should be set when the caller is going to scan on from there, and unset for
+ * random access, so that we can tell the kernel what readahead to do. */
+int oggReaderSeek(struct OggReader *reader, uint64_t offset, int sequential);
+
+/* Progress reporting. With --progress-fd, a tool writes a compact JSON line to
+ * that fd now and then, and once more when it's done:
+ * {"tool":"oggcorrect","pid":N,"bytes":N,"total":N,"packets":N,"gaps":N,"drops":N,"granule":N}
+ * bytes and granule are updated by oggReadPage, the rest by whoever knows
+ * about them. total is null if the input isn't all regular files. */
+struct OggProgress {
+    int fd; // -1 if we're not reporting
+    const char *tool;
+    uint64_t bytes, total, packets, gaps, drops, granulePos;
+    int totalKnown;
+    int passes; // How many times the tool reads its input
+    uint64_t last; // Time of the last report, in ns
+};
+
+extern struct OggProgress oggProgress;
+
+/* Take --progress-fd <fd> out of the arguments, wherever it is, and start
+ * reporting to it */
+void oggProgressArgs(int *argc, char **argv, const char *tool);
+
+// Count this reader's input into the total, if it's known
+void oggProgressAddReader(const struct OggReader *reader);
+
+// Report, if it's been long enough since the last report
+void oggProgressTick(void);
+
+// Report for the last time
+void oggProgressDone(void);
+
+#endif
@@ -14,35 +14,15 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
-#include <sys/select.h>
 #include <unistd.h>
 
-#include "crc32.h"
-
-/* NOTE: We don't use libogg here because the behavior of this program is so
- * trivial, the added memory bandwidth of using it is just a waste of energy */
-
-/* NOTE: This program assumes little-endian for speed, it WILL NOT WORK on a
- * big-endian system */
-
-struct OggPreHeader {
-    unsigned char capturePattern[4];
-    unsigned char version;
-} __attribute__((packed));
-
-struct OggHeader {
-    unsigned char type;
-    uint64_t granulePos;
-    uint32_t streamNo;
-    uint32_t sequenceNo;
-    uint32_t crc;
-} __attribute__((packed));
+#include "oggpage.h"
+#include "oggwrite.h"
 
 // The encoding for a packet with only zeroes
 const unsigned char zeroPacket[] = { 0xF8, 0xFF, 0xFE };
@@ -56,77 +36,15 @@ const unsigned char zeroPacketFLAC48k[] = { 0xFF, 0xF8, 0x7A, 0x0C, 0x00, 0x03,
 const unsigned char zeroPacketFLAC44k[] = { 0xFF, 0xF8, 0x79, 0x0C, 0x00, 0x03,
     0x71, 0x56, 0x00, 0x00, 0x00, 0x00, 0x63, 0xC5 };
 
-ssize_t readAll(int fd, void *vbuf, size_t count)
-{
-    unsigned char *buf = (unsigned char *) vbuf;
-    ssize_t rd = 0, ret;
-    while (rd < count) {
-        ret = read(fd, buf + rd, count - rd);
-        if (ret <= 0) return ret;
-        rd += ret;
-    }
-    return rd;
-}
-
-ssize_t writeAll(int fd, const void *vbuf, size_t count)
-{
-    const unsigned char *buf = (const unsigned char *) vbuf;
-    ssize_t wt = 0, ret;
-    while (wt < count) {
-        ret = write(fd, buf + wt, count - wt);
-
-        if (ret <= 0) {
-            if (ret < 0 && errno == EAGAIN) {
-                // Wait 'til we can write again
-                fd_set wfds;
-                FD_ZERO(&wfds);
-                FD_SET(fd, &wfds);
-                select(fd + 1, NULL, &wfds, NULL, NULL);
-                continue;
-            }
-
-            perror("write");
-            return ret;
-        }
-        wt += ret;
-    }
-    return wt;
-}
+// Everything goes to stdout
+static struct OggWriter writer;
 
 void writeOgg(struct OggHeader *header, const unsigned char *data, uint32_t size)
 {
-    static unsigned char seqBuf[256];
-    uint32_t seqCt = 0;
-    uint32_t sizeMod;
-    uint32_t crc;
-
-    // Calculate the sequence info
-    seqBuf[seqCt++] = (size+255)/255;
-    sizeMod = size;
-    while (sizeMod >= 255) {
-        seqBuf[seqCt++] = 255;
-        sizeMod -= 255;
-    }
-    seqBuf[seqCt++] = sizeMod;
-
-    // Calculate the CRC
-    header->crc = 0;
-    crc = 0xf07159ba; // crc32("OggS\0", 5, &crc);
-    crc32(header, sizeof(*header), &crc);
-    crc32(seqBuf, seqCt, &crc);
-    crc32(data, size, &crc);
-    header->crc = crc;
-
-    // Write the header
-    if (writeAll(1, "OggS\0", 5) != 5 ||
-        writeAll(1, header, sizeof(*header)) != sizeof(*header))
+    if (!oggWritePage(&writer, header, data, size)) {
+        perror("write");
         exit(1);
-
-    // Write the sequence info
-    if (writeAll(1, seqBuf, seqCt) != seqCt) exit(1);
-
-    // Then write the data
-    if (writeAll(1, data, size) != size) exit(1);
+    }
 }
 
 int main(int argc, char **argv)
@@ -135,48 +53,33 @@ int main(int argc, char **argv)
     uint64_t trueGranulePos = 0;
     uint32_t lastSequenceNo = 0;
     uint32_t packetSize, skip, framesInPacket;
-    unsigned char segmentCount, segmentVal;
-    unsigned char *buf = NULL;
-    uint32_t bufSz = 0;
-    struct OggPreHeader preHeader;
+    struct OggReader reader;
+    struct OggPage page;
+    const unsigned char *buf;
     unsigned char vadLevel = 0, correctTimestampsUp = 0,
         correctTimestampsDown = 0, lastWasSilence = 1;
     uint32_t flacRate = 0;
 
-    if (argc != 2) {
-        fprintf(stderr, "Use: oggstender <track no>\n");
+    if (argc < 2) {
+        fprintf(stderr, "Use: oggstender <track no> [input files]\n");
         exit(1);
     }
     keepStreamNo = atoi(argv[1]);
 
-    while (readAll(0, &preHeader, sizeof(preHeader)) == sizeof(preHeader)) {
-        struct OggHeader oggHeader;
-        if (memcmp(preHeader.capturePattern, "OggS", 4))
-            break;
-
-        // It's an ogg header, get the header data
-        if (readAll(0, &oggHeader, sizeof(oggHeader)) != sizeof(oggHeader))
-            break;
-
-        // Get the data size
-        packetSize = 0;
-        if (readAll(0, &segmentCount, 1) != 1)
-            break;
-        for (; segmentCount; segmentCount--) {
-            if (readAll(0, &segmentVal, 1) != 1)
-                break;
-            packetSize += (uint32_t) segmentVal;
-        }
+    if (!oggReaderOpen(&reader, argc - 2, argv + 2)) {
+        perror("open");
+        exit(1);
+    }
+    if (!oggWriterInit(&writer, 1, 0)) {
+        perror("malloc");
+        exit(1);
+    }
+    oggWriterAttach(&writer, &reader);
 
-        // Get the data
-        if (packetSize > bufSz) {
-            buf = realloc(buf, packetSize);
-            if (!buf)
-                break;
-            bufSz = packetSize;
-        }
-        if (readAll(0, buf, packetSize) != packetSize)
-            break;
+    while (oggReadPage(&reader, &page)) {
+        struct OggHeader oggHeader = *page.header;
+        buf = page.data;
+        packetSize = page.size;
 
         // Do we care?
         if (oggHeader.streamNo != keepStreamNo)
@@ -187,7 +90,7 @@ int main(int argc, char **argv)
             skip = 0;
             if (packetSize > 8 && !memcmp(buf, "ECVADD", 6)) {
                 // It's our VAD header. Get our VAD info and skip
-                skip = 8 + *((unsigned short *) (buf + 6));
+                skip = 8 + *((const unsigned short *) (buf + 6));
                 if (packetSize > 10)
                     vadLevel = buf[10];
             }
@@ -368,5 +271,10 @@ int main(int argc, char **argv)
         }
     }
 
+    if (!oggWriterFree(&writer)) {
+        perror("write");
+        exit(1);
+    }
+
     return 0;
 }
@@ -21,40 +21,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-/* NOTE: We don't use libogg here because the behavior of this program is so
- * trivial, the added memory bandwidth of using it is just a waste of energy */
-
-/* NOTE: This program assumes little-endian for speed, it WILL NOT WORK on a
- * big-endian system */
+#include "oggpage.h"
 
 static unsigned char outTrackNum = 0;
 
-struct OggPreHeader {
-    unsigned char capturePattern[4];
-    unsigned char version;
-} __attribute__((packed));
-
-struct OggHeader {
-    unsigned char type;
-    uint64_t granulePos;
-    uint32_t streamNo;
-    uint32_t sequenceNo;
-    uint32_t crc;
-} __attribute__((packed));
-
-static ssize_t readAll(int fd, void *vbuf, size_t count)
-{
-    unsigned char *buf = (unsigned char *) vbuf;
-    ssize_t rd = 0, ret;
-    while (rd < count) {
-        ret = read(fd, buf + rd, count - rd);
-        if (ret <= 0) return ret;
-        rd += ret;
-    }
-    return rd;
-}
-
-static void out(struct OggHeader *header, int **alreadyPrinted, int *apSz, const char *type)
+static void out(const struct OggHeader *header, int **alreadyPrinted, int *apSz, const char *type)
 {
     if (*apSz <= header->streamNo) {
         int i, oldSz = *apSz;
@@ -82,49 +53,32 @@ int main(int argc, char **argv)
 {
     uint32_t packetSize;
     uint32_t skip;
-    unsigned char segmentCount, segmentVal;
-    unsigned char *buf = NULL;
-    uint32_t bufSz = 0;
-    struct OggPreHeader preHeader;
+    struct OggReader reader;
+    struct OggPage page;
+    const unsigned char *buf;
     int *alreadyPrinted = NULL;
     int apSz = 0;
 
-    if (argc > 1 && !strcmp(argv[1], "-n"))
+    if (argc > 1 && !strcmp(argv[1], "-n")) {
         outTrackNum = 1;
+        argc--;
+        argv++;
+    }
 
-    while (readAll(0, &preHeader, sizeof(preHeader)) == sizeof(preHeader)) {
-        struct OggHeader oggHeader;
-        if (memcmp(preHeader.capturePattern, "OggS", 4))
-            break;
-
-        // It's an ogg header, get the header data
-        if (readAll(0, &oggHeader, sizeof(oggHeader)) != sizeof(oggHeader))
-            break;
-
-        // Get the data size
-        packetSize = 0;
-        if (readAll(0, &segmentCount, 1) != 1)
-            break;
-        for (; segmentCount; segmentCount--) {
-            if (readAll(0, &segmentVal, 1) != 1)
-                break;
-            packetSize += (uint32_t) segmentVal;
-        }
+    if (!oggReaderOpen(&reader, argc - 1, argv + 1)) {
+        perror("open");
+        exit(1);
+    }
 
-        // Get the data
-        if (packetSize > bufSz) {
-            buf = realloc(buf, packetSize);
-            if (!buf)
-                break;
-            bufSz = packetSize;
-        }
-        if (readAll(0, buf, packetSize) != packetSize)
-            break;
+    while (oggReadPage(&reader, &page)) {
+        struct OggHeader oggHeader = *page.header;
+        buf = page.data;
+        packetSize = page.size;
 
         // Is it VAD data?
         skip = 0;
         if (packetSize > 8 && !memcmp(buf, "ECVADD", 6))
-            skip = 8 + *((unsigned short *) (buf+6));
+            skip = 8 + *((const unsigned short *) (buf+6));
         if (packetSize < skip + 5)
             continue;
 
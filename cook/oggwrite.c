@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "oggwrite.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Largest page header: capture pattern, header, segment count and lacing
+#define PAGE_HEADER_MAX (sizeof(struct OggPreHeader) + sizeof(struct OggHeader) + 1 + 255)
+
+int oggWriterInit(struct OggWriter *writer, int fd, size_t watermark)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = fd;
+    writer->watermark = watermark ? watermark : OGG_WRITER_WATERMARK;
+
+    // Two iovecs per page
+    writer->iovSz = IOV_MAX;
+    writer->iov = malloc(writer->iovSz * sizeof(struct iovec));
+    writer->bufSz = (writer->iovSz / 2) * PAGE_HEADER_MAX;
+    writer->buf = malloc(writer->bufSz);
+    if (!writer->iov || !writer->buf) {
+        free(writer->iov);
+        free(writer->buf);
+        return 0;
+    }
+    return 1;
+}
+
+int oggWriterFree(struct OggWriter *writer)
+{
+    int ret = oggWriterFlush(writer);
+    free(writer->iov);
+    free(writer->buf);
+    memset(writer, 0, sizeof(*writer));
+    return ret;
+}
+
+int oggWriterFlush(struct OggWriter *writer)
+{
+    struct iovec *iov = writer->iov;
+    int iovCt = writer->iovCt;
+    ssize_t ret;
+
+    while (iovCt) {
+        ret = writev(writer->fd, iov, iovCt > IOV_MAX ? IOV_MAX : iovCt);
+
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret < 0 && errno == EAGAIN) {
+                // Wait 'til we can write again
+                fd_set wfds;
+                FD_ZERO(&wfds);
+                FD_SET(writer->fd, &wfds);
+                select(writer->fd + 1, NULL, &wfds, NULL, NULL);
+                continue;
+            }
+            return 0;
+        }
+
+        // Skip whatever got written
+        while (iovCt && (size_t) ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovCt--;
+        }
+        if (ret) {
+            iov->iov_base = (char *) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    writer->iovCt = 0;
+    writer->bufUsed = 0;
+    writer->queued = 0;
+    return 1;
+}
+
+// Queue a page whose header has been built at hdr
+static int queuePage(struct OggWriter *writer, unsigned char *hdr, size_t hdrSize,
+                     const unsigned char *data, uint32_t size)
+{
+    writer->bufUsed += hdrSize;
+    writer->iov[writer->iovCt].iov_base = hdr;
+    writer->iov[writer->iovCt++].iov_len = hdrSize;
+    if (size) {
+        writer->iov[writer->iovCt].iov_base = (void *) data;
+        writer->iov[writer->iovCt++].iov_len = size;
+    }
+    writer->queued += hdrSize + size;
+
+    if (writer->queued >= writer->watermark)
+        return oggWriterFlush(writer);
+    return 1;
+}
+
+// Make room for another page, and build its header (less the CRC)
+static unsigned char *buildHeader(struct OggWriter *writer, const struct OggHeader *header,
+                                  uint32_t size, size_t *hdrSize)
+{
+    unsigned char *hdr;
+    size_t pos;
+    uint32_t sizeMod;
+
+    if (writer->iovCt + 2 > writer->iovSz ||
+        writer->bufUsed + PAGE_HEADER_MAX > writer->bufSz) {
+        if (!oggWriterFlush(writer))
+            return NULL;
+    }
+
+    hdr = writer->buf + writer->bufUsed;
+    memcpy(hdr, "OggS\0", 5);
+    memcpy(hdr + 5, header, sizeof(*header));
+    pos = 5 + sizeof(*header);
+
+    // The sequence info
+    hdr[pos++] = (size+255)/255;
+    sizeMod = size;
+    while (sizeMod >= 255) {
+        hdr[pos++] = 255;
+        sizeMod -= 255;
+    }
+    hdr[pos++] = sizeMod;
+
+    *hdrSize = pos;
+    return hdr;
+}
+
+int oggWritePage(struct OggWriter *writer, struct OggHeader *header,
+                 const unsigned char *data, uint32_t size)
+{
+    unsigned char *hdr;
+    size_t hdrSize;
+    uint32_t crc;
+
+    // One packet per page, so it has to fit in 255 lacing values
+    if (size >= 255*255)
+        return 0;
+    header->crc = 0;
+    hdr = buildHeader(writer, header, size, &hdrSize);
+    if (!hdr)
+        return 0;
+
+    // Calculate the CRC
+    crc = 0;
+    crc32(hdr, hdrSize, &crc);
+    crc32(data, size, &crc);
+    header->crc = crc;
+    memcpy(hdr + 5 + offsetof(struct OggHeader, crc), &crc, sizeof(crc));
+
+    return queuePage(writer, hdr, hdrSize, data, size);
+}
+
+int oggWriteRawPage(struct OggWriter *writer, const struct OggHeader *header,
+                    const unsigned char *data, uint32_t size)
+{
+    unsigned char *hdr;
+    size_t hdrSize;
+
+    if (size >= 255*255)
+        return 0;
+    hdr = buildHeader(writer, header, size, &hdrSize);
+    if (!hdr)
+        return 0;
+    return queuePage(writer, hdr, hdrSize, data, size);
+}
+
+static void flushWriter(void *arg)
+{
+    if (!oggWriterFlush((struct OggWriter *) arg)) {
+        perror("write");
+        exit(1);
+    }
+}
+
+void oggWriterAttach(struct OggWriter *writer, struct OggReader *reader)
+{
+    reader->beforeRefill = flushWriter;
+    reader->beforeRefillArg = writer;
+}
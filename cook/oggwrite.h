@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2017-2026 Yahweasel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OGGWRITE_H
+#define OGGWRITE_H 1
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "oggpage.h"
+
+// How much we queue up before writing, by default
+#define OGG_WRITER_WATERMARK (64*1024)
+
+/* Pages are queued up and written with one writev() once there's a
+ * watermark's worth. Page headers are built in our own buffer, but the data
+ * is only referenced, so it must stay put until the next flush. For data
+ * straight out of an OggReader, oggWriterAttach takes care of that. */
+struct OggWriter {
+    int fd;
+    size_t watermark;
+
+    // Page headers (capture pattern, header and lacing values)
+    unsigned char *buf;
+    size_t bufSz, bufUsed;
+
+    // What's queued, in order
+    struct iovec *iov;
+    int iovCt, iovSz;
+    size_t queued;
+};
+
+/* Set up a writer to this fd, writing whenever at least watermark bytes are
+ * queued (0 for the default). Returns 0 on failure. */
+int oggWriterInit(struct OggWriter *writer, int fd, size_t watermark);
+
+// Flush anything that's queued and free the writer
+int oggWriterFree(struct OggWriter *writer);
+
+/* Queue a page with this header and data as its only packet. The CRC is
+ * calculated and set in header. Returns 0 on failure. */
+int oggWritePage(struct OggWriter *writer, struct OggHeader *header,
+                 const unsigned char *data, uint32_t size);
+
+/* Queue a page with a header that's already right, CRC and all, as when
+ * passing pages through. Returns 0 on failure. */
+int oggWriteRawPage(struct OggWriter *writer, const struct OggHeader *header,
+                    const unsigned char *data, uint32_t size);
+
+// Write everything that's queued. Returns 0 on failure.
+int oggWriterFlush(struct OggWriter *writer);
+
+/* Flush this writer whenever the reader is about to reuse its buffer, so that
+ * data queued from pages it returned can't change underneath us. */
+void oggWriterAttach(struct OggWriter *writer, struct OggReader *reader);
+
+#endif
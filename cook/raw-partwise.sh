@@ -40,11 +40,11 @@ NICE="nice -n10 taskset 3 ionice -c3 chrt -i 0"
 if [ ! "$STREAMS" -o "$STREAMS" = info ]
 then
     # Output the recording info
-    timeout 10 "$SCRIPTBASE/cook/recinfo.js" "$ID"
+    timeout 10 "$SCRIPTBASE/cook/cookplan" info "$ID"
     if [ "$STREAMS" = "info" ]
     then
         # Also tell them the tracks
-        timeout 10 "$SCRIPTBASE/cook/oggtracks" -n < $ID.ogg.header1
+        timeout 10 "$SCRIPTBASE/cook/oggtracks" -n $ID.ogg.header1
         exit 0
     fi
 fi
@@ -54,7 +54,7 @@ if [ ! "$STREAMS" ]
 then
     # get every stream
     STREAMS=""
-    STREAM_NOS=`timeout 10 "$SCRIPTBASE/cook/oggtracks" -n < $ID.ogg.header1`
+    STREAM_NOS=`timeout 10 "$SCRIPTBASE/cook/oggtracks" -n $ID.ogg.header1`
     NB_STREAMS=`echo "$STREAM_NOS" | wc -l`
     for c in `seq 1 $NB_STREAMS`
     do
@@ -66,7 +66,6 @@ fi
 # Output each requested component
 for c in $STREAMS
 do
-    timeout $DEF_TIMEOUT cat $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data \
-        $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data |
-        timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/cook/oggcorrect" $c
+    timeout $DEF_TIMEOUT $NICE "$SCRIPTBASE/cook/oggcorrect" $c \
+        $ID.ogg.header1 $ID.ogg.header2 $ID.ogg.data
 done
@@ -22,6 +22,10 @@ APT_DEPENDENCIES=(
   unzip             # cook
   at                # cook
   lame              # cook
+  pkg-config        # cook
+  libopus-dev       # cook
+  libflac-dev       # cook
+  zlib1g-dev        # cook
   lsb-release       # redis
   curl              # redis
   gpg               # redis
@@ -409,7 +413,12 @@ start_app(){
 config_cook(){
   info "Building cook..."
   mkdir -p "$craig_dir/rec"
-  "$craig_dir/scripts/buildCook.sh"
+  if ! "$craig_dir/scripts/buildCook.sh"
+  then
+    error "Failed to build cook (cook/cookdriver is required to cook downloads)"
+    error "Make sure the cook packages (make, pkg-config, build-essential) were successfully installed and rerun this script"
+    exit 1
+  fi
   "$craig_dir/scripts/downloadCookBuilds.sh"
 }
 
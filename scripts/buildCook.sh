@@ -1,4 +1,9 @@
 SCRIPTBASE=`dirname "$0"`
 SCRIPTBASE=`realpath "$SCRIPTBASE"`
 cd "$SCRIPTBASE/../cook"
-for i in *.c; do gcc -O3 -o ${i%.c} $i; done && for i in *.svg; do dbus-run-session inkscape -o ${i%.svg}.png $i; done
+if ! make || [ ! -x cookdriver ]
+then
+    echo 'Failed to build cook. cook.sh runs cook/cookdriver, so downloads cannot be cooked without it.' >&2
+    exit 1
+fi
+for i in *.svg; do dbus-run-session inkscape -o ${i%.svg}.png $i; done
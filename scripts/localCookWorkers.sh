@@ -0,0 +1,36 @@
+# Run several cook servers on this host, as if they were on separate hosts:
+# each pinned to its own CPUs, with its own socket, and listening on its own
+# port, but all sharing rec/. Set COOK_WORKERS to what this prints to have the
+# download API send cooks to them.
+#
+# Use: localCookWorkers.sh [<servers> [<first port>]]
+SCRIPTBASE=`dirname "$0"`
+SCRIPTBASE=`realpath "$SCRIPTBASE"`
+COOKD="$SCRIPTBASE/../cook/cookd"
+
+SERVERS="${1:-2}"
+PORT="${2:-5040}"
+CPUS=`nproc`
+if [ "$SERVERS" -gt "$CPUS" ]
+then
+    SERVERS="$CPUS"
+fi
+
+PIDS=
+WORKERS=
+i=0
+while [ "$i" -lt "$SERVERS" ]
+do
+    # Disjoint CPU ranges, the last taking any left over
+    FIRST=$(( i * CPUS / SERVERS ))
+    LAST=$(( (i + 1) * CPUS / SERVERS - 1 ))
+    taskset -c "$FIRST-$LAST" "$COOKD" -s "/tmp/cookd-$i.sock" -l "127.0.0.1:$(( PORT + i ))" \
+        -j $(( LAST - FIRST + 1 )) serve &
+    PIDS="$PIDS $!"
+    WORKERS="$WORKERS${WORKERS:+,}127.0.0.1:$(( PORT + i ))"
+    i=$(( i + 1 ))
+done
+
+trap 'kill $PIDS; wait; exit 0' INT TERM
+echo "COOK_WORKERS=$WORKERS"
+wait